@@ -1,13 +1,16 @@
 #include "ClothSystem.h"
 
+#include "clothTopology.h"
+
 //TODO: Initialize here
-ClothSystem::ClothSystem(int rows, int cols)
+ClothSystem::ClothSystem(int rows, int cols, const TriangleMesh *obstacle)
 {
 	scale = 0.2;
 
 	numRows = rows;
 	numCols = cols;
 	m_numParticles = numRows * numCols;
+	m_state.resize(m_numParticles);
 
 	for (int axis = 0; axis < 3; axis++) {
 		swing[axis] = false;
@@ -15,6 +18,9 @@ ClothSystem::ClothSystem(int rows, int cols)
 	}
 	swing_length = 8;
 
+	mass = 1 * scale;
+	drag_coefficient = 0.5;
+
 	// characteristics of types of strings
 	float structural_length = 1 * scale;
 	float structural_stiffness = 450 * scale;
@@ -29,8 +35,8 @@ ClothSystem::ClothSystem(int rows, int cols)
 		
 			// for this system, we care about the position and the velocity
 			Vector3f top_left = Vector3f(-numRows/2, numCols/2, 0) * scale;
-			m_vVecState.push_back(Vector3f(j, 0, i) * scale + top_left);	// x
-			m_vVecState.push_back(Vector3f(0, 0, 0));				// v
+			m_state.setPosition(indexOf(i, j), Vector3f(j, 0, i) * scale + top_left);	// x
+			m_state.setVelocity(indexOf(i, j), Vector3f(0, 0, 0));				// v
 
 			// add structural springs
 			if (i < numRows - 1)
@@ -50,6 +56,11 @@ ClothSystem::ClothSystem(int rows, int cols)
 			if (j < numCols - 2)
 				add_spring(indexOf(i, j), indexOf(i, j+2), flex_length, flex_stiffness);
 			
+			// the quad's two triangles
+			if (i < numRows - 1 && j < numCols - 1) {
+				add_triangle(indexOf(i, j), indexOf(i, j+1), indexOf(i+1, j+1));
+				add_triangle(indexOf(i+1, j+1), indexOf(i+1, j), indexOf(i, j));
+			}
 		}
 	}
 
@@ -58,37 +69,225 @@ ClothSystem::ClothSystem(int rows, int cols)
 	// add_fixed_particle(indexOf(0, 0));
 	// add_fixed_particle(indexOf(0, numCols - 1));
 
-	add_obstacle(Vector3f(0, -2.5, 0), 2.50f);		// cube
-	add_obstacle(Vector3f(0, -1005, 0), 1000.0f);	// floor
+	initScene(obstacle);
+}
+
+ClothSystem::ClothSystem(const TriangleMesh &cloth, const TriangleMesh *obstacle)
+{
+	numRows = numCols = 0;
+	m_numParticles = (int)cloth.vertices.size();
+	m_state.resize(m_numParticles);
+
+	for (int axis = 0; axis < 3; axis++) {
+		swing[axis] = false;
+		swing_forwad[axis] = true;
+	}
+	swing_length = 8;
+
+	// just above the obstacle, free to fall on it
+	TriangleMesh mesh = cloth;
+	mesh.fit(Vector3f(0, 0, 0), 7);
+	Vector3f lo, hi;
+	mesh.bounds(lo, hi);
+	for (int i = 0; i < m_numParticles; i++) {
+		mesh.vertices[i][1] += 0.5f - lo[1];
+		m_state.setPosition(i, mesh.vertices[i]);
+		m_state.setVelocity(i, Vector3f(0, 0, 0));
+	}
+
+	vector<int> edges, bends;
+	findClothSprings(mesh.faces, edges, bends);
+
+	// the mean edge length plays the part of the grid spacing: the material
+	// is the grid's, per unit of it
+	double total = 0;
+	for (size_t e = 0; e < edges.size(); e += 2)
+		total += (mesh.vertices[edges[e]] - mesh.vertices[edges[e + 1]]).abs();
+	scale = edges.empty() ? 0.2f : (float)(2 * total / edges.size());
+
+	mass = 1 * scale;
+	drag_coefficient = 0.5;
+	float stiffness = 450 * scale;
+
+	springs.reserve((edges.size() + bends.size()) / 2);
+	for (size_t e = 0; e < edges.size(); e += 2)
+		add_spring(edges[e], edges[e + 1], (mesh.vertices[edges[e]] - mesh.vertices[edges[e + 1]]).abs(), stiffness);
+	for (size_t b = 0; b < bends.size(); b += 2)
+		add_spring(bends[b], bends[b + 1], (mesh.vertices[bends[b]] - mesh.vertices[bends[b + 1]]).abs(), stiffness);
+
+	for (int t = 0; t < mesh.numTriangles(); t++) {
+		const int *v = &mesh.faces[3*t];
+		if (v[0] != v[1] && v[1] != v[2] && v[2] != v[0])
+			add_triangle(v[0], v[1], v[2]);
+	}
+
+	initScene(obstacle);
+}
+
+ClothSystem::ClothSystem()
+{
+	numRows = numCols = 0;
+	scale = 0.2;
+}
+
+void ClothSystem::initScene(const TriangleMesh *obstacle)
+{
+	if (obstacle != 0)
+	{
+		// sampled finely enough for the collision shell of 0.1
+		m_obstacleMesh = *obstacle;
+		m_obstacleMesh.fit(Vector3f(0, -2.5, 0), 5);
+		Vector3f lo, hi;
+		m_obstacleMesh.bounds(lo, hi);
+		m_obstacleField.reset(lo - Vector3f(0.5f), hi + Vector3f(0.5f), 0.05f);
+		m_obstacleField.addMesh(m_obstacleMesh);
+	}
+	addObstacles();
+
+	color_springs();
+
+	m_meshCollision.setThickness(0.25 * scale);
+	m_meshCollision.build(triangles, m_state);
+}
+
+void ClothSystem::addObstacles()
+{
+	if (!m_obstacleField.empty())
+		add_obstacle(new FieldObstacle(&m_obstacleField, &m_obstacleMesh));
+	else
+		add_obstacle(Vector3f(0, -2.5, 0), 2.50f);		// sphere
+	add_obstacle(new PlaneObstacle(Vector3f(0, 1, 0), Vector3f(0, -5, 0)));	// floor
+}
+
+namespace
+{
+	struct ClothShape
+	{
+		int rows, cols;
+		float scale;
+	};
+}
+
+void ClothSystem::save(CheckpointWriter &out) const
+{
+	ParticleSystem::save(out);
+
+	ClothShape shape;
+	shape.rows = numRows;
+	shape.cols = numCols;
+	shape.scale = scale;
+	out.putValue("cloth", shape);
+
+	if (!m_obstacleField.empty())
+	{
+		out.putVector("obstacle.verts", m_obstacleMesh.vertices);
+		out.putVector("obstacle.norms", m_obstacleMesh.normals);
+		out.putVector("obstacle.faces", m_obstacleMesh.faces);
+		m_obstacleField.save(out);
+	}
+	m_meshCollision.save(out);
+}
+
+// only into a cloth constructed empty, which has no obstacles yet
+bool ClothSystem::restore(const CheckpointReader &in)
+{
+	ClothShape shape;
+	if (!obstacles.empty() || !in.getValue("cloth", shape))
+		return false;
+
+	size_t bytes;
+	if (in.find("field.phi", bytes) != 0)
+	{
+		if (!in.getVector("obstacle.verts", m_obstacleMesh.vertices) ||
+		    !in.getVector("obstacle.norms", m_obstacleMesh.normals) ||
+		    !in.getVector("obstacle.faces", m_obstacleMesh.faces) ||
+		    !m_obstacleField.restore(in))
+			return false;
+	}
+	if (!ParticleSystem::restore(in))
+		return false;
+
+	if (shape.rows < 0 || shape.cols < 0 || shape.rows * shape.cols != m_numParticles)
+		shape.rows = shape.cols = 0;	// drawn as a mesh
+	numRows = shape.rows;
+	numCols = shape.cols;
+	scale = shape.scale;
+	if (!restore_obstacles(in, m_obstacleField.empty() ? 0 : &m_obstacleField, &m_obstacleMesh))
+		return false;
+
+	m_meshCollision.setThickness(0.25 * scale);
+	if (!m_meshCollision.restore(in, m_state))
+		m_meshCollision.build(triangles, m_state);
+	return true;
 }
 
 int ClothSystem::indexOf(int i, int j)
 {
-	return i * numRows + j;
+	return i * numCols + j;
 }
 
 
 // TODO: implement evalF
 // for a given state, evaluate f(X,t)
-vector<Vector3f> ClothSystem::evalF(vector<Vector3f> state)
+void ClothSystem::evalF(const ParticleState &state, ParticleState &f)
 {
-	vector<Vector3f> f;
-
-	float mass = 1 * scale;
-	float drag_coefficient = 0.5;
 	float wind = 25;
 
 	init_f(state, f);
 	apply_gravity_forces(state, f);
 	apply_drag_forces(state, f, drag_coefficient, mass);
 	apply_spring_forces(state, f, mass);
+	apply_self_collision_forces(state, f, 0.75f * scale, 1000 * scale, mass);
 	apply_wind_forces(state, f, wind, mass);
 	apply_collision_forces(state, f, mass);
 	apply_fixed_particles(state, f);
+	mask_sleeping(f);
+}
+
 
-	return f;
+void ClothSystem::beginStep(float stepSize)
+{
+	advance_wind(stepSize);
+	if (wind_exist)
+		invalidate_derivative();
+	begin_continuous_collisions();
 }
 
+// obstacles last, so nothing ends the step inside one
+void ClothSystem::endStep(float stepSize)
+{
+	if (tear_strain > 0)
+	{
+		size_t tornSprings = m_tornSprings.size(), tornTriangles = m_tornTriangles.size();
+		if (tear_springs(tear_strain) > 0)
+		{
+			invalidate_derivative();
+			for (size_t s = tornSprings; s < m_tornSprings.size(); s++)
+				m_meshCollision.removeEdge(m_tornSprings[s].i, m_tornSprings[s].j);
+			for (size_t t = tornTriangles; t < m_tornTriangles.size(); t++)
+				m_meshCollision.removeTriangle(m_tornTriangles[t]);
+		}
+	}
+
+	int pushed = m_meshCollision.apply(m_state, fixed_particles, stepSize, *m_pool, &m_asleep);
+	apply_continuous_collisions();
+	if (pushed > 0 || m_sweptHits > 0 || m_pushedOut > 0)
+		invalidate_derivative();
+	update_sleeping(stepSize, 0.75f * scale);
+}
+
+void ClothSystem::printStats()
+{
+	const MeshSelfCollision::Timings &t = m_meshCollision.getTimings();
+	printf("  self-collision: refit %.3f ms, traversal %.3f ms, response %.3f ms\n",
+	       t.refit, t.traversal, t.response);
+	printf("  %d vertex-triangle and %d edge-edge proximities\n", t.vertexTriangle, t.edgeEdge);
+	printf("  obstacles: %d particles stopped mid-step, %d pushed out\n", m_sweptHits, m_pushedOut);
+	printf("  sleeping %s: %d particles awake, %d asleep\n", sleeping_enabled ? "on" : "off",
+	       m_numParticles - m_sleepingCount, m_sleepingCount);
+	printf("  tearing %s: %d springs and %d triangles torn\n", tear_strain > 0 ? "on" : "off",
+	       (int)m_tornSprings.size(), (int)m_tornTriangles.size());
+}
 
 // This function simplifies calling gl of a vector vectex or normal.
 inline void glNormal3d(Vector3f vec) { glNormal3d(vec[0], vec[1], vec[2]); }
@@ -120,102 +319,43 @@ inline void drawTriangle(Vector3f a, Vector3f b, Vector3f c, Vector3f n_a, Vecto
 	glEnd();
 }
 
+bool ClothSystem::streamed = true;
 
-void ClothSystem::drawRect(int i, int j, Vector3f *normals)
+// smooth shading from area-weighted vertex normals, both sides drawn
+// separately
+void ClothSystem::drawImmediate()
 {
-	Vector3f a = m_vVecState[2*indexOf(i, j)];
-	Vector3f b = m_vVecState[2*indexOf(i, j+1)];
-	Vector3f c = m_vVecState[2*indexOf(i+1, j+1)];
-	Vector3f d = m_vVecState[2*indexOf(i+1, j)];
-
-	Vector3f n_a = normals[numRows*(i) + j];
-	Vector3f n_b = normals[numRows*(i) + j+1];
-	Vector3f n_c = normals[numRows*(i+1) + j+1];
-	Vector3f n_d = normals[numRows*(i+1) + j];
-
-	drawTriangle(a, b, c, n_a, n_b, n_c);
-	drawTriangle(c, d, a, n_c, n_d, n_a);
+	m_drawNormals.assign(m_numParticles, Vector3f(0, 0, 0));
+	for (size_t t = 0; t < triangles.size(); t += 3) {
+		Vector3f a = displayPosition(triangles[t]);
+		Vector3f b = displayPosition(triangles[t + 1]);
+		Vector3f c = displayPosition(triangles[t + 2]);
+		Vector3f normal = Vector3f::cross(a-b, c-b);
+		for (int k = 0; k < 3; k++)
+			m_drawNormals[triangles[t + k]] += normal;
+	}
 
-	// glBegin(GL_POLYGON);
-	// glVertex3d(a);
-	// glVertex3d(b);
-	// glVertex3d(c);
-	// glVertex3d(d);
-	// glEnd();
+	for (size_t t = 0; t < triangles.size(); t += 3) {
+		int a = triangles[t], b = triangles[t + 1], c = triangles[t + 2];
+		drawTriangle(displayPosition(a), displayPosition(b), displayPosition(c),
+		             m_drawNormals[a], m_drawNormals[b], m_drawNormals[c]);
+	}
 }
 
-///TODO: render the system (ie draw the particles)
 void ClothSystem::draw()
 {
-	// draw the cube
-	Vector3f center = Vector3f(0, -2.5, 0);
-	float radius = 2.5;
+	// draw the obstacles
 	GLfloat color[4] = {1, 1, 0, 1.0};
 	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color);
-	glPushMatrix();
-	glTranslatef(center[0], center[1], center[2]);
-	glutSolidSphere(radius,40,40);
-	glPopMatrix();
-
-	GLfloat ctrlpoints2[5][4][3] = {
-			{{-0.4, -0.4, 0.0}, {-0.2, -0.3, -0.1},	{0.0, -0.5, 0.1},	{0.4, -0.4, 0.0}},
-			{{-0.4, -0.2, 0.0},	{-0.2, -0.1, -0.1},	{0.0, -0.3, 0.1},	{0.4, -0.2, 0.0}},
-			{{-0.4,  0.0, 0.0},	{-0.2,  0.1, -0.1},	{0.0, -0.1, 0.1},	{0.4,  0.0, 0.0}},
-			{{-0.4,  0.4, 0.0},	{-0.2,  0.5, -0.1},	{0.0,  0.3, 0.1},	{0.4,  0.4, 0.0}},
-			{{-0.4,  0.5, 0.2},	{-0.2,  0.6,  0.1},	{0.0,  0.5, 0.3},	{0.4,  0.5, 0.2}}
-	};
-
-	Vector3f ctrlpoints[numRows][numCols] = {};
-
-	for (int i = 0; i < numRows; i++)
-		for (int j = 0; j < numCols; j++) {
-			ctrlpoints[i][j][0] = m_vVecState[2*indexOf(i, j)].x();
-			ctrlpoints[i][j][1] = m_vVecState[2*indexOf(i, j)].y();
-			ctrlpoints[i][j][2] = m_vVecState[2*indexOf(i, j)].z();
-
-		}
+	draw_obstacles();
 
-	// for (int i = 0; i < m_numParticles; i++) {
-	// 	Vector3f pos = state[2*i];//  position of particle i
-	// 	glPushMatrix();
-	// 	glTranslatef(pos[0], pos[1], pos[2] );
-	// 	glutSolidSphere(0.075f,10.0f,10.0f);
-	// 	glPopMatrix();
-	// }
-	
-	Vector3f normals[numRows][numCols] = {};
-
-	for (int i = 0; i < numRows - 1; i++) {
-		for (int j = 0; j < numCols - 1; j++) {
-			Vector3f a = m_vVecState[2*indexOf(i, j)];
-			Vector3f b = m_vVecState[2*indexOf(i, j+1)];
-			Vector3f c = m_vVecState[2*indexOf(i+1, j+1)];
-			Vector3f d = m_vVecState[2*indexOf(i+1, j)];
-
-			
-			Vector3f normal = Vector3f::cross(a-b, c-b); // normal of (a, b, c)
-			normals[i][j] += normal;
-			normals[i][j+1] += normal;
-			normals[i+1][j+1] += normal;
-
-			normal = Vector3f::cross(c-d, a-d); // normal of (c, d, a)
-			normals[i+1][j+1] += normal;
-			normals[i+1][j] += normal;
-			normals[i][j] += normal;
-		}
-	}
-
-	for (int i = 0; i < numRows; i++) {
-		for (int j = 0; j < numCols; j++) {
-			// draw structural springs
-			// if (i < numRows - 1)
-			// 	drawline(indexOf(i,j), indexOf(i+1, j));
-			// if (j < numCols - 1)
-			// 	drawline(indexOf(i,j), indexOf(i, j+1));
-			if (i < numRows - 1 && j < numCols - 1) {
-				drawRect(i, j, &normals[0][0]);
-			}
-		}
+	// grids and meshes alike are drawn from what is left of their triangles
+	if (streamed) {
+		GLfloat clothColor[4] = {0.9, 0.9, 0.9, 1.0};
+		m_renderer.draw(*this, clothColor);
+		return;
 	}
+	lockTopology();
+	drawImmediate();
+	unlockTopology();
 }
-
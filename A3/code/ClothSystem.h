@@ -6,6 +6,10 @@
 #include <GL/glut.h>
 
 #include "particleSystem.h"
+#include "meshCollision.h"
+#include "distanceField.h"
+#include "triangleMesh.h"
+#include "clothRenderer.h"
 
 class ClothSystem: public ParticleSystem
 {
@@ -14,14 +18,54 @@ public:
 	int numRows, numCols;
 	float scale;
 
-	ClothSystem(int rows, int cols);
+	// drapes over a sphere, or over obstacle scaled into the sphere's place
+	ClothSystem(int rows, int cols, const TriangleMesh *obstacle = 0);
+
+	// a cloth of any triangle mesh, with a structural spring along every
+	// edge and a bending spring across every edge two triangles share (see
+	// findClothSprings). It is scaled to fall on the obstacle, with nothing
+	// fixed; numRows and numCols are 0.
+	ClothSystem(const TriangleMesh &cloth, const TriangleMesh *obstacle = 0);
+
+	// an empty cloth, to restore a checkpoint into
+	ClothSystem();
 
 	int indexOf(int i, int j);
-	vector<Vector3f> evalF(vector<Vector3f> state);
-	void drawRect(int i, int j, Vector3f *normals);
+	void evalF(const ParticleState &state, ParticleState &f);
 	void draw();
 
+	// cloth is drawn through a ClothRenderer, or, if this is false, with a
+	// glBegin/glEnd pair per triangle side (for comparison)
+	static bool streamed;
+
+	// triangle-level self-collision and continuous obstacle collision of
+	// the stepped state
+	void beginStep(float stepSize);
+	void endStep(float stepSize);
+	void printStats();
+
+	// adds the grid's shape, the scale, the obstacle mesh and its distance
+	// field and the self-collision hierarchy, so a restored cloth needs no
+	// setup; the obstacles are the saved ones, whatever they are
+	void save(CheckpointWriter &out) const;
+	bool restore(const CheckpointReader &in);
+
 private:
+	// the obstacles, spring colors and self-collision shared by both kinds
+	void initScene(const TriangleMesh *obstacle);
+
+	// the sphere, or the mesh obstacle if there is a field, and the floor
+	void addObstacles();
+
+	void drawImmediate();
+
+	MeshSelfCollision m_meshCollision;
+	ClothRenderer m_renderer;
+	vector<Vector3f> m_drawNormals;	// per particle, for drawImmediate
+
+	// a mesh obstacle and its distance field, if the cloth has one
+	TriangleMesh m_obstacleMesh;
+	DistanceField m_obstacleField;
 
 };
 
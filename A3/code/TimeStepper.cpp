@@ -1,11 +1,306 @@
 #include "TimeStepper.hpp"
 
-///TODO: implement Explicit Euler time integrator here
+#include <algorithm>
+#include <cmath>
+
+#include "implicitEuler.h"
+#include "projectiveDynamics.h"
+#include "xpbd.h"
+
+// Explicit Euler: X' = X + h f(X)
 void ForwardEuler::takeStep(ParticleSystem* particleSystem, float stepSize)
 {
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	evalF(particleSystem, state, m_f);
+
+	float *x = state.data();
+	const float *f = m_f.data();
+	for (int k = 0; k < state.length(); k++)
+		x[k] += stepSize * f[k];
 }
 
-///TODO: implement Trapzoidal rule here
+// Trapezoidal rule: X' = X + h/2 (f(X) + f(X + h f(X)))
 void Trapzoidal::takeStep(ParticleSystem* particleSystem, float stepSize)
 {
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	evalF(particleSystem, state, m_f0);
+
+	m_x1 = state;
+	float *x1 = m_x1.data();
+	const float *f0 = m_f0.data();
+	for (int k = 0; k < m_x1.length(); k++)
+		x1[k] += stepSize * f0[k];
+
+	evalF(particleSystem, m_x1, m_f1);
+
+	float *x = state.data();
+	const float *f1 = m_f1.data();
+	for (int k = 0; k < state.length(); k++)
+		x[k] += stepSize / 2 * (f0[k] + f1[k]);
+}
+
+// Semi-implicit Euler: v' = v + h a(X), x' = x + h v'. Written on the
+// derivative as x' = x + h (dx/dt + h dv/dt), which is the same for free
+// particles and keeps prescribed position derivatives (fixed particles,
+// SimpleSystem) working.
+void SymplecticEuler::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	evalF(particleSystem, state, m_f);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float *x = state.pos(axis);
+		float *v = state.vel(axis);
+		const float *dx = m_f.pos(axis);
+		const float *dv = m_f.vel(axis);
+
+		for (int i = 0; i < state.size(); i++)
+		{
+			v[i] += stepSize * dv[i];
+			x[i] += stepSize * (dx[i] + stepSize * dv[i]);
+		}
+	}
+}
+
+// Velocity Verlet (kick-drift-kick):
+//   v_half = v + h/2 a(x, v)
+//   x'     = x + h v_half
+//   v'     = v_half + h/2 a(x', v_half)
+void VelocityVerlet::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	float h = stepSize;
+	float h2 = stepSize * 0.5f;
+
+	// reuse the closing derivative of the previous step only if the system
+	// has not changed anything since
+	if (m_system != particleSystem || m_revision != particleSystem->getRevision() ||
+	    m_f.length() != state.length())
+		evalF(particleSystem, state, m_f);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float *x = state.pos(axis);
+		float *v = state.vel(axis);
+		const float *dx = m_f.pos(axis);
+		const float *dv = m_f.vel(axis);
+
+		for (int i = 0; i < state.size(); i++)
+		{
+			v[i] += h2 * dv[i];
+			x[i] += h * (dx[i] + h2 * dv[i]);
+		}
+	}
+
+	evalF(particleSystem, state, m_f);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float *v = state.vel(axis);
+		float *dx = m_f.pos(axis);
+		const float *dv = m_f.vel(axis);
+
+		for (int i = 0; i < state.size(); i++)
+		{
+			v[i] += h2 * dv[i];
+			// the position derivative was taken at v_half; bring it to v'
+			dx[i] += h2 * dv[i];
+		}
+	}
+
+	m_system = particleSystem;
+	m_revision = particleSystem->getRevision();
+}
+
+// RK4: X' = X + h/6 k1 + h/3 k2 + h/3 k3 + h/6 k4, with
+//   k1 = f(X), k2 = f(X + h/2 k1), k3 = f(X + h/2 k2), k4 = f(X + h k3)
+// The weighted terms are accumulated in that order, one product at a time,
+// which reproduces the results of the old prebuilt libRK4.a bit for bit.
+void RK4::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+
+	float h = stepSize;
+	float h6 = stepSize / 6.0f;
+	float h2 = stepSize * 0.5f;
+	float h3 = stepSize / 3.0f;
+
+	m_xs.resize(state.size());
+	m_acc.resize(state.size());
+
+	float *x = state.data();
+	float *xs = m_xs.data();
+	float *acc = m_acc.data();
+	int n = state.length();
+
+	evalF(particleSystem, state, m_k);
+	const float *k = m_k.data();
+	for (int i = 0; i < n; i++)
+	{
+		acc[i] = x[i] + k[i] * h6;
+		xs[i] = x[i] + k[i] * h2;
+	}
+
+	evalF(particleSystem, m_xs, m_k);
+	k = m_k.data();
+	for (int i = 0; i < n; i++)
+	{
+		acc[i] += k[i] * h3;
+		xs[i] = x[i] + k[i] * h2;
+	}
+
+	evalF(particleSystem, m_xs, m_k);
+	k = m_k.data();
+	for (int i = 0; i < n; i++)
+	{
+		acc[i] += k[i] * h3;
+		xs[i] = x[i] + k[i] * h;
+	}
+
+	evalF(particleSystem, m_xs, m_k);
+	k = m_k.data();
+	for (int i = 0; i < n; i++)
+		x[i] = acc[i] + k[i] * h6;
+}
+
+namespace
+{
+	// Dormand-Prince tableau: stage s is evaluated at X + h sum_j a[s][j] k_j.
+	// The last row is also the fifth-order solution, so its derivative is
+	// the first stage of the next substep.
+	const float dp_a[7][6] = {
+		{0},
+		{1.0f/5},
+		{3.0f/40, 9.0f/40},
+		{44.0f/45, -56.0f/15, 32.0f/9},
+		{19372.0f/6561, -25360.0f/2187, 64448.0f/6561, -212.0f/729},
+		{9017.0f/3168, -355.0f/33, 46732.0f/5247, 49.0f/176, -5103.0f/18656},
+		{35.0f/384, 0, 500.0f/1113, 125.0f/192, -2187.0f/6784, 11.0f/84}
+	};
+
+	// difference between the fifth- and fourth-order weights
+	const float dp_e[7] = {
+		71.0f/57600, 0, -71.0f/16695, 71.0f/1920, -17253.0f/339200, 22.0f/525, -1.0f/40
+	};
+}
+
+DormandPrince::DormandPrince(float tolerance):m_tolerance(tolerance), m_h(0), m_accepted(0), m_rejected(0)
+{
+}
+
+void DormandPrince::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	int n = state.length();
+
+	for (int s = 0; s < 7; s++)
+		m_k[s].resize(state.size());
+	m_xs.resize(state.size());
+
+	if (m_h <= 0 || m_h > stepSize)
+		m_h = stepSize;
+	float h_min = stepSize * 1e-4f;
+
+	evalF(particleSystem, state, m_k[0]);
+
+	float t = 0;
+	bool done = false;
+	while (!done)
+	{
+		float h = m_h;
+		bool last = (t + h >= stepSize);
+		if (last)
+			h = stepSize - t;
+
+		const float *x = state.data();
+		float *xs = m_xs.data();
+
+		// stages 2..7; the last one leaves the fifth-order solution in m_xs
+		for (int s = 1; s < 7; s++)
+		{
+			const float *k[6];
+			for (int j = 0; j < s; j++)
+				k[j] = m_k[j].data();
+
+			for (int i = 0; i < n; i++)
+			{
+				float sum = 0;
+				for (int j = 0; j < s; j++)
+					sum += dp_a[s][j] * k[j][i];
+				xs[i] = x[i] + h * sum;
+			}
+
+			evalF(particleSystem, m_xs, m_k[s]);
+		}
+
+		// scaled RMS of the difference between the two embedded solutions
+		const float *k[7];
+		for (int j = 0; j < 7; j++)
+			k[j] = m_k[j].data();
+
+		double err2 = 0;
+		for (int i = 0; i < n; i++)
+		{
+			float e = 0;
+			for (int j = 0; j < 7; j++)
+				e += dp_e[j] * k[j][i];
+			float sc = m_tolerance * (1 + max(fabsf(x[i]), fabsf(xs[i])));
+			float r = h * e / sc;
+			err2 += r * r;
+		}
+		float err = n > 0 ? sqrt(err2 / n) : 0;
+
+		// standard controller, growth limited to [0.2, 5] per substep
+		float factor = err > 0 ? 0.9f * pow(err, -0.2f) : 5.0f;
+		factor = min(5.0f, max(0.2f, factor));
+
+		if (err <= 1 || h <= h_min)
+		{
+			state.swap(m_xs);
+			m_k[0].swap(m_k[6]);
+			t += h;
+			m_accepted++;
+
+			// a substep shortened to land on the frame end says nothing
+			// about growing, only about shrinking
+			if (!last || h * factor < m_h)
+				m_h = h * factor;
+			done = last;
+		}
+		else
+		{
+			m_rejected++;
+			m_h = max(h * factor, h_min);
+		}
+	}
+}
+
+TimeStepper *makeTimeStepper(char name)
+{
+	switch (name)
+	{
+	case 'e': return new ForwardEuler();
+	case 't': return new Trapzoidal();
+	case 'r': return new RK4();
+	case 's': return new SymplecticEuler();
+	case 'v': return new VelocityVerlet();
+	case 'd': return new DormandPrince();
+	case 'i': return new ImplicitEuler();
+	case 'x': return new XPBD();
+	case 'p': return new ProjectiveDynamics();
+	default: return 0;
+	}
 }
@@ -8,27 +8,129 @@
 class TimeStepper
 {
 public:
+	TimeStepper():m_steps(0), m_evaluations(0){}
+	virtual ~TimeStepper(){}
+
 	virtual void takeStep(ParticleSystem* particleSystem,float stepSize)=0;
+
+	// cost of the steps taken so far, in evaluations of f(X,t)
+	int getSteps() const { return m_steps; }
+	int getEvaluations() const { return m_evaluations; }
+	float getEvaluationsPerStep() const { return m_steps > 0 ? float(m_evaluations) / m_steps : 0; }
+	void resetStats() { m_steps = m_evaluations = 0; }
+
+	// forgets whatever it keeps about the system between steps, for when
+	// the driver switches to another one
+	virtual void reset() {}
+
+protected:
+	// every stepper evaluates the system through here so its cost is counted
+	void evalF(ParticleSystem* particleSystem, const ParticleState &state, ParticleState &f)
+	{
+		m_evaluations++;
+		particleSystem->evalF(state, f);
+	}
+
+	int m_steps;
+	int m_evaluations;
 };
 
 //IMPLEMENT YOUR TIMESTEPPERS
 
+// The steppers below work on the system's structure-of-arrays state in
+// place and keep their scratch states between steps, so once these have
+// grown to the state size a step does no heap allocation.
+
 class ForwardEuler:public TimeStepper
 {
   void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  ParticleState m_f;
 };
 
 class Trapzoidal:public TimeStepper
 {
   void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  ParticleState m_x1, m_f0, m_f1;
+};
+
+// Semi-implicit (symplectic) Euler: the velocity is updated first and the
+// position moves with the new velocity. One evaluation per step.
+class SymplecticEuler:public TimeStepper
+{
+  void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  ParticleState m_f;
+};
+
+// Velocity Verlet in kick-drift-kick form. The derivative at the end of a
+// step is the one the next step starts from, unless the system has changed
+// its state or forces since (see ParticleSystem::invalidate_derivative).
+// A step costs one evaluation on systems that leave both alone, as the
+// pendulum and the simple system do, and two on the cloth whenever its
+// wind blows or a collision or tear changes it after the step. A reused
+// derivative has velocity-dependent forces such as drag at the half-step
+// velocity, as usual for velocity Verlet.
+class VelocityVerlet:public TimeStepper
+{
+public:
+  VelocityVerlet():m_system(0), m_revision(0){}
+
+  void takeStep(ParticleSystem* particleSystem, float stepSize);
+  void reset() { m_system = 0; }
+
+private:
+  ParticleState m_f;
+
+  // the system and its revision m_f was evaluated for
+  const ParticleSystem *m_system;
+  unsigned int m_revision;
 };
 
 /////////////////////////
 
-//Provided
+// Classical fourth-order Runge-Kutta. The stage combinations are fused so
+// that each stage is one pass over the state, using a stage state, an
+// accumulator and a derivative buffer that persist across steps.
 class RK4:public TimeStepper
 {
   void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  ParticleState m_xs, m_acc, m_k;
 };
 
+// Adaptive Dormand-Prince 5(4). A call to takeStep advances the system by
+// the whole stepSize (one frame) in as many substeps as the embedded
+// fourth-order error estimate allows; the substep size carries over from
+// frame to frame. The tolerance bounds the scaled RMS error of a substep,
+// relative to the state magnitude and absolute alike.
+class DormandPrince:public TimeStepper
+{
+public:
+  DormandPrince(float tolerance = 1e-3f);
+
+  void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  void setTolerance(float tolerance) { m_tolerance = tolerance; }
+  float getTolerance() const { return m_tolerance; }
+
+  // work done since construction (or the last resetStats)
+  int getAcceptedSteps() const { return m_accepted; }
+  int getRejectedSteps() const { return m_rejected; }
+  void resetStats() { TimeStepper::resetStats(); m_accepted = m_rejected = 0; }
+
+private:
+  float m_tolerance;
+  float m_h;
+
+  int m_accepted, m_rejected;
+
+  ParticleState m_k[7], m_xs;
+};
+
+// the integrator named by a command line letter (see main.cpp), or 0 if
+// unknown
+TimeStepper *makeTimeStepper(char name);
+
 #endif
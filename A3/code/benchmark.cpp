@@ -0,0 +1,356 @@
+#include "benchmark.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ClothSystem.h"
+#include "pendulumSystem.h"
+#include "simpleSystem.h"
+#include "simulationClock.h"
+#include "xpbd.h"
+
+using namespace std;
+
+namespace
+{
+	// a cloth whose springs are all stretched or compressed a little
+	void perturb(ParticleState &state)
+	{
+		float *x = state.data();
+		for (int k = 0; k < 3 * state.size(); k++)
+			x[k] += 0.01f * sinf(0.7f * k);
+	}
+
+	float maxDifference(const ParticleState &a, const ParticleState &b)
+	{
+		float diff = 0;
+		for (int k = 0; k < a.length(); k++)
+			diff = max(diff, fabsf(a.data()[k] - b.data()[k]));
+		return diff;
+	}
+
+	// milliseconds per apply_spring_forces with the system's current settings
+	double timeSpringForces(ParticleSystem &system, const ParticleState &state, ParticleState &f)
+	{
+		// warm up, and build anything built on first use
+		system.init_f(state, f);
+		system.apply_spring_forces(state, f, system.getMass());
+
+		int repeats = 0;
+		double start = wallTime(), elapsed = 0;
+		while (repeats < 3 || elapsed < 0.5)
+		{
+			system.init_f(state, f);
+			system.apply_spring_forces(state, f, system.getMass());
+			repeats++;
+			elapsed = wallTime() - start;
+		}
+		return elapsed / repeats * 1e3;
+	}
+
+	int springsBenchmark(int argc, char *argv[])
+	{
+		vector<int> sizes;
+		for (int a = 0; a < argc; a++)
+			sizes.push_back(atoi(argv[a]));
+		if (sizes.empty())
+		{
+			sizes.push_back(64);
+			sizes.push_back(128);
+			sizes.push_back(256);
+			sizes.push_back(512);
+		}
+
+		ThreadPool serial(1);
+		ThreadPool &pool = ThreadPool::global();
+
+		printf("spring forces, ms per evaluation (%d threads)\n", pool.size());
+		printf("%8s %10s %10s %10s %10s %10s %12s\n",
+		       "cloth", "springs", "scatter", "colored", "gather-1", "gather", "max diff");
+
+		for (size_t s = 0; s < sizes.size(); s++)
+		{
+			int n = sizes[s];
+			ClothSystem cloth(n, n);
+			ParticleState state = cloth.getParticleState();
+			perturb(state);
+
+			ParticleState reference, f;
+
+			cloth.setSpringEvaluation(ParticleSystem::SPRINGS_SCATTER);
+			cloth.setThreadPool(&serial);
+			double scatter = timeSpringForces(cloth, state, reference);
+
+			cloth.setThreadPool(&pool);
+			double colored = timeSpringForces(cloth, state, f);
+			float diff = maxDifference(reference, f);
+
+			cloth.setSpringEvaluation(ParticleSystem::SPRINGS_GATHER);
+			cloth.setThreadPool(&serial);
+			double gatherSerial = timeSpringForces(cloth, state, f);
+			diff = max(diff, maxDifference(reference, f));
+
+			cloth.setThreadPool(&pool);
+			double gather = timeSpringForces(cloth, state, f);
+			diff = max(diff, maxDifference(reference, f));
+
+			printf("%4dx%-4d %10d %10.3f %10.3f %10.3f %10.3f %12.3g\n",
+			       n, n, (int)cloth.getSprings().size(), scatter, colored, gatherSerial, gather, diff);
+		}
+		return 0;
+	}
+
+	struct DrapeResult
+	{
+		double stepMs, frameMs;	// takeStep alone, and with begin/endStep
+		float evaluations;	// of f(X,t) per frame
+		float stretch;	// mean |d - len| / len over the springs, percent
+		float centerY;
+	};
+
+	// drapes a size x size cloth over the sphere for seconds of simulated
+	// time in frames of the viewer's default step
+	DrapeResult drape(int size, TimeStepper &stepper, float seconds)
+	{
+		const float h = 0.04f;
+		ClothSystem cloth(size, size);
+		int frames = (int)(seconds / h);
+
+		double stepTime = 0, frameTime = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			double start = wallTime();
+			cloth.beginStep(h);
+			double before = wallTime();
+			stepper.takeStep(&cloth, h);
+			double after = wallTime();
+			cloth.endStep(h);
+			double end = wallTime();
+
+			stepTime += after - before;
+			frameTime += end - start;
+		}
+
+		DrapeResult result;
+		result.stepMs = stepTime / frames * 1e3;
+		result.frameMs = frameTime / frames * 1e3;
+		result.evaluations = stepper.getEvaluationsPerStep();
+
+		const ParticleState &state = cloth.getParticleState();
+		const vector<Spring> &springs = cloth.getSprings();
+		double stretch = 0;
+		for (size_t s = 0; s < springs.size(); s++)
+		{
+			float d = (state.position(springs[s].i) - state.position(springs[s].j)).abs();
+			stretch += fabsf(d - springs[s].len) / springs[s].len;
+		}
+		result.stretch = (float)(100 * stretch / springs.size());
+		result.centerY = state.position(cloth.indexOf(size / 2, size / 2))[1];
+		return result;
+	}
+
+	void printDrape(const char *name, const DrapeResult &r)
+	{
+		printf("%-10s %10.3f %10.3f %10.1f %10.3f %10.3f\n",
+		       name, r.stepMs, r.frameMs, r.evaluations, r.stretch, r.centerY);
+	}
+
+	int xpbdBenchmark(int argc, char *argv[])
+	{
+		int size = argc > 0 ? atoi(argv[0]) : 40;
+		float seconds = argc > 1 ? (float)atof(argv[1]) : 4;
+
+		printf("%dx%d cloth, %.1f s in 0.04 s frames, ms per frame (%d threads)\n",
+		       size, size, seconds, ThreadPool::global().size());
+		printf("%-10s %10s %10s %10s %10s %10s\n",
+		       "stepper", "step", "frame", "evals", "stretch %", "center y");
+
+		RK4 rk4;
+		printDrape("RK4", drape(size, rk4, seconds));
+
+		const int iterations[] = {5, 10, 20};
+		for (int k = 0; k < 3; k++)
+		{
+			XPBD xpbd(iterations[k]);
+			char name[32];
+			sprintf(name, "XPBD %d", iterations[k]);
+			printDrape(name, drape(size, xpbd, seconds));
+		}
+		return 0;
+	}
+
+	// the system named on the command line, or 0 if unknown; size is "N" or
+	// "RxC". Any other name is a checkpoint to resume.
+	ParticleSystem *makeSystem(const char *name, const char *size)
+	{
+		int rows = atoi(size), cols = rows;
+		const char *x = strchr(size, 'x');
+		if (x != 0)
+			cols = atoi(x + 1);
+
+		if (strcmp(name, "cloth") == 0)
+			return rows > 1 && cols > 1 ? new ClothSystem(rows, cols) : 0;
+		if (strcmp(name, "pendulum") == 0)
+			return rows > 0 ? new PendulumSystem(rows) : 0;
+		if (strcmp(name, "simple") == 0)
+			return new SimpleSystem();
+
+		CheckpointReader checkpoint;
+		ClothSystem *cloth = new ClothSystem();
+		if (checkpoint.open(name) && cloth->restore(checkpoint))
+			return cloth;
+		delete cloth;
+		return 0;
+	}
+
+	struct Throughput
+	{
+		double particleSteps;	// per second of whole steps
+		double stepMs, frameMs;	// takeStep alone, and with begin/endStep
+		double evalMs;	// one evalF on the final state
+		float evaluations;	// of f(X,t) per step
+		bool finite;	// whether the final state is
+	};
+
+	// steps the system as fast as it goes, the way the simulation thread
+	// would, then times evalF alone
+	Throughput measure(ParticleSystem &system, TimeStepper &stepper, float h, int steps)
+	{
+		double stepTime = 0, frameTime = 0;
+		for (int k = 0; k < steps; k++)
+		{
+			double start = wallTime();
+			system.beginStep(h);
+			double before = wallTime();
+			stepper.takeStep(&system, h);
+			double after = wallTime();
+			system.endStep(h);
+			double end = wallTime();
+
+			stepTime += after - before;
+			frameTime += end - start;
+		}
+
+		Throughput result;
+		const ParticleState &state = system.getParticleState();
+		result.particleSteps = frameTime > 0 ? (double)state.size() * steps / frameTime : 0;
+		result.stepMs = steps > 0 ? stepTime / steps * 1e3 : 0;
+		result.frameMs = steps > 0 ? frameTime / steps * 1e3 : 0;
+		result.evaluations = stepper.getEvaluationsPerStep();
+
+		result.finite = true;
+		for (int k = 0; k < state.length(); k++)
+			if (!(fabsf(state.data()[k]) < 1e30f))
+			{
+				result.finite = false;
+				break;
+			}
+
+		// warm up, then repeat for at least half a second
+		ParticleState f;
+		system.evalF(state, f);
+		int repeats = 0;
+		double start = wallTime(), elapsed = 0;
+		while (repeats < 3 || elapsed < 0.5)
+		{
+			system.evalF(state, f);
+			repeats++;
+			elapsed = wallTime() - start;
+		}
+		result.evalMs = elapsed / repeats * 1e3;
+		return result;
+	}
+
+	int scalingBenchmark(int argc, char *argv[])
+	{
+		char integrator = argc > 0 ? argv[0][0] : 'r';
+		int steps = argc > 1 ? atoi(argv[1]) : 10;
+		vector<int> sizes;
+		for (int a = 2; a < argc; a++)
+			sizes.push_back(atoi(argv[a]));
+		if (sizes.empty())
+		{
+			const int defaults[] = {40, 64, 128, 256, 512, 1024};
+			sizes.assign(defaults, defaults + 6);
+		}
+
+		printf("cloth scaling, integrator %c, %d steps of 0.04 (%d threads)\n",
+		       integrator, steps, ThreadPool::global().size());
+		printf("%10s %10s %14s %12s %10s %10s %10s %10s\n",
+		       "cloth", "particles", "particle-st/s", "ns/p-step", "step ms", "frame ms", "evals", "evalF ms");
+
+		for (size_t s = 0; s < sizes.size(); s++)
+		{
+			int n = sizes[s];
+			TimeStepper *stepper = makeTimeStepper(integrator);
+			if (stepper == 0 || n < 2)
+			{
+				fprintf(stderr, "bad integrator %c or size %d\n", integrator, n);
+				delete stepper;
+				return 1;
+			}
+			ClothSystem cloth(n, n);
+			Throughput t = measure(cloth, *stepper, 0.04f, steps);
+			delete stepper;
+
+			printf("%4dx%-5d %10d %14.4g %12.1f %10.3f %10.3f %10.1f %10.3f%s\n",
+			       n, n, n * n, t.particleSteps, t.particleSteps > 0 ? 1e9 / t.particleSteps : 0,
+			       t.stepMs, t.frameMs, t.evaluations, t.evalMs, t.finite ? "" : "  (blew up)");
+			fflush(stdout);
+		}
+		return 0;
+	}
+}
+
+int runHeadless(int argc, char *argv[])
+{
+	const char *name = argc > 0 ? argv[0] : "cloth";
+	const char *size = argc > 1 ? argv[1] : "40";
+	char integrator = argc > 2 ? argv[2][0] : 'r';
+	float h = argc > 3 ? (float)atof(argv[3]) : 0.04f;
+	int steps = argc > 4 ? atoi(argv[4]) : 100;
+
+	ParticleSystem *system = makeSystem(name, size);
+	TimeStepper *stepper = makeTimeStepper(integrator);
+	if (system == 0 || stepper == 0 || !(h > 0) || steps < 1)
+	{
+		fprintf(stderr, "usage: a3 run [cloth|pendulum|simple|checkpoint] [size] [e|t|r|s|v|d|i|x|p] [stepSize] [steps]\n");
+		delete system;
+		delete stepper;
+		return 1;
+	}
+
+	printf("%s %s, %d particles, integrator %c, %d steps of %g (%d threads)\n",
+	       name, size, system->getParticleState().size(), integrator, steps, h,
+	       ThreadPool::global().size());
+	Throughput t = measure(*system, *stepper, h, steps);
+	printf("%.4g particle-steps/s\n", t.particleSteps);
+	printf("%.3f ms per step (%.3f in takeStep), %.1f evaluations per step\n",
+	       t.frameMs, t.stepMs, t.evaluations);
+	printf("%.3f ms per evalF\n", t.evalMs);
+	if (!t.finite)
+		printf("the state blew up\n");
+	system->printStats();
+
+	delete stepper;
+	delete system;
+	return t.finite ? 0 : 2;
+}
+
+int runBenchmark(int argc, char *argv[])
+{
+	if (argc > 0 && strcmp(argv[0], "springs") == 0)
+		return springsBenchmark(argc - 1, argv + 1);
+	if (argc > 0 && strcmp(argv[0], "xpbd") == 0)
+		return xpbdBenchmark(argc - 1, argv + 1);
+	if (argc > 0 && strcmp(argv[0], "scaling") == 0)
+		return scalingBenchmark(argc - 1, argv + 1);
+
+	fprintf(stderr, "usage: a3 bench springs [sizes...]\n"
+	                "       a3 bench xpbd [size] [seconds]\n"
+	                "       a3 bench scaling [integrator] [steps] [sizes...]\n");
+	return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Command line benchmarks, run as "a3 bench <name> [args]" without opening
+// a window. argv starts at <name>. Returns the process exit code.
+//
+//   springs [sizes...]   scatter vs colored scatter vs CSR gather spring
+//                        forces on square cloths (default 64 128 256 512)
+//   xpbd [size] [seconds]
+//                        wall-clock per frame of XPBD against RK4 on the
+//                        draping cloth (default 40x40 for 4 simulated
+//                        seconds), with the stretch of the springs to
+//                        compare how stiff the two look
+//   scaling [integrator] [steps] [sizes...]
+//                        throughput of "a3 run" on square cloths (default
+//                        RK4, 10 steps, 40 64 128 256 512 1024), one row
+//                        per size; ns per particle-step stays flat while
+//                        the cost scales linearly
+int runBenchmark(int argc, char *argv[]);
+
+// Runs a simulation without a window or GL context, as
+// "a3 run [system] [size] [integrator] [stepSize] [steps]", and prints its
+// throughput. system is cloth (default), pendulum, simple or a checkpoint
+// file to resume; size is N or RxC particles for the cloth (default 40) and
+// the particle count for the pendulum; integrator is a letter as in the viewer (default r); steps
+// default to 100 of 0.04.
+int runHeadless(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,135 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	const char magic[8] = {'A', '3', 'C', 'K', 'P', 'T', 0, 0};
+	const size_t headerBytes = 16;	// magic, version, unused
+	const size_t nameBytes = 16;
+	const size_t sectionHeaderBytes = nameBytes + 8;
+
+	size_t padded(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+}
+
+const unsigned int CheckpointWriter::version = 5;
+
+CheckpointWriter::CheckpointWriter()
+	:m_data(headerBytes, 0)
+{
+	memcpy(&m_data[0], magic, sizeof(magic));
+	memcpy(&m_data[8], &version, sizeof(version));
+}
+
+void CheckpointWriter::put(const char *name, const void *data, size_t bytes)
+{
+	size_t at = m_data.size();
+	m_data.resize(at + sectionHeaderBytes + padded(bytes), 0);
+	strncpy(&m_data[at], name, nameBytes - 1);
+	unsigned long long count = bytes;
+	memcpy(&m_data[at + nameBytes], &count, sizeof(count));
+	if (bytes > 0)
+		memcpy(&m_data[at + sectionHeaderBytes], data, bytes);
+}
+
+bool CheckpointWriter::write(const char *path) const
+{
+	string temporary = string(path) + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (file == 0)
+		return false;
+	bool written = fwrite(&m_data[0], 1, m_data.size(), file) == m_data.size();
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temporary.c_str(), path) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+CheckpointReader::CheckpointReader()
+	:m_data(0), m_size(0)
+{
+}
+
+CheckpointReader::~CheckpointReader()
+{
+	close();
+}
+
+bool CheckpointReader::open(const char *path)
+{
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && (size_t)info.st_size >= headerBytes)
+		data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);	// the mapping stays
+	if (data == MAP_FAILED)
+		return false;
+
+	m_data = (const char *)data;
+	m_size = info.st_size;
+	unsigned int fileVersion;
+	memcpy(&fileVersion, m_data + 8, sizeof(fileVersion));
+	if (memcmp(m_data, magic, sizeof(magic)) != 0 || fileVersion != CheckpointWriter::version)
+	{
+		close();
+		return false;
+	}
+
+	size_t at = headerBytes;
+	while (at < m_size)
+	{
+		unsigned long long count;
+		if (m_size - at < sectionHeaderBytes)
+			break;
+		memcpy(&count, m_data + at + nameBytes, sizeof(count));
+		if (m_data[at + nameBytes - 1] != 0 || count > m_size - at - sectionHeaderBytes)
+			break;
+
+		Section section;
+		section.name = m_data + at;
+		section.data = m_data + at + sectionHeaderBytes;
+		section.bytes = (size_t)count;
+		m_sections.push_back(section);
+		at += sectionHeaderBytes + padded(section.bytes);
+	}
+	if (at < m_size)
+	{
+		close();	// damaged
+		return false;
+	}
+	return true;
+}
+
+void CheckpointReader::close()
+{
+	if (m_data != 0)
+		munmap((void *)m_data, m_size);
+	m_data = 0;
+	m_size = 0;
+	m_sections.clear();
+}
+
+const void *CheckpointReader::find(const char *name, size_t &bytes) const
+{
+	for (size_t s = 0; s < m_sections.size(); s++)
+		if (strcmp(m_sections[s].name, name) == 0)
+		{
+			bytes = m_sections[s].bytes;
+			return m_sections[s].data;
+		}
+	bytes = 0;
+	return 0;
+}
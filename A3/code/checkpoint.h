@@ -0,0 +1,97 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Binary snapshot of a simulation, for resuming it later without setting
+// it up again. A file is a header (magic, version) followed by named
+// sections, each a 16-character name, a 64-bit byte count and the bytes,
+// padded to a multiple of 8 so that arrays in a mapped file stay aligned.
+// Sections hold plain arrays, so restoring one is a copy out of the mapping.
+//
+// Readers reject files of another version, ignore sections they do not know
+// and fail on missing ones; a change to what a section holds needs a new
+// version.
+
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+
+	// appends a section; name is at most 15 characters
+	void put(const char *name, const void *data, size_t bytes);
+
+	template <class T>
+	void putValue(const char *name, const T &value) { put(name, &value, sizeof(T)); }
+
+	template <class T>
+	void putVector(const char *name, const vector<T> &values)
+	{
+		put(name, values.empty() ? 0 : &values[0], values.size() * sizeof(T));
+	}
+
+	// false if the file cannot be written completely. The file is written
+	// under a temporary name and renamed, so a reader never sees half of it.
+	bool write(const char *path) const;
+
+	static const unsigned int version;
+
+private:
+	vector<char> m_data;
+};
+
+// Reads a checkpoint through a read-only mapping of the file.
+class CheckpointReader
+{
+public:
+	CheckpointReader();
+	~CheckpointReader();
+
+	// false if the file is missing, damaged or of another version
+	bool open(const char *path);
+	void close();
+
+	// the bytes of a section in the mapping, or 0 if there is none
+	const void *find(const char *name, size_t &bytes) const;
+
+	// false if the section is missing or of the wrong size
+	template <class T>
+	bool getValue(const char *name, T &value) const
+	{
+		size_t bytes;
+		const void *data = find(name, bytes);
+		if (data == 0 || bytes != sizeof(T))
+			return false;
+		memcpy(&value, data, sizeof(T));
+		return true;
+	}
+
+	template <class T>
+	bool getVector(const char *name, vector<T> &values) const
+	{
+		size_t bytes;
+		const void *data = find(name, bytes);
+		if (data == 0 || bytes % sizeof(T) != 0)
+			return false;
+		const T *first = (const T *)data;
+		values.assign(first, first + bytes / sizeof(T));
+		return true;
+	}
+
+private:
+	struct Section
+	{
+		const char *name;
+		const char *data;
+		size_t bytes;
+	};
+
+	const char *m_data;
+	size_t m_size;
+	vector<Section> m_sections;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef CLOSESTPOINT_H
+#define CLOSESTPOINT_H
+
+// Closest-point queries on plain float[3] points, for the inner loops of
+// collision detection where calls into vecmath would dominate.
+
+inline float dot3(const float *a, const float *b) { return a[0]*b[0] + a[1]*b[1] + a[2]*b[2]; }
+inline void sub3(const float *a, const float *b, float *r) { r[0] = a[0] - b[0]; r[1] = a[1] - b[1]; r[2] = a[2] - b[2]; }
+inline float clamp01(float v) { return v < 0 ? 0 : (v > 1 ? 1 : v); }
+
+// closest point to p on triangle (a, b, c) as barycentric weights
+// (Ericson, Real-Time Collision Detection, 5.1.5)
+inline void closestOnTriangle(const float *p, const float *a, const float *b, const float *c, float w[3])
+{
+	float ab[3], ac[3], ap[3];
+	sub3(b, a, ab); sub3(c, a, ac); sub3(p, a, ap);
+	float d1 = dot3(ab, ap), d2 = dot3(ac, ap);
+	if (d1 <= 0 && d2 <= 0) { w[0] = 1; w[1] = w[2] = 0; return; }
+
+	float bp[3];
+	sub3(p, b, bp);
+	float d3 = dot3(ab, bp), d4 = dot3(ac, bp);
+	if (d3 >= 0 && d4 <= d3) { w[1] = 1; w[0] = w[2] = 0; return; }
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0)
+	{
+		float v = d1 / (d1 - d3);
+		w[0] = 1 - v; w[1] = v; w[2] = 0;
+		return;
+	}
+
+	float cp[3];
+	sub3(p, c, cp);
+	float d5 = dot3(ab, cp), d6 = dot3(ac, cp);
+	if (d6 >= 0 && d5 <= d6) { w[2] = 1; w[0] = w[1] = 0; return; }
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0)
+	{
+		float v = d2 / (d2 - d6);
+		w[0] = 1 - v; w[1] = 0; w[2] = v;
+		return;
+	}
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+	{
+		float v = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		w[0] = 0; w[1] = 1 - v; w[2] = v;
+		return;
+	}
+
+	float denom = 1 / (va + vb + vc);
+	w[1] = vb * denom;
+	w[2] = vc * denom;
+	w[0] = 1 - w[1] - w[2];
+}
+
+// parameters s, t of the closest points p1 + s (q1 - p1) and
+// p2 + t (q2 - p2) of two segments (Ericson 5.1.9)
+inline void closestOnSegments(const float *p1, const float *q1, const float *p2, const float *q2, float &s, float &t)
+{
+	float d1[3], d2[3], r[3];
+	sub3(q1, p1, d1); sub3(q2, p2, d2); sub3(p1, p2, r);
+	float a = dot3(d1, d1), e = dot3(d2, d2), f = dot3(d2, r);
+	const float eps = 1e-12f;
+
+	if (a <= eps && e <= eps) { s = t = 0; return; }
+	if (a <= eps) { s = 0; t = clamp01(f / e); return; }
+
+	float c = dot3(d1, r);
+	if (e <= eps) { t = 0; s = clamp01(-c / a); return; }
+
+	float b = dot3(d1, d2);
+	float denom = a * e - b * b;
+	s = denom > eps ? clamp01((b * f - c * e) / denom) : 0;
+	t = (b * s + f) / e;
+
+	if (t < 0) { t = 0; s = clamp01(-c / a); }
+	else if (t > 1) { t = 1; s = clamp01((b - c) / a); }
+}
+
+#endif
@@ -0,0 +1,238 @@
+// the buffer object entry points are OpenGL 1.5, past what gl.h declares
+#define GL_GLEXT_PROTOTYPES
+
+#include "clothRenderer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "particleSystem.h"
+#include "threadPool.h"
+
+namespace
+{
+	const int vertexFloats = 6;	// position, normal
+
+	class PositionTask:public ParallelTask
+	{
+	public:
+		const ParticleSystem *system;
+		float *vertices;
+
+		void run(int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				Vector3f p = system->displayPosition(i);
+				float *v = vertices + vertexFloats * i;
+				v[0] = p[0]; v[1] = p[1]; v[2] = p[2];
+			}
+		}
+	};
+
+	// area-weighted normals of (a, b, c), counterclockwise as seen from the
+	// front
+	class FaceNormalTask:public ParallelTask
+	{
+	public:
+		const unsigned int *indices;
+		const float *vertices;
+		float *normals;
+
+		void run(int begin, int end)
+		{
+			for (int t = begin; t < end; t++)
+			{
+				const float *a = vertices + vertexFloats * indices[3*t];
+				const float *b = vertices + vertexFloats * indices[3*t + 1];
+				const float *c = vertices + vertexFloats * indices[3*t + 2];
+				float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+				float w[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+				float *n = normals + 3 * t;
+				n[0] = u[1]*w[2] - u[2]*w[1];
+				n[1] = u[2]*w[0] - u[0]*w[2];
+				n[2] = u[0]*w[1] - u[1]*w[0];
+			}
+		}
+	};
+
+	// each vertex sums the normals of its own triangles, so there are no
+	// conflicting writes; GL_NORMALIZE scales the sums
+	class VertexNormalTask:public ParallelTask
+	{
+	public:
+		const int *start, *triangles;
+		const float *faceNormals;
+		float *vertices;
+
+		void run(int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				float n[3] = {0, 0, 0};
+				for (int k = start[i]; k < start[i + 1]; k++)
+				{
+					const float *f = faceNormals + 3 * triangles[k];
+					n[0] += f[0]; n[1] += f[1]; n[2] += f[2];
+				}
+				float *v = vertices + vertexFloats * i + 3;
+				v[0] = n[0]; v[1] = n[1]; v[2] = n[2];
+			}
+		}
+	};
+}
+
+ClothRenderer::ClothRenderer()
+	:m_initialized(false), m_useBuffers(false), m_vertexBuffer(0), m_indexBuffer(0),
+	 m_indexCapacity(0), m_changedBegin(0), m_changedEnd(0)
+{
+}
+
+ClothRenderer::~ClothRenderer()
+{
+	if (m_vertexBuffer != 0)
+	{
+		glDeleteBuffers(1, &m_vertexBuffer);
+		glDeleteBuffers(1, &m_indexBuffer);
+	}
+}
+
+ThreadPool &ClothRenderer::pool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ClothRenderer::draw(ParticleSystem &system, const GLfloat color[4])
+{
+	if (!m_initialized)
+	{
+		int major = 1, minor = 0;
+		const char *version = (const char *)glGetString(GL_VERSION);
+		if (version != 0)
+			sscanf(version, "%d.%d", &major, &minor);
+		m_useBuffers = major > 1 || (major == 1 && minor >= 5);
+		if (m_useBuffers)
+		{
+			glGenBuffers(1, &m_vertexBuffer);
+			glGenBuffers(1, &m_indexBuffer);
+		}
+	}
+
+	int numVertices = system.getParticleState().size();
+	bool indicesChanged = updateIndices(system);
+	if (indicesChanged || (int)m_vertexStart.size() != numVertices + 1)
+		indexVertices(numVertices);
+	int numTriangles = (int)m_indices.size() / 3;
+	if (numTriangles == 0)
+		return;
+
+	m_vertices.resize(vertexFloats * numVertices);
+	m_faceNormals.resize(3 * numTriangles);
+
+	PositionTask positions;
+	positions.system = &system;
+	positions.vertices = &m_vertices[0];
+	pool().parallelFor(0, numVertices, positions, 4096);
+
+	FaceNormalTask faces;
+	faces.indices = &m_indices[0];
+	faces.vertices = &m_vertices[0];
+	faces.normals = &m_faceNormals[0];
+	pool().parallelFor(0, numTriangles, faces, 4096);
+
+	VertexNormalTask normals;
+	normals.start = &m_vertexStart[0];
+	normals.triangles = &m_vertexTriangles[0];
+	normals.faceNormals = &m_faceNormals[0];
+	normals.vertices = &m_vertices[0];
+	pool().parallelFor(0, numVertices, normals, 4096);
+
+	if (m_useBuffers)
+		upload(indicesChanged);
+
+	glPushAttrib(GL_ENABLE_BIT | GL_LIGHTING_BIT);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glDisable(GL_CULL_FACE);
+	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color);
+
+	// offsets into the bound buffers, or pointers into client memory
+	const char *vertices = m_useBuffers ? 0 : (const char *)&m_vertices[0];
+	const GLvoid *indices = m_useBuffers ? 0 : &m_indices[0];
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, vertexFloats * sizeof(float), vertices);
+	glNormalPointer(GL_FLOAT, vertexFloats * sizeof(float), vertices + 3 * sizeof(float));
+	glDrawElements(GL_TRIANGLES, (GLsizei)m_indices.size(), GL_UNSIGNED_INT, indices);
+
+	glPopClientAttrib();
+	glPopAttrib();
+	if (m_useBuffers)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+bool ClothRenderer::updateIndices(ParticleSystem &system)
+{
+	system.lockTopology();
+	const vector<int> &triangles = system.getTriangles();
+	int size = (int)triangles.size();
+	int begin = 0, end = size;
+	if (m_initialized)
+		system.getTriangleChanges(begin, end);
+	end = min(end, size);
+
+	bool changed = begin < end || (int)m_indices.size() != size;
+	m_indices.resize(size);
+	for (int k = begin; k < end; k++)
+		m_indices[k] = triangles[k];
+	system.clearTriangleChanges();
+	system.unlockTopology();
+
+	if (begin < end)
+	{
+		m_changedBegin = min(m_changedBegin, begin);
+		m_changedEnd = max(m_changedEnd, end);
+	}
+	m_initialized = true;
+	return changed;
+}
+
+void ClothRenderer::indexVertices(int numVertices)
+{
+	int numTriangles = (int)m_indices.size() / 3;
+	m_vertexStart.assign(numVertices + 1, 0);
+	for (size_t k = 0; k < m_indices.size(); k++)
+		m_vertexStart[m_indices[k] + 1]++;
+	for (int i = 0; i < numVertices; i++)
+		m_vertexStart[i + 1] += m_vertexStart[i];
+
+	vector<int> next(m_vertexStart.begin(), m_vertexStart.end() - 1);
+	m_vertexTriangles.resize(m_indices.size());
+	for (int t = 0; t < numTriangles; t++)
+		for (int k = 0; k < 3; k++)
+			m_vertexTriangles[next[m_indices[3*t + k]]++] = t;
+}
+
+void ClothRenderer::upload(bool indicesChanged)
+{
+	// a new store each frame, so the driver need not wait for the last
+	// frame's draw before taking the data
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(float), &m_vertices[0], GL_STREAM_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	if (m_indices.size() > m_indexCapacity)
+	{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_DYNAMIC_DRAW);
+		m_indexCapacity = m_indices.size();
+	}
+	else if (indicesChanged && m_changedBegin < m_changedEnd)
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, m_changedBegin * sizeof(unsigned int),
+		                (m_changedEnd - m_changedBegin) * sizeof(unsigned int), &m_indices[m_changedBegin]);
+	m_changedBegin = (int)m_indices.size();
+	m_changedEnd = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef CLOTHRENDERER_H
+#define CLOTHRENDERER_H
+
+#include <vector>
+#include <GL/glut.h>
+
+using namespace std;
+
+class ParticleSystem;
+class ThreadPool;
+
+// Draws a particle system's triangles with one indexed call per frame.
+// Positions and smooth vertex normals are computed into a persistent
+// interleaved array, in parallel on a pool of the drawing thread's own, and
+// streamed into a vertex buffer; the index buffer is only updated where
+// tearing changed the triangles (see ParticleSystem::getTriangleChanges).
+// Both sides of the cloth are lit from one set of triangles with two-sided
+// lighting. Without vertex buffers (before OpenGL 1.5) the same arrays are
+// drawn from client memory.
+//
+// The buffers belong to the GL context current at the first draw(), which
+// must also be current when the renderer is destroyed.
+class ClothRenderer
+{
+public:
+	ClothRenderer();
+	~ClothRenderer();
+
+	// draws system at its display positions; takes its topology lock while
+	// reading the triangles
+	void draw(ParticleSystem &system, const GLfloat color[4]);
+
+	// threads computing the normals; created with the first renderer
+	static ThreadPool &pool();
+
+private:
+	// copies the triangles that changed; true if any did
+	bool updateIndices(ParticleSystem &system);
+
+	// the per-vertex lists of triangles the normals are gathered from
+	void indexVertices(int numVertices);
+
+	void upload(bool indicesChanged);
+
+	vector<unsigned int> m_indices;	// a copy of the system's triangles
+	vector<int> m_vertexStart;	// per vertex, its range in m_vertexTriangles
+	vector<int> m_vertexTriangles;
+	vector<float> m_faceNormals;	// 3 per triangle
+	vector<float> m_vertices;	// per vertex, position then normal
+
+	bool m_initialized;	// m_indices holds all of the triangles
+	bool m_useBuffers;
+	GLuint m_vertexBuffer, m_indexBuffer;
+	size_t m_indexCapacity;	// of m_indexBuffer, in indices
+	int m_changedBegin, m_changedEnd;	// of m_indices, not yet uploaded
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "clothTopology.h"
+
+#include "edgeTable.h"
+
+void findClothSprings(const vector<int> &faces, vector<int> &edges, vector<int> &bends)
+{
+	// a closed mesh has 3/2 edges per triangle
+	int numTriangles = (int)faces.size() / 3;
+	EdgeTable table(numTriangles + numTriangles / 2);
+
+	// per edge, the vertex opposite it in its first triangle, or -1 once it
+	// has its bending spring
+	vector<int> opposite;
+	opposite.reserve(numTriangles + numTriangles / 2);
+
+	edges.clear();
+	bends.clear();
+	edges.reserve(3 * numTriangles);
+	bends.reserve(3 * numTriangles);
+
+	for (int t = 0; t < numTriangles; t++)
+	{
+		const int *v = &faces[3*t];
+		if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0])
+			continue;
+
+		for (int k = 0; k < 3; k++)
+		{
+			int a = v[k], b = v[(k + 1) % 3], c = v[(k + 2) % 3];
+			bool added;
+			int e = table.insert(a, b, added);
+			if (added)
+			{
+				edges.push_back(a);
+				edges.push_back(b);
+				opposite.push_back(c);
+			}
+			else if (opposite[e] >= 0)
+			{
+				if (opposite[e] != c)
+				{
+					bends.push_back(opposite[e]);
+					bends.push_back(c);
+				}
+				opposite[e] = -1;
+			}
+		}
+	}
+}
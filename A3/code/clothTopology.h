@@ -0,0 +1,17 @@
+#ifndef CLOTHTOPOLOGY_H
+#define CLOTHTOPOLOGY_H
+
+#include <vector>
+
+using namespace std;
+
+// The springs of a cloth made from a triangle mesh (3 vertex indices per
+// triangle in faces): one structural spring per unique edge into edges,
+// and one bending spring per edge shared by two triangles, between the two
+// vertices opposite it, into bends; 2 vertex indices per spring. Edges are
+// matched with an EdgeTable, so this is linear in the number of triangles.
+// Degenerate triangles are skipped, and an edge shared by more than two
+// triangles only bends across the first two.
+void findClothSprings(const vector<int> &faces, vector<int> &edges, vector<int> &bends);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+// Bounded lock-free FIFO between one producer and one consumer thread. The
+// producer only writes m_tail and the consumer only writes m_head, so each
+// side needs nothing more than acquire/release ordering on the other's
+// index. Capacity is N - 1 items.
+template <class T, int N>
+class CommandQueue
+{
+public:
+	CommandQueue():m_head(0), m_tail(0){}
+
+	// producer side; false if the queue is full
+	bool push(const T &item)
+	{
+		int tail = m_tail;
+		int next = (tail + 1) % N;
+		if (next == __atomic_load_n(&m_head, __ATOMIC_ACQUIRE))
+			return false;
+
+		m_items[tail] = item;
+		__atomic_store_n(&m_tail, next, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// consumer side; false if the queue is empty
+	bool pop(T &item)
+	{
+		int head = m_head;
+		if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+			return false;
+
+		item = m_items[head];
+		__atomic_store_n(&m_head, (head + 1) % N, __ATOMIC_RELEASE);
+		return true;
+	}
+
+private:
+	T m_items[N];
+
+	int m_head;	// next item to pop, written by the consumer
+	int m_tail;	// next free slot, written by the producer
+};
+
+#endif
@@ -0,0 +1,328 @@
+#include "distanceField.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "closestPoint.h"
+
+namespace
+{
+	// cells around each triangle whose nodes get exact distances before
+	// sweeping
+	const int exactBand = 1;
+
+	// distance from p to triangle t of the mesh
+	float triangleDistance(const float *p, const vector<float> &vertices, const int *t)
+	{
+		const float *a = &vertices[3*t[0]], *b = &vertices[3*t[1]], *c = &vertices[3*t[2]];
+		float w[3];
+		closestOnTriangle(p, a, b, c, w);
+
+		float d[3];
+		for (int axis = 0; axis < 3; axis++)
+			d[axis] = p[axis] - (w[0] * a[axis] + w[1] * b[axis] + w[2] * c[axis]);
+		return sqrt(dot3(d, d));
+	}
+
+	// twice the signed area of 2D triangle (a, b, c), in doubles so the sign
+	// is exact for float inputs
+	inline double orient(double ay, double az, double by, double bz, double cy, double cz)
+	{
+		return (by - ay) * (cz - az) - (bz - az) * (cy - ay);
+	}
+
+	// which of two triangles sharing an edge counts a point lying on it: of
+	// the two directions the edge has in them, exactly one passes
+	inline bool ownsEdge(double ey, double ez)
+	{
+		return ez > 0 || (ez == 0 && ey > 0);
+	}
+
+	inline int clampIndex(int i, int n) { return i < 0 ? 0 : (i >= n ? n - 1 : i); }
+}
+
+void DistanceField::reset(const Vector3f &lo, const Vector3f &hi, float cellSize)
+{
+	m_cellSize = cellSize;
+	m_lo = lo;
+	for (int axis = 0; axis < 3; axis++)
+		m_n[axis] = max(2, (int)ceil((hi[axis] - lo[axis]) / cellSize) + 1);
+	m_hi = node(m_n[0] - 1, m_n[1] - 1, m_n[2] - 1);
+
+	float far = cellSize * (m_n[0] + m_n[1] + m_n[2]);
+	m_phi.assign(m_n[0] * m_n[1] * m_n[2], far);
+}
+
+namespace
+{
+	struct Grid
+	{
+		float lo[3];
+		float cellSize;
+		int n[3];
+	};
+}
+
+void DistanceField::save(CheckpointWriter &out) const
+{
+	Grid grid;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		grid.lo[axis] = m_lo[axis];
+		grid.n[axis] = m_n[axis];
+	}
+	grid.cellSize = m_cellSize;
+	out.putValue("field.grid", grid);
+	out.putVector("field.phi", m_phi);
+}
+
+bool DistanceField::restore(const CheckpointReader &in)
+{
+	Grid grid;
+	vector<float> phi;
+	if (!in.getValue("field.grid", grid) || !in.getVector("field.phi", phi) ||
+	    grid.n[0] < 0 || grid.n[1] < 0 || grid.n[2] < 0 ||
+	    phi.size() != (size_t)grid.n[0] * grid.n[1] * grid.n[2])
+		return false;
+
+	m_cellSize = grid.cellSize;
+	m_lo = Vector3f(grid.lo[0], grid.lo[1], grid.lo[2]);
+	for (int axis = 0; axis < 3; axis++)
+		m_n[axis] = grid.n[axis];
+	m_hi = node(m_n[0] - 1, m_n[1] - 1, m_n[2] - 1);
+	m_phi.swap(phi);
+	return true;
+}
+
+void DistanceField::addSphere(const Vector3f &center, float radius)
+{
+	for (int k = 0; k < m_n[2]; k++)
+		for (int j = 0; j < m_n[1]; j++)
+			for (int i = 0; i < m_n[0]; i++)
+			{
+				float &phi = m_phi[index(i, j, k)];
+				phi = min(phi, (node(i, j, k) - center).abs() - radius);
+			}
+}
+
+void DistanceField::addBox(const Vector3f &center, const Vector3f &halfSize)
+{
+	for (int k = 0; k < m_n[2]; k++)
+		for (int j = 0; j < m_n[1]; j++)
+			for (int i = 0; i < m_n[0]; i++)
+			{
+				Vector3f x = node(i, j, k) - center;
+				float q[3], outside = 0, inside = -1e30f;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					q[axis] = fabs(x[axis]) - halfSize[axis];
+					outside += max(q[axis], 0.0f) * max(q[axis], 0.0f);
+					inside = max(inside, q[axis]);
+				}
+
+				float &phi = m_phi[index(i, j, k)];
+				phi = min(phi, sqrt(outside) + min(inside, 0.0f));
+			}
+}
+
+void DistanceField::addMesh(const TriangleMesh &mesh)
+{
+	if (empty())
+		return;
+
+	const float h = m_cellSize;
+	const float origin[3] = {m_lo[0], m_lo[1], m_lo[2]};
+	const int n = (int)m_phi.size();
+	const int numTriangles = mesh.numTriangles();
+
+	vector<float> vertices(3 * mesh.vertices.size());
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+		for (int axis = 0; axis < 3; axis++)
+			vertices[3*v + axis] = mesh.vertices[v][axis];
+	const int *faces = &mesh.faces[0];
+
+	vector<float> phi(n, h * (m_n[0] + m_n[1] + m_n[2]));
+	vector<int> closest(n, -1);
+	vector<int> crossings(n, 0);
+
+	for (int t = 0; t < numTriangles; t++)
+	{
+		const int *tri = faces + 3*t;
+		float lo[3], hi[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = hi[axis] = vertices[3*tri[0] + axis];
+			for (int c = 1; c < 3; c++)
+			{
+				lo[axis] = min(lo[axis], vertices[3*tri[c] + axis]);
+				hi[axis] = max(hi[axis], vertices[3*tri[c] + axis]);
+			}
+		}
+
+		// exact distances to the nodes around the triangle
+		int first[3], last[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			first[axis] = clampIndex((int)floor((lo[axis] - m_lo[axis]) / h) - exactBand, m_n[axis]);
+			last[axis] = clampIndex((int)ceil((hi[axis] - m_lo[axis]) / h) + exactBand, m_n[axis]);
+		}
+
+		for (int k = first[2]; k <= last[2]; k++)
+			for (int j = first[1]; j <= last[1]; j++)
+				for (int i = first[0]; i <= last[0]; i++)
+				{
+					float p[3] = {origin[0] + i * h, origin[1] + j * h, origin[2] + k * h};
+					float d = triangleDistance(p, vertices, tri);
+					int at = index(i, j, k);
+					if (d < phi[at])
+					{
+						phi[at] = d;
+						closest[at] = t;
+					}
+				}
+
+		// where the rays along +x through the (y, z) nodes cross the
+		// triangle; a node is inside if an odd number of crossings lie
+		// before it
+		double ya = vertices[3*tri[0] + 1], za = vertices[3*tri[0] + 2];
+		double yb = vertices[3*tri[1] + 1], zb = vertices[3*tri[1] + 2];
+		double yc = vertices[3*tri[2] + 1], zc = vertices[3*tri[2] + 2];
+		double area = orient(ya, za, yb, zb, yc, zc);
+		if (area == 0)
+			continue;
+		double s = area > 0 ? 1 : -1;
+
+		int j0 = max(0, (int)ceil((lo[1] - m_lo[1]) / h)), j1 = min(m_n[1] - 1, (int)floor((hi[1] - m_lo[1]) / h));
+		int k0 = max(0, (int)ceil((lo[2] - m_lo[2]) / h)), k1 = min(m_n[2] - 1, (int)floor((hi[2] - m_lo[2]) / h));
+		for (int k = k0; k <= k1; k++)
+			for (int j = j0; j <= j1; j++)
+			{
+				double y = m_lo[1] + j * h, z = m_lo[2] + k * h;
+
+				// barycentric weights, and the edges they vanish on, taken
+				// counterclockwise
+				double wa = s * orient(yb, zb, yc, zc, y, z);
+				double wb = s * orient(yc, zc, ya, za, y, z);
+				double wc = s * orient(ya, za, yb, zb, y, z);
+				if (wa < 0 || wb < 0 || wc < 0)
+					continue;
+				if ((wa == 0 && !ownsEdge(s * (yc - yb), s * (zc - zb))) ||
+					(wb == 0 && !ownsEdge(s * (ya - yc), s * (za - zc))) ||
+					(wc == 0 && !ownsEdge(s * (yb - ya), s * (zb - za))))
+					continue;
+
+				double x = (wa * vertices[3*tri[0]] + wb * vertices[3*tri[1]] + wc * vertices[3*tri[2]]) / (s * area);
+				int i = (int)ceil((x - m_lo[0]) / h);
+				if (i < m_n[0])
+					crossings[index(max(i, 0), j, k)]++;
+			}
+	}
+
+	// carry the closest triangles outwards from the band, sweeping the grid
+	// in all eight diagonal directions, twice
+	for (int pass = 0; pass < 2; pass++)
+		for (int sweep = 0; sweep < 8; sweep++)
+		{
+			int di = sweep & 1 ? -1 : 1, dj = sweep & 2 ? -1 : 1, dk = sweep & 4 ? -1 : 1;
+			int i0 = di > 0 ? 1 : m_n[0] - 2, j0 = dj > 0 ? 1 : m_n[1] - 2, k0 = dk > 0 ? 1 : m_n[2] - 2;
+
+			for (int k = k0; k >= 0 && k < m_n[2]; k += dk)
+				for (int j = j0; j >= 0 && j < m_n[1]; j += dj)
+					for (int i = i0; i >= 0 && i < m_n[0]; i += di)
+					{
+						int at = index(i, j, k);
+						float p[3] = {origin[0] + i * h, origin[1] + j * h, origin[2] + k * h};
+
+						// the face neighbours already visited in this sweep;
+						// diagonal ones are reached through the other sweeps
+						for (int m = 1; m < 8; m <<= 1)
+						{
+							int from = index(m & 1 ? i - di : i, m & 2 ? j - dj : j, m & 4 ? k - dk : k);
+							int t = closest[from];
+							if (t < 0 || t == closest[at])
+								continue;
+
+							float d = triangleDistance(p, vertices, faces + 3*t);
+							if (d < phi[at])
+							{
+								phi[at] = d;
+								closest[at] = t;
+							}
+						}
+					}
+		}
+
+	for (int k = 0; k < m_n[2]; k++)
+		for (int j = 0; j < m_n[1]; j++)
+		{
+			int count = 0;
+			for (int i = 0; i < m_n[0]; i++)
+			{
+				int at = index(i, j, k);
+				count += crossings[at];
+				if (count % 2 == 1)
+					phi[at] = -phi[at];
+				m_phi[at] = min(m_phi[at], phi[at]);
+			}
+		}
+}
+
+void DistanceField::locate(const Vector3f &p, int cell[3], float t[3]) const
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float f = (p[axis] - m_lo[axis]) / m_cellSize;
+		int c = (int)floor(f);
+		c = c < 0 ? 0 : (c > m_n[axis] - 2 ? m_n[axis] - 2 : c);
+		cell[axis] = c;
+		t[axis] = clamp01(f - c);
+	}
+}
+
+float DistanceField::distance(const Vector3f &p) const
+{
+	Vector3f gradient;
+	return distance(p, gradient);
+}
+
+float DistanceField::distance(const Vector3f &p, Vector3f &gradient) const
+{
+	if (empty())
+	{
+		gradient = Vector3f(0, 0, 0);
+		return 1e30f;
+	}
+
+	int c[3];
+	float t[3];
+	locate(p, c, t);
+
+	const int sx = 1, sy = m_n[0], sz = m_n[0] * m_n[1];
+	const float *phi = &m_phi[index(c[0], c[1], c[2])];
+	float c000 = phi[0], c100 = phi[sx], c010 = phi[sy], c110 = phi[sx + sy];
+	float c001 = phi[sz], c101 = phi[sx + sz], c011 = phi[sy + sz], c111 = phi[sx + sy + sz];
+
+	float x = t[0], y = t[1], z = t[2];
+	float c00 = c000 + x * (c100 - c000), c10 = c010 + x * (c110 - c010);
+	float c01 = c001 + x * (c101 - c001), c11 = c011 + x * (c111 - c011);
+	float c0 = c00 + y * (c10 - c00), c1 = c01 + y * (c11 - c01);
+	float d = c0 + z * (c1 - c0);
+
+	// outside the grid, from the nearest point on it
+	Vector3f q = p;
+	for (int axis = 0; axis < 3; axis++)
+		q[axis] = max(m_lo[axis], min(m_hi[axis], p[axis]));
+	float outside = (p - q).abs();
+	if (outside > 0)
+	{
+		gradient = (p - q) / outside;
+		return d + outside;
+	}
+
+	gradient[0] = (1 - z) * ((1 - y) * (c100 - c000) + y * (c110 - c010)) + z * ((1 - y) * (c101 - c001) + y * (c111 - c011));
+	gradient[1] = c10 - c00 + z * ((c11 - c01) - (c10 - c00));
+	gradient[2] = c1 - c0;
+	if (gradient.absSquared() > 0)
+		gradient.normalize();
+	return d;
+}
@@ -0,0 +1,66 @@
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <vector>
+#include <vecmath.h>
+
+#include "triangleMesh.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+// Signed distance to an obstacle, sampled once on a regular grid of nodes
+// and looked up by trilinear interpolation: negative inside, positive
+// outside. A lookup reads the 8 nodes around a point whatever the shape, so
+// colliding particles with a detailed mesh costs the same as with a sphere.
+//
+// A field starts out empty over a box and obstacles are added to it as a
+// union: analytic primitives exactly, and closed meshes by the method of
+// Bridson's makelevelset3 (exact distances near the triangles, propagated
+// outwards by fast sweeping, signs from the parity of ray crossings).
+class DistanceField
+{
+public:
+	DistanceField():m_cellSize(1){ m_n[0] = m_n[1] = m_n[2] = 0; }
+
+	// an empty field (everything far away) over [lo, hi], in cubes no larger
+	// than cellSize
+	void reset(const Vector3f &lo, const Vector3f &hi, float cellSize);
+
+	void addSphere(const Vector3f &center, float radius);
+	void addBox(const Vector3f &center, const Vector3f &halfSize);
+
+	// adds the inside of a closed, consistently wound mesh
+	void addMesh(const TriangleMesh &mesh);
+
+	bool empty() const { return m_phi.empty(); }
+	const Vector3f &lo() const { return m_lo; }
+	const Vector3f &hi() const { return m_hi; }
+
+	// interpolated signed distance at p. Outside the grid this is the value
+	// at the nearest grid point plus the distance to it.
+	float distance(const Vector3f &p) const;
+
+	// the same, and the gradient of the interpolant, normalized: the
+	// direction out of the obstacle
+	float distance(const Vector3f &p, Vector3f &gradient) const;
+
+	// the grid and its samples as checkpoint sections; restore is false,
+	// with the field unchanged, if they are missing or do not fit
+	void save(CheckpointWriter &out) const;
+	bool restore(const CheckpointReader &in);
+
+private:
+	int index(int i, int j, int k) const { return (k * m_n[1] + j) * m_n[0] + i; }
+	Vector3f node(int i, int j, int k) const { return m_lo + m_cellSize * Vector3f((float)i, (float)j, (float)k); }
+
+	// cell containing p (clamped to the grid) and p's position in it
+	void locate(const Vector3f &p, int cell[3], float t[3]) const;
+
+	Vector3f m_lo, m_hi;
+	float m_cellSize;
+	int m_n[3];	// nodes per axis
+	vector<float> m_phi;
+};
+
+#endif
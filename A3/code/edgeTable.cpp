@@ -0,0 +1,74 @@
+#include "edgeTable.h"
+
+#include <algorithm>
+
+EdgeTable::EdgeTable(int expectedEdges):m_size(0)
+{
+	unsigned int slots = 16;
+	while (slots < 2 * (unsigned int)max(expectedEdges, 0))
+		slots *= 2;
+	m_slots.assign(3 * slots, -1);
+	m_mask = slots - 1;
+}
+
+int EdgeTable::insert(int a, int b, bool &added)
+{
+	if (2 * (m_size + 1) > (int)(m_mask + 1))
+		grow();
+
+	int lo = min(a, b), hi = max(a, b);
+	unsigned int s = hash(lo, hi) & m_mask;
+	while (true)
+	{
+		int *slot = &m_slots[3 * s];
+		if (slot[0] < 0)
+		{
+			slot[0] = lo;
+			slot[1] = hi;
+			slot[2] = m_size++;
+			added = true;
+			return slot[2];
+		}
+		if (slot[0] == lo && slot[1] == hi)
+		{
+			added = false;
+			return slot[2];
+		}
+		s = (s + 1) & m_mask;
+	}
+}
+
+int EdgeTable::find(int a, int b) const
+{
+	int lo = min(a, b), hi = max(a, b);
+	unsigned int s = hash(lo, hi) & m_mask;
+	while (true)
+	{
+		const int *slot = &m_slots[3 * s];
+		if (slot[0] < 0)
+			return -1;
+		if (slot[0] == lo && slot[1] == hi)
+			return slot[2];
+		s = (s + 1) & m_mask;
+	}
+}
+
+void EdgeTable::grow()
+{
+	vector<int> old;
+	old.swap(m_slots);
+	unsigned int slots = 2 * (m_mask + 1);
+	m_slots.assign(3 * slots, -1);
+	m_mask = slots - 1;
+
+	for (size_t k = 0; k < old.size(); k += 3)
+		if (old[k] >= 0)
+		{
+			unsigned int s = hash(old[k], old[k + 1]) & m_mask;
+			while (m_slots[3 * s] >= 0)
+				s = (s + 1) & m_mask;
+			m_slots[3 * s] = old[k];
+			m_slots[3 * s + 1] = old[k + 1];
+			m_slots[3 * s + 2] = old[k + 2];
+		}
+}
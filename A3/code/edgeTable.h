@@ -0,0 +1,46 @@
+#ifndef EDGETABLE_H
+#define EDGETABLE_H
+
+#include <vector>
+
+using namespace std;
+
+// Undirected edges between vertex indices, numbered in the order they were
+// first inserted. The table is open-addressed with linear probing over a
+// power-of-two number of slots, at most half full, and each slot holds its
+// edge's two endpoints and number, so a lookup is a hash and usually one
+// cache line.
+class EdgeTable
+{
+public:
+	// sized for expectedEdges edges without growing
+	explicit EdgeTable(int expectedEdges = 0);
+
+	// the number of edge (a, b), equal to (b, a), adding it if it is new
+	int insert(int a, int b, bool &added);
+
+	// the number of edge (a, b), or -1 if it was never inserted
+	int find(int a, int b) const;
+
+	int size() const { return m_size; }
+
+private:
+	static unsigned int hash(int lo, int hi)
+	{
+		unsigned int h = (unsigned int)lo * 0x9E3779B1u + (unsigned int)hi;
+		h ^= h >> 16;
+		h *= 0x85EBCA6Bu;
+		h ^= h >> 13;
+		return h;
+	}
+
+	void grow();
+
+	// 3 ints per slot: lower endpoint, higher endpoint, number; the lower
+	// endpoint is -1 in empty slots
+	vector<int> m_slots;
+	unsigned int m_mask;
+	int m_size;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef FLOAT4_H
+#define FLOAT4_H
+
+// Four floats processed together: one SSE register where the compiler
+// targets SSE (every x86-64 build does), four plain floats elsewhere, with
+// the same operations either way. Comparisons return masks for select().
+
+#ifdef __SSE__
+
+#include <xmmintrin.h>
+
+struct Float4
+{
+	__m128 v;
+
+	Float4(){}
+	Float4(float s):v(_mm_set1_ps(s)){}
+	Float4(__m128 m):v(m){}
+
+	static Float4 load(const float *p) { return _mm_loadu_ps(p); }
+	void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+inline Float4 abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+inline Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+
+// a where mask is set, b elsewhere
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+#else
+
+#include <cmath>
+
+struct Float4
+{
+	float v[4];
+
+	Float4(){}
+	Float4(float s) { v[0] = v[1] = v[2] = v[3] = s; }
+
+	static Float4 load(const float *p) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = p[k]; return r; }
+	void store(float *p) const { for (int k = 0; k < 4; k++) p[k] = v[k]; }
+};
+
+#define FLOAT4_LANES(expr) Float4 r; for (int k = 0; k < 4; k++) r.v[k] = (expr); return r;
+
+inline Float4 operator+(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] + b.v[k]) }
+inline Float4 operator-(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] - b.v[k]) }
+inline Float4 operator*(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] * b.v[k]) }
+inline Float4 operator/(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] / b.v[k]) }
+inline Float4 min(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] < b.v[k] ? a.v[k] : b.v[k]) }
+inline Float4 max(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] > b.v[k] ? a.v[k] : b.v[k]) }
+inline Float4 sqrt(Float4 a) { FLOAT4_LANES(std::sqrt(a.v[k])) }
+inline Float4 abs(Float4 a) { FLOAT4_LANES(std::fabs(a.v[k])) }
+
+// masks are 0 or 1 per lane
+inline Float4 operator<(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] < b.v[k] ? 1.0f : 0.0f) }
+inline Float4 operator>(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] > b.v[k] ? 1.0f : 0.0f) }
+inline Float4 operator&(Float4 a, Float4 b) { FLOAT4_LANES(a.v[k] != 0 && b.v[k] != 0 ? 1.0f : 0.0f) }
+inline Float4 select(Float4 mask, Float4 a, Float4 b) { FLOAT4_LANES(mask.v[k] != 0 ? a.v[k] : b.v[k]) }
+
+#undef FLOAT4_LANES
+
+#endif
+
+#endif
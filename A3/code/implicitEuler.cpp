@@ -0,0 +1,323 @@
+#include "implicitEuler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// y = S x for a symmetric 3x3 block S = (xx, yy, zz, xy, xz, yz)
+	inline void symmetricMultiply(const float *S, float x, float y, float z, float &rx, float &ry, float &rz)
+	{
+		rx = S[0] * x + S[3] * y + S[4] * z;
+		ry = S[3] * x + S[1] * y + S[5] * z;
+		rz = S[4] * x + S[5] * y + S[2] * z;
+	}
+
+	// replaces a symmetric 3x3 block by its inverse (identity if singular)
+	void symmetricInvert(float *S)
+	{
+		float a = S[0], b = S[1], c = S[2], d = S[3], e = S[4], f = S[5];
+		float cxx = b * c - f * f;
+		float cxy = e * f - d * c;
+		float cxz = d * f - b * e;
+		float det = a * cxx + d * cxy + e * cxz;
+
+		if (fabsf(det) < 1e-20f)
+		{
+			S[0] = S[1] = S[2] = 1;
+			S[3] = S[4] = S[5] = 0;
+			return;
+		}
+
+		S[0] = cxx / det;
+		S[1] = (a * c - e * e) / det;
+		S[2] = (a * b - d * d) / det;
+		S[3] = cxy / det;
+		S[4] = cxz / det;
+		S[5] = (d * e - a * f) / det;
+	}
+
+	double dot(const vector<float> &a, const vector<float> &b)
+	{
+		double sum = 0;
+		for (size_t k = 0; k < a.size(); k++)
+			sum += a[k] * b[k];
+		return sum;
+	}
+}
+
+ImplicitEuler::ImplicitEuler(float tolerance, int maxIterations)
+	:m_tolerance(tolerance), m_maxIterations(maxIterations), m_iterations(0), m_springs(0), m_active(0), m_n(0)
+{
+}
+
+void ImplicitEuler::filter(vector<float> &v)
+{
+	int n = m_n;
+	for (int i = 0; i < n; i++)
+	{
+		if (m_constraint[i] == FIXED)
+			v[i] = v[n + i] = v[2*n + i] = 0;
+		else if (m_constraint[i] == CONTACT)
+		{
+			const float *N = &m_normals[3*i];
+			float vn = v[i] * N[0] + v[n + i] * N[1] + v[2*n + i] * N[2];
+			v[i] -= vn * N[0];
+			v[n + i] -= vn * N[1];
+			v[2*n + i] -= vn * N[2];
+		}
+	}
+}
+
+void ImplicitEuler::addStiffness(const float *p, vector<float> &q, float scale)
+{
+	const vector<Spring> &springs = *m_springs;
+	int n = m_n;
+	const float *px = p, *py = p + n, *pz = p + 2*n;
+	float *qx = &q[0], *qy = &q[n], *qz = &q[2*n];
+	size_t count = m_active ? m_active->size() : springs.size();
+
+	for (size_t k = 0; k < count; k++)
+	{
+		size_t s = m_active ? (*m_active)[k] : k;
+		int i = springs[s].i, j = springs[s].j;
+		float rx, ry, rz;
+		symmetricMultiply(&m_jacobians[6*s], px[i] - px[j], py[i] - py[j], pz[i] - pz[j], rx, ry, rz);
+
+		qx[i] += scale * rx; qy[i] += scale * ry; qz[i] += scale * rz;
+		qx[j] -= scale * rx; qy[j] -= scale * ry; qz[j] -= scale * rz;
+	}
+}
+
+void ImplicitEuler::multiply(const vector<float> &p, vector<float> &q)
+{
+	for (size_t k = 0; k < p.size(); k++)
+		q[k] = m_diagonal * p[k];
+
+	addStiffness(&p[0], q, -m_stiffnessScale);
+}
+
+void ImplicitEuler::precondition(const vector<float> &r, vector<float> &q)
+{
+	int n = m_n;
+	for (int i = 0; i < n; i++)
+		symmetricMultiply(&m_precond[6*i], r[i], r[n + i], r[2*n + i], q[i], q[n + i], q[2*n + i]);
+}
+
+// Classifies every particle and puts the prescribed part of its velocity
+// change into m_dv. A particle is in contact with the obstacle it is
+// nearest to when it is inside the collision shell, or when its explicit
+// velocity update would carry it below the surface within the step.
+void ImplicitEuler::findConstraints(ParticleSystem* particleSystem, float stepSize)
+{
+	const ParticleState &state = particleSystem->getParticleState();
+	const vector<int> &fixed = particleSystem->getFixedParticles();
+	float h = stepSize;
+	int n = m_n;
+
+	m_constraint.assign(n, FREE);
+	m_normals.resize(3 * n);
+	m_dv.assign(3 * n, 0);
+
+	bool obstacles = particleSystem->nearest_obstacles(state, m_gaps, m_gapNormals);
+	for (int i = 0; obstacles && i < n; i++)
+	{
+		Vector3f v = state.velocity(i);
+		Vector3f a = m_f.velocity(i);
+
+		float gap = m_gaps[i];
+		if (gap > 0.1f + h * (v + h * a).abs())
+			continue;
+		Vector3f N(m_gapNormals[i], m_gapNormals[n + i], m_gapNormals[2*n + i]);
+
+		float vn = Vector3f::dot(v, N);
+		float vn_min = -gap / h;
+		if (gap > 0.1f && vn + h * Vector3f::dot(a, N) >= vn_min)
+			continue;
+
+		// inelastic contact: end the step on the surface (pushed out of it if
+		// already inside), without the penalty force of evalF launching the
+		// particle off it
+		m_constraint[i] = CONTACT;
+		m_normals[3*i] = N[0];
+		m_normals[3*i + 1] = N[1];
+		m_normals[3*i + 2] = N[2];
+
+		float dvn = max(min(vn, 0.0f), vn_min) - vn;
+		m_dv[i] = dvn * N[0];
+		m_dv[n + i] = dvn * N[1];
+		m_dv[2*n + i] = dvn * N[2];
+	}
+
+	for (size_t ind = 0; ind < fixed.size(); ind++)
+	{
+		int i = fixed[ind];
+		m_constraint[i] = FIXED;
+		m_dv[i] = m_dv[n + i] = m_dv[2*n + i] = 0;
+	}
+
+	// sleeping particles are held where they are
+	if (particleSystem->getSleepingCount() > 0)
+		for (int i = 0; i < n; i++)
+			if (particleSystem->isAsleep(i))
+			{
+				m_constraint[i] = FIXED;
+				m_dv[i] = m_dv[n + i] = m_dv[2*n + i] = 0;
+			}
+}
+
+// spring force Jacobians df_i/dx_i at the current positions; the transverse
+// term is dropped for compressed springs to keep the matrix definite
+void ImplicitEuler::buildJacobians(const ParticleState &state)
+{
+	const vector<Spring> &springs = *m_springs;
+	const float *x = state.pos(0), *y = state.pos(1), *z = state.pos(2);
+
+	m_jacobians.resize(6 * springs.size());
+	size_t count = m_active ? m_active->size() : springs.size();
+	for (size_t ind = 0; ind < count; ind++)
+	{
+		size_t s = m_active ? (*m_active)[ind] : ind;
+		const Spring &spring = springs[s];
+		float *J = &m_jacobians[6*s];
+
+		float dx = x[spring.i] - x[spring.j];
+		float dy = y[spring.i] - y[spring.j];
+		float dz = z[spring.i] - z[spring.j];
+		float l = sqrtf(dx*dx + dy*dy + dz*dz);
+		if (l <= 0)
+		{
+			J[0] = J[1] = J[2] = J[3] = J[4] = J[5] = 0;
+			continue;
+		}
+
+		float nx = dx / l, ny = dy / l, nz = dz / l;
+		float c = max(0.0f, 1 - spring.len / l);
+		float k = -spring.stiff;
+
+		J[0] = k * ((1 - c) * nx * nx + c);
+		J[1] = k * ((1 - c) * ny * ny + c);
+		J[2] = k * ((1 - c) * nz * nz + c);
+		J[3] = k * (1 - c) * nx * ny;
+		J[4] = k * (1 - c) * nx * nz;
+		J[5] = k * (1 - c) * ny * nz;
+	}
+}
+
+// block-Jacobi preconditioner: inverse of each particle's 3x3 diagonal block
+void ImplicitEuler::buildPreconditioner()
+{
+	const vector<Spring> &springs = *m_springs;
+	int n = m_n;
+
+	m_precond.assign(6 * n, 0);
+	for (int i = 0; i < n; i++)
+		m_precond[6*i] = m_precond[6*i + 1] = m_precond[6*i + 2] = m_diagonal;
+
+	size_t count = m_active ? m_active->size() : springs.size();
+	for (size_t k = 0; k < count; k++)
+		for (int c = 0; c < 6; c++)
+		{
+			size_t s = m_active ? (*m_active)[k] : k;
+			float J = m_stiffnessScale * m_jacobians[6*s + c];
+			m_precond[6*springs[s].i + c] -= J;
+			m_precond[6*springs[s].j + c] -= J;
+		}
+
+	for (int i = 0; i < n; i++)
+		symmetricInvert(&m_precond[6*i]);
+}
+
+void ImplicitEuler::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	float h = stepSize;
+	float mass = particleSystem->getMass();
+	int n = state.size();
+
+	m_n = n;
+	m_springs = &particleSystem->getSprings();
+	m_active = particleSystem->getActiveSprings();
+	m_diagonal = 1 + h * particleSystem->getDragCoefficient() / mass;
+	m_stiffnessScale = h * h / mass;
+
+	evalF(particleSystem, state, m_f);
+
+	findConstraints(particleSystem, stepSize);
+	buildJacobians(state);
+	buildPreconditioner();
+
+	// right-hand side h f0 + h^2/m df/dx v0
+	const float *dv0 = m_f.vel(0);
+	m_b.resize(3 * n);
+	for (int k = 0; k < 3 * n; k++)
+		m_b[k] = h * dv0[k];
+	addStiffness(state.vel(0), m_b, m_stiffnessScale);
+
+	m_r.resize(3 * n);
+	m_c.resize(3 * n);
+	m_s.resize(3 * n);
+	m_q.resize(3 * n);
+
+	// modified preconditioned conjugate gradient (Baraff and Witkin, 5.3),
+	// starting from the prescribed velocity changes in m_dv
+	m_r = m_b;
+	filter(m_r);
+	precondition(m_r, m_s);
+	double delta0 = dot(m_r, m_s);
+
+	multiply(m_dv, m_q);
+	for (int k = 0; k < 3 * n; k++)
+		m_r[k] = m_b[k] - m_q[k];
+	filter(m_r);
+
+	precondition(m_r, m_c);
+	filter(m_c);
+	double delta = dot(m_r, m_c);
+
+	for (m_iterations = 0; m_iterations < m_maxIterations; m_iterations++)
+	{
+		if (delta <= m_tolerance * m_tolerance * delta0 || delta <= 0)
+			break;
+
+		multiply(m_c, m_q);
+		filter(m_q);
+		double cq = dot(m_c, m_q);
+		if (cq <= 0)
+			break;
+
+		float alpha = delta / cq;
+		for (int k = 0; k < 3 * n; k++)
+		{
+			m_dv[k] += alpha * m_c[k];
+			m_r[k] -= alpha * m_q[k];
+		}
+
+		precondition(m_r, m_s);
+		double delta_old = delta;
+		delta = dot(m_r, m_s);
+
+		float beta = delta / delta_old;
+		for (int k = 0; k < 3 * n; k++)
+			m_c[k] = m_s[k] + beta * m_c[k];
+		filter(m_c);
+	}
+
+	// v' = v + dv, x' = x + h (dx/dt + dv), which is x + h v' for free
+	// particles and the prescribed motion for fixed ones
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float *px = state.pos(axis);
+		float *pv = state.vel(axis);
+		const float *dx = m_f.pos(axis);
+		const float *dv = &m_dv[axis * n];
+
+		for (int i = 0; i < n; i++)
+		{
+			pv[i] += dv[i];
+			px[i] += h * (dx[i] + dv[i]);
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef IMPLICITEULER_H
+#define IMPLICITEULER_H
+
+#include <vector>
+
+#include "TimeStepper.hpp"
+
+// Backward Euler in the style of Baraff and Witkin, "Large Steps in Cloth
+// Simulation". Spring forces and drag are linearised around the current
+// state and integrated implicitly, which solves
+//
+//   (I - h df/dv - h^2 df/dx) dv = h (f0 + h df/dx v0)
+//
+// for the velocity change with a block-Jacobi preconditioned conjugate
+// gradient. df/dx is never assembled: each step only stores one symmetric
+// 3x3 Jacobian per spring and applies the matrix spring by spring.
+// Everything else in evalF (gravity, wind, friction) enters explicitly
+// through f0.
+//
+// Constraints are enforced inside the solve by filtering, as in the paper:
+// fixed particles get no velocity change at all (they keep following the
+// position derivative evalF gives them), and particles touching an
+// obstacle have their normal velocity prescribed so that they end the step
+// on the surface instead of in it. Sleeping particles are held like fixed
+// ones, and springs between two of them are left out altogether.
+class ImplicitEuler:public TimeStepper
+{
+public:
+  ImplicitEuler(float tolerance = 1e-4f, int maxIterations = 200);
+
+  void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  // conjugate gradient iterations used by the last step
+  int getIterations() const { return m_iterations; }
+
+private:
+  enum Constraint { FREE, FIXED, CONTACT };
+
+  void findConstraints(ParticleSystem* particleSystem, float stepSize);
+  void buildJacobians(const ParticleState &state);
+  void buildPreconditioner();
+
+  // q = A p for the current step's matrix
+  void multiply(const vector<float> &p, vector<float> &q);
+  // adds scale * df/dx p to q
+  void addStiffness(const float *p, vector<float> &q, float scale);
+  // q = P r with the block-Jacobi preconditioner
+  void precondition(const vector<float> &r, vector<float> &q);
+  // removes the constrained components
+  void filter(vector<float> &v);
+
+  float m_tolerance;
+  int m_maxIterations;
+  int m_iterations;
+
+  const vector<Spring> *m_springs;
+  const vector<int> *m_active;	// the springs to use, or 0 for all of them
+  int m_n;
+
+  // A = m_diagonal I - m_stiffnessScale sum_s J_s
+  float m_diagonal, m_stiffnessScale;
+
+  ParticleState m_f;
+
+  // symmetric 3x3 blocks stored as (xx, yy, zz, xy, xz, yz)
+  vector<float> m_jacobians;	// per spring
+  vector<float> m_precond;	// per particle, inverse of the diagonal block
+
+  vector<char> m_constraint;
+  vector<float> m_normals;	// 3 per particle, contact normal
+
+  // distance of every particle to the nearest obstacle and the normal
+  // there, as ParticleSystem::nearest_obstacles gives them
+  vector<float> m_gaps, m_gapNormals;
+
+  // 3n vectors laid out like ParticleState's velocity arrays
+  vector<float> m_b, m_dv, m_r, m_c, m_s, m_q;
+};
+
+#endif
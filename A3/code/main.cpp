@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <vector>
@@ -14,6 +17,9 @@
 #include "simpleSystem.h"
 #include "pendulumSystem.h"
 #include "ClothSystem.h"
+#include "simulationThread.h"
+#include "trajectoryCache.h"
+#include "benchmark.h"
 
 using namespace std;
 
@@ -23,38 +29,246 @@ namespace
 
     ParticleSystem *system;
     TimeStepper * timeStepper;
+    float stepSize = 0.04f;
+
+    // what the cloth falls on, if not the sphere, and the cloth itself, if
+    // not the grid; kept for resets
+    TriangleMesh obstacle;
+    bool useObstacle = false;
+    TriangleMesh cloth;
+    bool useCloth = false;
+    int gridSize = 40;	// rows and columns of the grid cloth
+
+    ParticleSystem * makeCloth()
+    {
+        if (useCloth)
+            return new ClothSystem(cloth, useObstacle ? &obstacle : 0);
+        return new ClothSystem(gridSize, gridSize, useObstacle ? &obstacle : 0);
+    }
+
+    // 'k' saves the simulation here and 'r' goes back to it, once there is
+    // something to go back to
+    const char *checkpointPath = "a3.ckpt";
+    bool checkpointed = false;
+
+    // saves posted with 'k', and how many of them the simulation thread
+    // has been seen to write or fail
+    int savesPosted = 0, savesWritten = 0, savesFailed = 0;
+
+    // a cloth from a checkpoint, or 0 if it cannot be read
+    ParticleSystem * restoreCloth(const char *path)
+    {
+        CheckpointReader checkpoint;
+        ClothSystem *restored = new ClothSystem();
+        if (checkpoint.open(path) && restored->restore(checkpoint))
+            return restored;
+        delete restored;
+        return 0;
+    }
+
+    // every system handed to the simulation thread, oldest first; the ones
+    // before the system it publishes are done with
+    vector<ParticleSystem *> liveSystems;
+
+    void retireSystems(ParticleSystem *current)
+    {
+        size_t k = 0;
+        while (k < liveSystems.size() && liveSystems[k] != current)
+            k++;
+        if (k == liveSystems.size())
+            return;
+        for (size_t r = 0; r < k; r++)
+            delete liveSystems[r];
+        liveSystems.erase(liveSystems.begin(), liveSystems.begin() + k);
+    }
+
+    // steps the system; everything else reaches it through commands
+    SimulationThread simThread;
+
+    // takes in what became of the saves the simulation thread carried out,
+    // reporting failures; with wait, first waits until all posted ones
+    // have been carried out, so 'r' goes back to the newest
+    void collectSaves(bool wait)
+    {
+        int written = simThread.checkpointsWritten(), failed = simThread.checkpointsFailed();
+        while (wait && written + failed < savesPosted)
+        {
+            timespec t;
+            t.tv_sec = 0;
+            t.tv_nsec = 1000000;
+            nanosleep(&t, 0);
+            written = simThread.checkpointsWritten();
+            failed = simThread.checkpointsFailed();
+        }
+
+        if (written > savesWritten)
+            checkpointed = true;
+        if (failed > savesFailed)
+        {
+            cerr << "Cannot write checkpoint " << checkpointPath;
+            if (checkpointed)
+                cerr << ", 'r' goes back to the last one saved";
+            cerr << "." << endl;
+        }
+        savesWritten = written;
+        savesFailed = failed;
+    }
+
+    // simulated seconds per wall-clock second, live and in playback
+    const float timeScale = 2;
+
+    // "a3 record": every step also goes to the cache, which is complete
+    // once the viewer is left with Escape
+    TrajectoryWriter recorder;
+    const char *recordPath = 0;
+
+    // the simulation thread uses the global pool, so it has to end first
+    void stopSimulation()
+    {
+      simThread.stop();
+      recorder.close();
+    }
+
+    // "a3 play": frames come from the cache instead of the simulation
+    TrajectoryReader player;
+    bool playing = false;
+    double playStart;
+    int playFrame = -1;	// the frame in playPrevious, playCurrent is the next
+    vector<float> playPrevious, playCurrent;
+    // time spent drawing, with glFinish, since 'v' last switched between
+    // the streamed and the immediate cloth drawing
+    double drawTime = 0;
+    int drawFrames = 0;
+
     float cameraDistance = 20;
     float zoomFactor = 0.9;
 
 
   // initialize your particle systems
-  ///TODO: read argv here. set timestepper , step size etc
+  // usage: a3 [e|t|r|s|v|d|i|x|p] [stepSize] [obstacle.obj|-] [cloth.obj|size]
+  //   e: forward Euler, t: trapezoidal, r: RK4 (default),
+  //   s: symplectic Euler, v: velocity Verlet,
+  //   d: adaptive Dormand-Prince, i: implicit Euler,
+  //   x: position-based (XPBD), p: projective dynamics
+  // A closed OBJ mesh (e.g. ../../A0/code/torus.obj) replaces the sphere the
+  // cloth falls on; "-" keeps the sphere. Any OBJ mesh after it replaces the
+  // grid cloth, and a number instead sets the grid's size (40 by default).
+  // "a3 run" and "a3 bench" run without a window (see benchmark.h).
+  //
+  // usage: a3 record <cache> [e|t|r|s|v|d|i|x|p] [stepSize] [obstacle.obj|-] [cloth.obj|size]
+  //        a3 play <cache> [obstacle.obj|-] [cloth.obj|size]
+  //        a3 resume <checkpoint> [e|t|r|s|v|d|i|x|p] [stepSize]
+  // record simulates as above and writes every step to a trajectory cache
+  // (see trajectoryCache.h); play loops through one without simulating,
+  // on the same meshes as it was recorded with. resume continues from a
+  // checkpoint saved with 'k' (see checkpoint.h), which 'k' then updates.
+  void loadMeshes(const char *obstacleName, const char *clothName)
+  {
+    useObstacle = obstacleName != 0 && strcmp(obstacleName, "-") != 0 && obstacle.load(obstacleName);
+    if (clothName != 0 && strspn(clothName, "0123456789") == strlen(clothName))
+      gridSize = max(atoi(clothName), 2);
+    else
+      useCloth = clothName != 0 && cloth.load(clothName);
+  }
+
   void initSystem(int argc, char * argv[])
   {
     // seed the random number generator with the current time
     srand( time( NULL ) );
+    loadMeshes(argc > 3 ? argv[3] : 0, argc > 4 ? argv[4] : 0);
+
     system = new SimpleSystem();
     system = new PendulumSystem(4);
-    system = new ClothSystem(40, 40);
-    timeStepper = new RK4();		
+    system = checkpointed ? restoreCloth(checkpointPath) : 0;
+    if (checkpointed && system == 0)
+    {
+      cerr << "Cannot restore " << checkpointPath << ", starting over." << endl;
+      checkpointed = false;
+    }
+    if (system == 0)
+      system = makeCloth();
+    liveSystems.push_back(system);
+
+    timeStepper = argc > 1 ? makeTimeStepper(argv[1][0]) : new RK4();
+    if (timeStepper == 0)
+    {
+      cerr << "Unknown integrator " << argv[1] << ", using RK4." << endl;
+      timeStepper = new RK4();
+    }
+
+    // the clock divides by the step, so it has to be positive
+    if (argc > 2 && !(atof(argv[2]) > 0))
+      cerr << "Invalid step size " << argv[2] << ", using " << stepSize << "." << endl;
+    else if (argc > 2)
+      stepSize = atof(argv[2]);
+
+    if (recordPath != 0)
+    {
+      if (recorder.open(recordPath, system->getParticleState().size(), stepSize))
+        simThread.setRecorder(&recorder);
+      else
+        cerr << "Cannot write " << recordPath << ", not recording." << endl;
+    }
+
+    // simulated time runs at twice wall-clock speed, which is the pace of the
+    // original one 0.04 step per 20 ms timer tick
+    simThread.start(system, timeStepper, stepSize, timeScale);
   }
 
-  // Take a step forward for the particle shower
-  ///TODO: Optional. modify this function to display various particle systems
-  ///and switch between different timeSteppers
-  void stepSystem()
+  // argv: cache, obstacle, cloth; false if the cache does not fit the cloth
+  bool initPlayback(int argc, char * argv[])
   {
-      ///TODO The stepsize should change according to commandline arguments
-      // TODO: how to decrese h but not look slow motion
-    const float h = 0.04f;
-    if(timeStepper!=0){
-      timeStepper->takeStep(system,h);
+    if (!player.open(argv[0]))
+    {
+      cerr << "Cannot read " << argv[0] << "." << endl;
+      return false;
+    }
+    loadMeshes(argc > 1 ? argv[1] : 0, argc > 2 ? argv[2] : 0);
+    system = makeCloth();
+    int n = system->getParticleState().size();
+    if (player.getNumParticles() != n || player.getFrames() == 0 || !(player.getStepSize() > 0))
+    {
+      cerr << argv[0] << " has " << player.getFrames() << " frames of "
+           << player.getNumParticles() << " particles, the cloth has " << n << "." << endl;
+      return false;
     }
+    cout << "Playing " << player.getFrames() << " frames of " << n << " particles." << endl;
+
+    playing = true;
+    playStart = wallTime();
+    playPrevious.resize(3 * n);
+    playCurrent.resize(3 * n);
+    return true;
   }
 
-  // Draw the current particle positions
+  // the cache at the live pace, looping; frames are decoded when the
+  // display passes into them
+  void drawPlayback()
+  {
+    int frames = player.getFrames();
+    double position = (wallTime() - playStart) * timeScale / player.getStepSize();
+    int frame = (int)fmod(position, (double)frames);
+    int next = frame + 1 < frames ? frame + 1 : frame;
+    if (frame != playFrame)
+    {
+      if (frame == playFrame + 1)
+        playPrevious.swap(playCurrent);
+      else
+        player.frame(frame, &playPrevious[0]);
+      player.frame(next, &playCurrent[0]);
+      playFrame = frame;
+    }
+
+    system->interpolateDisplay(&playPrevious[0], &playCurrent[0], (float)(position - floor(position)));
+    system->draw();
+  }
+
+  // Draw the particle positions of the latest snapshot, interpolated to now
   void drawSystem()
   {
+    const SimulationSnapshot &snapshot = simThread.latestSnapshot();
+    retireSystems(snapshot.system);
+    collectSaves(false);
     
     // Base material colors (they don't change)
     GLfloat particleColor[] = {0.4f, 0.7f, 1.0f, 1.0f};
@@ -64,7 +278,27 @@ namespace
     
     glutSolidSphere(0.1f,10.0f,10.0f);
     
-    system->draw();
+    if (playing)
+      drawPlayback();
+    else if (snapshot.system != 0)
+    {
+      snapshot.system->interpolateDisplay(&snapshot.previous[0], &snapshot.current[0],
+                                          snapshot.alphaAt(wallTime()));
+      snapshot.system->draw();
+
+      // awake and sleeping particles of the frame, in the title bar
+      static int shownAwake = -1, shownSleeping = -1;
+      int sleeping = snapshot.sleeping;
+      int awake = (int)snapshot.current.size() / 3 - sleeping;
+      if (awake != shownAwake || sleeping != shownSleeping)
+      {
+        char title[64];
+        sprintf(title, "Assignment 4 - %d awake, %d asleep", awake, sleeping);
+        glutSetWindowTitle(title);
+        shownAwake = awake;
+        shownSleeping = sleeping;
+      }
+    }
     
     
     glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, floorColor);
@@ -114,26 +348,41 @@ namespace
         }
         case 'x':
         {
-            system->toggleSwing(0);
-            printf("swing " + system->getSwing(0) ? "on" : "off");
+            simThread.post(SimulationCommand(SimulationCommand::TOGGLE_SWING, 0));
             break;
         }
         case 'y':
         {
-            system->toggleSwing(1);
-            printf("swing " + system->getSwing(1) ? "on" : "off");
+            simThread.post(SimulationCommand(SimulationCommand::TOGGLE_SWING, 1));
             break;
         }
         case 's':
         case 'z':
         {
-            system->toggleSwing(2);
-            printf("swing " + system->getSwing(2) ? "on" : "off");
+            simThread.post(SimulationCommand(SimulationCommand::TOGGLE_SWING, 2));
             break;
         }
         case 'r':
         {
-            system = new ClothSystem(40, 40);
+            if (playing)
+            {
+                playStart = wallTime();
+                break;
+            }
+            collectSaves(true);
+            system = checkpointed ? restoreCloth(checkpointPath) : 0;
+            if (checkpointed && system == 0)
+                cerr << "Cannot restore " << checkpointPath << ", starting over." << endl;
+            if (system == 0)
+                system = makeCloth();
+            liveSystems.push_back(system);
+            simThread.post(SimulationCommand(SimulationCommand::RESET, 0, system));
+            break;
+        }
+        case 'k':
+        {
+            if (!playing && simThread.post(SimulationCommand(SimulationCommand::SAVE_CHECKPOINT, 0, 0, checkpointPath)))
+                savesPosted++;
             break;
         }
         case 'i':
@@ -150,7 +399,32 @@ namespace
         }
         case 'w':
         {
-            system->toggleWind();
+            simThread.post(SimulationCommand(SimulationCommand::TOGGLE_WIND));
+            break;
+        }
+        case 't':
+        {
+            simThread.post(SimulationCommand(SimulationCommand::TOGGLE_TEARING));
+            break;
+        }
+        case 'l':
+        {
+            simThread.post(SimulationCommand(SimulationCommand::TOGGLE_SLEEPING));
+            break;
+        }
+        case 'v':
+        {
+            if (drawFrames > 0)
+                printf("%s drawing: %.2f ms per frame over %d frames\n", ClothSystem::streamed ? "streamed" : "immediate",
+                       1000 * drawTime / drawFrames, drawFrames);
+            ClothSystem::streamed = !ClothSystem::streamed;
+            drawTime = 0;
+            drawFrames = 0;
+            break;
+        }
+        case 'c':
+        {
+            simThread.post(SimulationCommand(SimulationCommand::PRINT_STATS));
             break;
         }
         default:
@@ -263,7 +537,11 @@ namespace
 
         // THIS IS WHERE THE DRAW CODE GOES.
 
+        double start = wallTime();
         drawSystem();
+        glFinish();
+        drawTime += wallTime() - start;
+        drawFrames++;
 
         // This draws the coordinate axes when you're rotating, to
         // keep yourself oriented.
@@ -302,10 +580,9 @@ namespace
         glutSwapBuffers();
     }
 
+    // redraw regularly; the simulation thread keeps its own time
     void timerFunc(int t)
     {
-        stepSystem();
-
         glutPostRedisplay();
 
         glutTimerFunc(t, &timerFunc, t);
@@ -321,6 +598,13 @@ namespace
 // Set up OpenGL, define the callbacks and start the main loop
 int main( int argc, char* argv[] )
 {
+    // a3 bench <name> runs a benchmark, and a3 run a simulation, instead of
+    // the viewer
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return runBenchmark(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "run") == 0)
+        return runHeadless(argc - 2, argv + 2);
+
     glutInit( &argc, argv );
 
     // We're going to animate it, so double buffer 
@@ -341,7 +625,29 @@ int main( int argc, char* argv[] )
     initRendering();
 
     // Setup particle system
-    initSystem(argc,argv);
+    if (argc > 2 && strcmp(argv[1], "play") == 0)
+    {
+        if (!initPlayback(argc - 2, argv + 2))
+            return 1;
+    }
+    else if (argc > 2 && strcmp(argv[1], "record") == 0)
+    {
+        recordPath = argv[2];
+        initSystem(argc - 2, argv + 2);
+    }
+    else if (argc > 2 && strcmp(argv[1], "resume") == 0)
+    {
+        checkpointPath = argv[2];
+        checkpointed = true;
+        initSystem(argc - 2, argv + 2);
+    }
+    else
+        initSystem(argc,argv);
+
+    // registered after the global thread pool exists, so it runs before the
+    // pool is destroyed, whichever way the program exits
+    ThreadPool::global();
+    atexit(stopSimulation);
 
     // Set up callback functions for key presses
     glutKeyboardFunc(keyboardFunc); // Handles "normal" ascii symbols
@@ -0,0 +1,491 @@
+#include "meshCollision.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "closestPoint.h"
+#include "simulationClock.h"
+
+namespace
+{
+	// leaf pairs per chunk of the narrow phase
+	const int pairGrain = 64;
+
+	// a connected patch whose normals stay within this of their mean is
+	// taken to be too flat to touch itself; below 90 degrees it is a height
+	// field, and the margin keeps steep parts of it from coming close
+	const float flatAngle = 3.14159265f / 4;
+
+	// true if boxes a and b (lo[3], hi[3] each) overlap
+	inline bool overlaps(const float *a, const float *b)
+	{
+		return a[0] <= b[3] && b[0] <= a[3] &&
+		       a[1] <= b[4] && b[1] <= a[4] &&
+		       a[2] <= b[5] && b[2] <= a[5];
+	}
+
+	// true if start (one more than the nodes) cuts [0, size) into ranges,
+	// one per node, in order
+	bool isPartition(const vector<int> &start, int nodes, size_t size)
+	{
+		if ((int)start.size() != nodes + 1 || start[0] != 0 || start[nodes] != (int)size)
+			return false;
+		for (int node = 0; node < nodes; node++)
+			if (start[node] > start[node + 1])
+				return false;
+		return true;
+	}
+
+	bool indicesBelow(const vector<int> &indices, int n)
+	{
+		for (size_t k = 0; k < indices.size(); k++)
+			if (indices[k] < 0 || indices[k] >= n)
+				return false;
+		return true;
+	}
+
+	// true if point p lies in box b
+	inline bool contains(const float *b, const float *p)
+	{
+		return b[0] <= p[0] && p[0] <= b[3] &&
+		       b[1] <= p[1] && p[1] <= b[4] &&
+		       b[2] <= p[2] && p[2] <= b[5];
+	}
+
+	inline void gather(const ParticleState &state, int i, float *p)
+	{
+		p[0] = state.pos(0)[i];
+		p[1] = state.pos(1)[i];
+		p[2] = state.pos(2)[i];
+	}
+
+	// fills in the direction and length of sum a_k x_k, the positions of
+	// p_k being x[k]; false if not closer than thickness, or degenerate
+	bool finish(MeshSelfCollision::Proximity &prox, const float x[4][3], float thickness)
+	{
+		float d[3];
+		for (int axis = 0; axis < 3; axis++)
+			d[axis] = prox.a[0] * x[0][axis] + prox.a[1] * x[1][axis] + prox.a[2] * x[2][axis] + prox.a[3] * x[3][axis];
+
+		float dd = dot3(d, d);
+		if (dd >= thickness * thickness || dd <= 1e-18f)
+			return false;
+
+		prox.d = sqrt(dd);
+		for (int axis = 0; axis < 3; axis++)
+			prox.n[axis] = d[axis] / prox.d;
+		return true;
+	}
+}
+
+bool MeshSelfCollision::Proximity::operator<(const Proximity &o) const
+{
+	for (int k = 0; k < 4; k++)
+		if (p[k] != o.p[k])
+			return p[k] < o.p[k];
+	for (int k = 0; k < 4; k++)
+		if (a[k] != o.a[k])
+			return a[k] < o.a[k];
+	return false;
+}
+
+// narrow phase of a range of overlapping leaf pairs
+class MeshSelfCollision::PairTask:public ParallelTask
+{
+public:
+	MeshSelfCollision *owner;
+	const ParticleState *state;
+
+	void run(int begin, int end)
+	{
+		int chunk = begin / pairGrain;
+		vector<Proximity> &found = owner->m_chunkProximities[chunk];
+		found.clear();
+		int vertexTriangle = 0, edgeEdge = 0;
+		for (int k = begin; k < end; k++)
+		{
+			int a = owner->m_leafPairs[k].first, b = owner->m_leafPairs[k].second;
+			owner->testVertices(a, b, *state, found);
+			if (a != b)
+				owner->testVertices(b, a, *state, found);
+			vertexTriangle = (int)found.size() - edgeEdge;
+			owner->testEdges(a, b, *state, found);
+			edgeEdge = (int)found.size() - vertexTriangle;
+		}
+		owner->m_chunkCounts[2*chunk] = vertexTriangle;
+		owner->m_chunkCounts[2*chunk + 1] = edgeEdge;
+	}
+};
+
+MeshSelfCollision::MeshSelfCollision(float thickness):m_thickness(thickness)
+{
+	m_timings.refit = m_timings.traversal = m_timings.response = 0;
+	m_timings.vertexTriangle = m_timings.edgeEdge = 0;
+}
+
+void MeshSelfCollision::build(const vector<int> &triangles, const ParticleState &state)
+{
+	m_triangles = triangles;
+	m_bvh.build(triangles, state);
+
+	vector<pair<int, int> > edges;
+	for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+		for (int k = 0; k < 3; k++)
+		{
+			int a = triangles[t + k], b = triangles[t + (k + 1) % 3];
+			edges.push_back(make_pair(min(a, b), max(a, b)));
+		}
+	sort(edges.begin(), edges.end());
+	edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+	m_edges.resize(2 * edges.size());
+	for (size_t e = 0; e < edges.size(); e++)
+	{
+		m_edges[2*e] = edges[e].first;
+		m_edges[2*e + 1] = edges[e].second;
+	}
+	m_removedTriangles.assign(triangles.size() / 3, 0);
+	m_removedEdges.assign(edges.size(), 0);
+
+	// give every vertex and edge to the first leaf that has it
+	int nodes = m_bvh.numNodes();
+	vector<char> vertexTaken(state.size(), 0), edgeTaken(edges.size(), 0);
+
+	m_vertexStart.assign(nodes + 1, 0);
+	m_edgeStart.assign(nodes + 1, 0);
+	m_vertices.clear();
+	m_leafEdges.clear();
+
+	for (int node = 0; node < nodes; node++)
+	{
+		const TriangleBVH::Node &leaf = m_bvh.node(node);
+		for (int k = leaf.first; k < leaf.first + leaf.count; k++)
+		{
+			const int *tri = &triangles[3 * m_bvh.triangleAt(k)];
+			for (int v = 0; v < 3; v++)
+			{
+				if (!vertexTaken[tri[v]])
+				{
+					vertexTaken[tri[v]] = 1;
+					m_vertices.push_back(tri[v]);
+				}
+
+				pair<int, int> edge(min(tri[v], tri[(v + 1) % 3]), max(tri[v], tri[(v + 1) % 3]));
+				int e = (int)(lower_bound(edges.begin(), edges.end(), edge) - edges.begin());
+				if (!edgeTaken[e])
+				{
+					edgeTaken[e] = 1;
+					m_leafEdges.push_back(e);
+				}
+			}
+		}
+		m_vertexStart[node + 1] = (int)m_vertices.size();
+		m_edgeStart[node + 1] = (int)m_leafEdges.size();
+	}
+}
+
+void MeshSelfCollision::removeTriangle(int t)
+{
+	m_removedTriangles[t] = 1;
+}
+
+// m_edges is sorted, so the edge is found by bisection
+void MeshSelfCollision::removeEdge(int a, int b)
+{
+	int lo = min(a, b), hi = max(a, b);
+	int first = 0, count = (int)m_edges.size() / 2;
+	while (count > 0)
+	{
+		int half = count / 2, e = first + half;
+		if (m_edges[2*e] < lo || (m_edges[2*e] == lo && m_edges[2*e + 1] < hi))
+		{
+			first = e + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+	if (2 * first < (int)m_edges.size() && m_edges[2*first] == lo && m_edges[2*first + 1] == hi)
+		m_removedEdges[first] = 1;
+}
+
+void MeshSelfCollision::save(CheckpointWriter &out) const
+{
+	out.putVector("self.triangles", m_triangles);
+	out.putVector("self.edges", m_edges);
+	out.putVector("self.vertStart", m_vertexStart);
+	out.putVector("self.vertices", m_vertices);
+	out.putVector("self.edgeStart", m_edgeStart);
+	out.putVector("self.leafEdges", m_leafEdges);
+	out.putVector("self.tornTris", m_removedTriangles);
+	out.putVector("self.tornEdges", m_removedEdges);
+	m_bvh.save(out);
+}
+
+bool MeshSelfCollision::restore(const CheckpointReader &in, const ParticleState &state)
+{
+	vector<int> triangles, edges, vertexStart, vertices, edgeStart, leafEdges;
+	vector<char> removedTriangles, removedEdges;
+	if (!in.getVector("self.triangles", triangles) || !in.getVector("self.edges", edges) ||
+	    !in.getVector("self.vertStart", vertexStart) || !in.getVector("self.vertices", vertices) ||
+	    !in.getVector("self.edgeStart", edgeStart) || !in.getVector("self.leafEdges", leafEdges) ||
+	    !in.getVector("self.tornTris", removedTriangles) || !in.getVector("self.tornEdges", removedEdges) ||
+	    triangles.size() != 3 * removedTriangles.size() || edges.size() != 2 * removedEdges.size() ||
+	    !indicesBelow(triangles, state.size()) || !indicesBelow(edges, state.size()) ||
+	    !indicesBelow(vertices, state.size()) || !indicesBelow(leafEdges, (int)removedEdges.size()) ||
+	    !m_bvh.restore(in, triangles))
+		return false;
+
+	int nodes = m_bvh.numNodes();
+	if (!isPartition(vertexStart, nodes, vertices.size()) || !isPartition(edgeStart, nodes, leafEdges.size()))
+	{
+		m_bvh = TriangleBVH();
+		return false;
+	}
+
+	m_triangles.swap(triangles);
+	m_edges.swap(edges);
+	m_vertexStart.swap(vertexStart);
+	m_vertices.swap(vertices);
+	m_edgeStart.swap(edgeStart);
+	m_leafEdges.swap(leafEdges);
+	m_removedTriangles.swap(removedTriangles);
+	m_removedEdges.swap(removedEdges);
+	return true;
+}
+
+// removed edges and triangles get empty boxes, which nothing overlaps
+void MeshSelfCollision::updateBounds(const ParticleState &state)
+{
+	const float *x[3] = {state.pos(0), state.pos(1), state.pos(2)};
+	float r = m_thickness;
+
+	m_vertexPositions.resize(3 * m_vertices.size());
+	for (size_t k = 0; k < m_vertices.size(); k++)
+		for (int axis = 0; axis < 3; axis++)
+			m_vertexPositions[3*k + axis] = x[axis][m_vertices[k]];
+
+	m_edgeBoxes.resize(6 * m_leafEdges.size());
+	for (size_t k = 0; k < m_leafEdges.size(); k++)
+	{
+		const int *e = &m_edges[2 * m_leafEdges[k]];
+		bool removed = m_removedEdges[m_leafEdges[k]] != 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			m_edgeBoxes[6*k + axis] = removed ? FLT_MAX : min(x[axis][e[0]], x[axis][e[1]]) - r;
+			m_edgeBoxes[6*k + 3 + axis] = removed ? -FLT_MAX : max(x[axis][e[0]], x[axis][e[1]]) + r;
+		}
+	}
+
+	int n = m_bvh.numTriangles();
+	m_triangleBoxes.resize(6 * n);
+	for (int k = 0; k < n; k++)
+	{
+		const int *t = &m_triangles[3 * m_bvh.triangleAt(k)];
+		bool removed = m_removedTriangles[m_bvh.triangleAt(k)] != 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float *c = x[axis];
+			m_triangleBoxes[6*k + axis] = removed ? FLT_MAX : min(c[t[0]], min(c[t[1]], c[t[2]])) - r;
+			m_triangleBoxes[6*k + 3 + axis] = removed ? -FLT_MAX : max(c[t[0]], max(c[t[1]], c[t[2]])) + r;
+		}
+	}
+}
+
+// owned vertices of leaf against the triangles of other
+void MeshSelfCollision::testVertices(int leaf, int other, const ParticleState &state, vector<Proximity> &found) const
+{
+	const TriangleBVH::Node &node = m_bvh.node(other);
+
+	for (int k = m_vertexStart[leaf]; k < m_vertexStart[leaf + 1]; k++)
+	{
+		const float *p = &m_vertexPositions[3 * k];
+		if (!contains(node.lo, p))
+			continue;
+
+		int v = m_vertices[k];
+		float x[4][3];
+		gather(state, v, x[0]);
+		for (int t = node.first; t < node.first + node.count; t++)
+		{
+			if (!contains(&m_triangleBoxes[6 * t], p))
+				continue;
+			const int *tri = &m_triangles[3 * m_bvh.triangleAt(t)];
+			if (tri[0] == v || tri[1] == v || tri[2] == v)
+				continue;
+
+			for (int c = 0; c < 3; c++)
+				gather(state, tri[c], x[c + 1]);
+			float w[3];
+			closestOnTriangle(x[0], x[1], x[2], x[3], w);
+
+			Proximity prox;
+			prox.p[0] = v;
+			prox.a[0] = 1;
+			for (int c = 0; c < 3; c++)
+			{
+				prox.p[c + 1] = tri[c];
+				prox.a[c + 1] = -w[c];
+			}
+			if (finish(prox, x, m_thickness))
+				found.push_back(prox);
+		}
+	}
+}
+
+// owned edges of leaf against the owned edges of other
+void MeshSelfCollision::testEdges(int leaf, int other, const ParticleState &state, vector<Proximity> &found) const
+{
+	const TriangleBVH::Node &node = m_bvh.node(other);
+
+	for (int i = m_edgeStart[leaf]; i < m_edgeStart[leaf + 1]; i++)
+	{
+		const float *box = &m_edgeBoxes[6 * i];
+		if (!overlaps(box, node.lo))
+			continue;
+
+		const int *ab = &m_edges[2 * m_leafEdges[i]];
+		int a = ab[0], b = ab[1];
+		float x[4][3];
+		gather(state, a, x[0]);
+		gather(state, b, x[1]);
+
+		// within one leaf, each pair once
+		int j = leaf == other ? i + 1 : m_edgeStart[other];
+		for (; j < m_edgeStart[other + 1]; j++)
+		{
+			if (!overlaps(box, &m_edgeBoxes[6 * j]))
+				continue;
+			const int *cd = &m_edges[2 * m_leafEdges[j]];
+			int c = cd[0], d = cd[1];
+			if (c == a || c == b || d == a || d == b)
+				continue;
+
+			gather(state, c, x[2]);
+			gather(state, d, x[3]);
+			float s, u;
+			closestOnSegments(x[0], x[1], x[2], x[3], s, u);
+
+			Proximity prox;
+			prox.p[0] = a; prox.a[0] = 1 - s;
+			prox.p[1] = b; prox.a[1] = s;
+			prox.p[2] = c; prox.a[2] = -(1 - u);
+			prox.p[3] = d; prox.a[3] = -u;
+			if (finish(prox, x, m_thickness))
+				found.push_back(prox);
+		}
+	}
+}
+
+// Between two leaves whose particles are all held, every proximity would
+// get an impulse that changes nothing, so such pairs are not tested.
+void MeshSelfCollision::dropHeldPairs()
+{
+	int nodes = m_bvh.numNodes();
+	m_leafHeld.assign(nodes, 0);
+	for (int node = 0; node < nodes; node++)
+	{
+		const TriangleBVH::Node &leaf = m_bvh.node(node);
+		bool held = leaf.count > 0;
+		for (int k = leaf.first; held && k < leaf.first + leaf.count; k++)
+		{
+			const int *tri = &m_triangles[3 * m_bvh.triangleAt(k)];
+			held = m_fixed[tri[0]] && m_fixed[tri[1]] && m_fixed[tri[2]];
+		}
+		m_leafHeld[node] = held;
+	}
+
+	size_t kept = 0;
+	for (size_t k = 0; k < m_leafPairs.size(); k++)
+		if (!m_leafHeld[m_leafPairs[k].first] || !m_leafHeld[m_leafPairs[k].second])
+			m_leafPairs[kept++] = m_leafPairs[k];
+	m_leafPairs.resize(kept);
+}
+
+int MeshSelfCollision::apply(ParticleState &state, const vector<int> &fixed, float stepSize, ThreadPool &pool,
+	const vector<char> *asleep)
+{
+	if (m_bvh.empty())
+		return 0;
+
+	if (asleep != 0 && (int)asleep->size() == state.size())
+		m_fixed = *asleep;
+	else
+		m_fixed.assign(state.size(), 0);
+	for (size_t k = 0; k < fixed.size(); k++)
+		m_fixed[fixed[k]] = 1;
+
+	double start = wallTime();
+	m_bvh.refit(state, m_thickness);
+	updateBounds(state);
+	double refitted = wallTime();
+
+	m_bvh.overlappingLeaves(m_leafPairs, flatAngle);
+	dropHeldPairs();
+
+	// the chunk buffers only grow, so they keep their capacity
+	int chunks = ((int)m_leafPairs.size() + pairGrain - 1) / pairGrain;
+	if ((int)m_chunkProximities.size() < chunks)
+		m_chunkProximities.resize(chunks);
+	m_chunkCounts.resize(2 * chunks);
+
+	PairTask task;
+	task.owner = this;
+	task.state = &state;
+	pool.parallelFor(0, (int)m_leafPairs.size(), task, pairGrain);
+
+	m_proximities.clear();
+	m_timings.vertexTriangle = m_timings.edgeEdge = 0;
+	for (int chunk = 0; chunk < chunks; chunk++)
+	{
+		const vector<Proximity> &found = m_chunkProximities[chunk];
+		m_proximities.insert(m_proximities.end(), found.begin(), found.end());
+		m_timings.vertexTriangle += m_chunkCounts[2*chunk];
+		m_timings.edgeEdge += m_chunkCounts[2*chunk + 1];
+	}
+
+	// the response in particle order, whatever the order of the leaf pairs
+	sort(m_proximities.begin(), m_proximities.end());
+	double traversed = wallTime();
+
+	// one Gauss-Seidel pass: keep approaching pairs from closing in, and
+	// separate overlapping ones gently, by a tenth of the overlap per step
+	float h = stepSize;
+	int pushed = 0;
+	for (size_t c = 0; c < m_proximities.size(); c++)
+	{
+		const Proximity &prox = m_proximities[c];
+		Vector3f n(prox.n[0], prox.n[1], prox.n[2]);
+
+		float vn = 0, weight = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			vn += prox.a[k] * Vector3f::dot(state.velocity(prox.p[k]), n);
+			if (!m_fixed[prox.p[k]])
+				weight += prox.a[k] * prox.a[k];
+		}
+
+		float target = 0.1f * (m_thickness - prox.d) / h;
+		if (vn >= target || weight <= 0)
+			continue;
+
+		float impulse = (target - vn) / weight;
+		pushed++;
+		for (int k = 0; k < 4; k++)
+		{
+			int i = prox.p[k];
+			if (m_fixed[i])
+				continue;
+			Vector3f dv = prox.a[k] * impulse * n;
+			state.addVelocity(i, dv);
+			state.setPosition(i, state.position(i) + h * dv);
+		}
+	}
+	double responded = wallTime();
+
+	m_timings.refit = (refitted - start) * 1e3;
+	m_timings.traversal = (traversed - refitted) * 1e3;
+	m_timings.response = (responded - traversed) * 1e3;
+	return pushed;
+}
@@ -0,0 +1,126 @@
+#ifndef MESHCOLLISION_H
+#define MESHCOLLISION_H
+
+#include <vector>
+
+#include "particleState.h"
+#include "threadPool.h"
+#include "triangleBVH.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+// Triangle-level self-collision of a cloth mesh, after Bridson, Fedkiw and
+// Anderson, "Robust Treatment of Collisions, Contact and Friction for Cloth
+// Animation". After a step, vertex-triangle and edge-edge pairs closer than
+// the cloth thickness are found through a refit TriangleBVH, and repulsion
+// impulses push them apart along the line between their closest points.
+//
+// Candidates come from traversing the hierarchy against itself. Every
+// vertex and edge is owned by one leaf that contains it, so for a pair of
+// overlapping leaves the owned vertices of one are tested against the
+// triangles of the other and the owned edges against the owned edges, and
+// every candidate pair is tested exactly once. Flat connected patches are
+// culled by their normal cones, so a smooth sheet costs little more than the
+// refit.
+//
+// Every proximity is written in one form: four particles p with weights a,
+// such that sum a_k x_k is the vector between the two closest points
+// (vertex minus point on triangle, or point on one edge minus point on the
+// other) and n its direction. An impulse I changes the velocity of p_k by
+// a_k I n, which moves the relative normal velocity by I sum a_k^2.
+class MeshSelfCollision
+{
+public:
+	struct Timings
+	{
+		double refit, traversal, response;	// milliseconds, last step
+		int vertexTriangle, edgeEdge;		// proximities found
+	};
+
+	MeshSelfCollision(float thickness = 0.05f);
+
+	void setThickness(float thickness) { m_thickness = thickness; }
+	float getThickness() const { return m_thickness; }
+
+	// sets up the hierarchy and edge list; call again when the triangles
+	// change
+	void build(const vector<int> &triangles, const ParticleState &state);
+
+	// takes triangle t, by its index in the triangles given to build, or
+	// the edge (a, b), if it is one, out of the tests, as when the cloth
+	// tears; the hierarchy keeps them, with empty boxes
+	void removeTriangle(int t);
+	void removeEdge(int a, int b);
+
+	// the triangles, hierarchy, edges and leaf ownership build set up and
+	// what was removed since, as checkpoint sections; restore copies them
+	// back without building, or is false if the sections are missing or do
+	// not fit state
+	void save(CheckpointWriter &out) const;
+	bool restore(const CheckpointReader &in, const ParticleState &state);
+
+	// finds the proximities in state and resolves them, changing velocities
+	// by the impulses and positions by stepSize times that change, as if the
+	// corrected velocity had been used over the step. Fixed particles act
+	// as infinitely heavy, and so do the sleeping ones if asleep is given
+	// (see ParticleSystem::getSleeping). Returns the number of pairs pushed
+	// apart, none if state was left as it was.
+	int apply(ParticleState &state, const vector<int> &fixed, float stepSize, ThreadPool &pool,
+		const vector<char> *asleep = 0);
+
+	const Timings &getTimings() const { return m_timings; }
+
+	struct Proximity
+	{
+		int p[4];
+		float a[4];
+		float n[3];
+		float d;
+
+		bool operator<(const Proximity &o) const;
+	};
+
+private:
+	class PairTask;
+
+	void dropHeldPairs();
+	void updateBounds(const ParticleState &state);
+
+	// tests of one pair of overlapping leaves
+	void testVertices(int leaf, int other, const ParticleState &state, vector<Proximity> &found) const;
+	void testEdges(int leaf, int other, const ParticleState &state, vector<Proximity> &found) const;
+
+	float m_thickness;
+
+	vector<int> m_triangles;
+	vector<int> m_edges;	// unique edges, 2 particles each, lower index first
+	vector<char> m_removedTriangles, m_removedEdges;
+	TriangleBVH m_bvh;
+
+	// per node: owned vertices m_vertices[m_vertexStart[node] ..
+	// m_vertexStart[node + 1]), and owned edges likewise (empty for inner
+	// nodes)
+	vector<int> m_vertexStart, m_vertices;
+	vector<int> m_edgeStart, m_leafEdges;
+
+	// refreshed every step so the narrow phase reads contiguous memory:
+	// positions of m_vertices, boxes (lo, hi) of m_leafEdges, and boxes of
+	// the triangles in BVH leaf order, each grown by the thickness
+	vector<float> m_vertexPositions, m_edgeBoxes, m_triangleBoxes;
+
+	vector<pair<int, int> > m_leafPairs;
+	vector<char> m_leafHeld;	// per node, a leaf whose particles are all fixed
+
+	// what each chunk of leaf pairs found (see pairGrain), with its
+	// vertex-triangle and edge-edge counts, kept between steps so a step in
+	// contact allocates nothing; joined in order into m_proximities
+	vector<vector<Proximity> > m_chunkProximities;
+	vector<int> m_chunkCounts;
+	vector<Proximity> m_proximities;
+	vector<char> m_fixed;
+
+	Timings m_timings;
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include "obstacle.h"
+
+#include <cmath>
+#include <GL/glut.h>
+
+#include "float4.h"
+
+namespace
+{
+	// Runs kernel(x, y, z, gap, nx, ny, nz) on Float4s over the points, four
+	// at a time. The last partial block is padded with copies of its first
+	// point and only the real lanes are written back.
+	template <class Kernel>
+	void evaluateBlocks(const Kernel &kernel, const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz)
+	{
+		Float4 g, a, b, c;
+		int k = 0;
+		for (; k + 4 <= count; k += 4)
+		{
+			kernel(Float4::load(x + k), Float4::load(y + k), Float4::load(z + k), g, a, b, c);
+			g.store(gap + k);
+			a.store(nx + k);
+			b.store(ny + k);
+			c.store(nz + k);
+		}
+
+		if (k == count)
+			return;
+
+		float in[3][4], out[4][4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			int from = k + lane < count ? k + lane : k;
+			in[0][lane] = x[from];
+			in[1][lane] = y[from];
+			in[2][lane] = z[from];
+		}
+		kernel(Float4::load(in[0]), Float4::load(in[1]), Float4::load(in[2]), g, a, b, c);
+		g.store(out[0]);
+		a.store(out[1]);
+		b.store(out[2]);
+		c.store(out[3]);
+		for (int lane = 0; k + lane < count; lane++)
+		{
+			gap[k + lane] = out[0][lane];
+			nx[k + lane] = out[1][lane];
+			ny[k + lane] = out[2][lane];
+			nz[k + lane] = out[3][lane];
+		}
+	}
+
+	// -1 where a is negative, 1 elsewhere
+	inline Float4 sign(Float4 a)
+	{
+		return select(a < Float4(0.0f), Float4(-1.0f), Float4(1.0f));
+	}
+
+	// d normalized into (nx, ny, nz), given its length; straight up where
+	// the length is 0 and there is no direction
+	inline void normalize(Float4 dx, Float4 dy, Float4 dz, Float4 length, Float4 &nx, Float4 &ny, Float4 &nz)
+	{
+		Float4 valid = length > Float4(0.0f);
+		Float4 inv = Float4(1.0f) / length;
+		nx = select(valid, dx * inv, Float4(0.0f));
+		ny = select(valid, dy * inv, Float4(1.0f));
+		nz = select(valid, dz * inv, Float4(0.0f));
+	}
+
+	struct SphereKernel
+	{
+		Float4 cx, cy, cz, radius;
+
+		void operator()(Float4 x, Float4 y, Float4 z, Float4 &gap, Float4 &nx, Float4 &ny, Float4 &nz) const
+		{
+			Float4 dx = x - cx, dy = y - cy, dz = z - cz;
+			Float4 length = sqrt(dx * dx + dy * dy + dz * dz);
+			gap = length - radius;
+			normalize(dx, dy, dz, length, nx, ny, nz);
+		}
+	};
+
+	ObstacleRecord blankRecord(int kind)
+	{
+		ObstacleRecord record;
+		record.kind = kind;
+		for (int k = 0; k < 7; k++)
+			record.values[k] = 0;
+		return record;
+	}
+
+	void putVector(float *values, const Vector3f &v)
+	{
+		values[0] = v[0];
+		values[1] = v[1];
+		values[2] = v[2];
+	}
+
+	Vector3f getVector(const float *values)
+	{
+		return Vector3f(values[0], values[1], values[2]);
+	}
+
+	struct PlaneKernel
+	{
+		Float4 px, py, pz, offset;
+
+		void operator()(Float4 x, Float4 y, Float4 z, Float4 &gap, Float4 &nx, Float4 &ny, Float4 &nz) const
+		{
+			gap = px * x + py * y + pz * z - offset;
+			nx = px;
+			ny = py;
+			nz = pz;
+		}
+	};
+
+	struct BoxKernel
+	{
+		Float4 cx, cy, cz, hx, hy, hz;
+
+		void operator()(Float4 x, Float4 y, Float4 z, Float4 &gap, Float4 &nx, Float4 &ny, Float4 &nz) const
+		{
+			Float4 dx = x - cx, dy = y - cy, dz = z - cz;
+			Float4 qx = abs(dx) - hx, qy = abs(dy) - hy, qz = abs(dz) - hz;
+			Float4 zero(0.0f);
+
+			// outside: from the nearest point on the box, a corner, edge or
+			// face
+			Float4 ox = max(qx, zero), oy = max(qy, zero), oz = max(qz, zero);
+			Float4 outside = sqrt(ox * ox + oy * oy + oz * oz);
+
+			// inside: out through the nearest face (faces equally near share
+			// the normal)
+			Float4 deepest = max(qx, max(qy, qz));
+			Float4 ix = select(qx < deepest, zero, sign(dx));
+			Float4 iy = select(qy < deepest, zero, sign(dy));
+			Float4 iz = select(qz < deepest, zero, sign(dz));
+			Float4 inv = Float4(1.0f) / sqrt(ix * ix + iy * iy + iz * iz);
+
+			Float4 isOutside = outside > zero;
+			gap = outside + min(deepest, zero);
+			Float4 scale = Float4(1.0f) / outside;
+			nx = select(isOutside, sign(dx) * ox * scale, ix * inv);
+			ny = select(isOutside, sign(dy) * oy * scale, iy * inv);
+			nz = select(isOutside, sign(dz) * oz * scale, iz * inv);
+		}
+	};
+
+	struct CapsuleKernel
+	{
+		Float4 ax, ay, az, abx, aby, abz, invLength2, radius;
+
+		void operator()(Float4 x, Float4 y, Float4 z, Float4 &gap, Float4 &nx, Float4 &ny, Float4 &nz) const
+		{
+			Float4 px = x - ax, py = y - ay, pz = z - az;
+			Float4 t = (px * abx + py * aby + pz * abz) * invLength2;
+			t = min(max(t, Float4(0.0f)), Float4(1.0f));
+
+			Float4 dx = px - t * abx, dy = py - t * aby, dz = pz - t * abz;
+			Float4 length = sqrt(dx * dx + dy * dy + dz * dz);
+			gap = length - radius;
+			normalize(dx, dy, dz, length, nx, ny, nz);
+		}
+	};
+}
+
+float Obstacle::distance(const Vector3f &p, Vector3f &normal) const
+{
+	float gap, nx, ny, nz;
+	evaluate(&p[0], &p[1], &p[2], 1, &gap, &nx, &ny, &nz);
+	normal = Vector3f(nx, ny, nz);
+	return gap;
+}
+
+void SphereObstacle::evaluate(const float *x, const float *y, const float *z, int count,
+	float *gap, float *nx, float *ny, float *nz) const
+{
+	SphereKernel kernel;
+	kernel.cx = m_center[0];
+	kernel.cy = m_center[1];
+	kernel.cz = m_center[2];
+	kernel.radius = m_radius;
+	evaluateBlocks(kernel, x, y, z, count, gap, nx, ny, nz);
+}
+
+void SphereObstacle::draw() const
+{
+	glPushMatrix();
+	glTranslatef(m_center[0], m_center[1], m_center[2]);
+	glutSolidSphere(m_radius, 40, 40);
+	glPopMatrix();
+}
+
+PlaneObstacle::PlaneObstacle(const Vector3f &normal, const Vector3f &point)
+{
+	m_normal = normal.normalized();
+	m_offset = Vector3f::dot(m_normal, point);
+}
+
+void PlaneObstacle::evaluate(const float *x, const float *y, const float *z, int count,
+	float *gap, float *nx, float *ny, float *nz) const
+{
+	PlaneKernel kernel;
+	kernel.px = m_normal[0];
+	kernel.py = m_normal[1];
+	kernel.pz = m_normal[2];
+	kernel.offset = m_offset;
+	evaluateBlocks(kernel, x, y, z, count, gap, nx, ny, nz);
+}
+
+void BoxObstacle::evaluate(const float *x, const float *y, const float *z, int count,
+	float *gap, float *nx, float *ny, float *nz) const
+{
+	BoxKernel kernel;
+	kernel.cx = m_center[0];
+	kernel.cy = m_center[1];
+	kernel.cz = m_center[2];
+	kernel.hx = m_halfSize[0];
+	kernel.hy = m_halfSize[1];
+	kernel.hz = m_halfSize[2];
+	evaluateBlocks(kernel, x, y, z, count, gap, nx, ny, nz);
+}
+
+void BoxObstacle::draw() const
+{
+	glPushMatrix();
+	glTranslatef(m_center[0], m_center[1], m_center[2]);
+	glScalef(2 * m_halfSize[0], 2 * m_halfSize[1], 2 * m_halfSize[2]);
+	glutSolidCube(1);
+	glPopMatrix();
+}
+
+void CapsuleObstacle::evaluate(const float *x, const float *y, const float *z, int count,
+	float *gap, float *nx, float *ny, float *nz) const
+{
+	Vector3f ab = m_b - m_a;
+	float length2 = ab.absSquared();
+
+	CapsuleKernel kernel;
+	kernel.ax = m_a[0];
+	kernel.ay = m_a[1];
+	kernel.az = m_a[2];
+	kernel.abx = ab[0];
+	kernel.aby = ab[1];
+	kernel.abz = ab[2];
+	kernel.invLength2 = length2 > 0 ? 1 / length2 : 0;
+	kernel.radius = m_radius;
+	evaluateBlocks(kernel, x, y, z, count, gap, nx, ny, nz);
+}
+
+void CapsuleObstacle::draw() const
+{
+	Vector3f ab = m_b - m_a;
+	float length = ab.abs();
+
+	glPushMatrix();
+	glTranslatef(m_a[0], m_a[1], m_a[2]);
+	glutSolidSphere(m_radius, 40, 40);
+
+	// turn +z, the axis of GLU's cylinders, onto ab
+	if (length > 0)
+	{
+		Vector3f axis = Vector3f::cross(Vector3f(0, 0, 1), ab);
+		float angle = acos(ab[2] / length) * 180 / M_PI;
+		if (axis.absSquared() > 0)
+			glRotatef(angle, axis[0], axis[1], axis[2]);
+		else if (ab[2] < 0)
+			glRotatef(180, 1, 0, 0);
+
+		GLUquadric *quadric = gluNewQuadric();
+		gluCylinder(quadric, m_radius, m_radius, length, 40, 1);
+		gluDeleteQuadric(quadric);
+
+		glTranslatef(0, 0, length);
+		glutSolidSphere(m_radius, 40, 40);
+	}
+	glPopMatrix();
+}
+
+// trilinear lookups do not vectorize like the closed forms; one per point
+void FieldObstacle::evaluate(const float *x, const float *y, const float *z, int count,
+	float *gap, float *nx, float *ny, float *nz) const
+{
+	for (int k = 0; k < count; k++)
+	{
+		Vector3f gradient;
+		gap[k] = m_field->distance(Vector3f(x[k], y[k], z[k]), gradient);
+		nx[k] = gradient[0];
+		ny[k] = gradient[1];
+		nz[k] = gradient[2];
+	}
+}
+
+void FieldObstacle::draw() const
+{
+	if (m_mesh != 0)
+		m_mesh->draw();
+}
+
+ObstacleRecord SphereObstacle::record() const
+{
+	ObstacleRecord record = blankRecord(ObstacleRecord::sphere);
+	putVector(record.values, m_center);
+	record.values[3] = m_radius;
+	return record;
+}
+
+ObstacleRecord PlaneObstacle::record() const
+{
+	ObstacleRecord record = blankRecord(ObstacleRecord::plane);
+	putVector(record.values, m_normal);
+	record.values[3] = m_offset;
+	return record;
+}
+
+ObstacleRecord BoxObstacle::record() const
+{
+	ObstacleRecord record = blankRecord(ObstacleRecord::box);
+	putVector(record.values, m_center);
+	putVector(record.values + 3, m_halfSize);
+	return record;
+}
+
+ObstacleRecord CapsuleObstacle::record() const
+{
+	ObstacleRecord record = blankRecord(ObstacleRecord::capsule);
+	putVector(record.values, m_a);
+	putVector(record.values + 3, m_b);
+	record.values[6] = m_radius;
+	return record;
+}
+
+ObstacleRecord FieldObstacle::record() const
+{
+	return blankRecord(ObstacleRecord::field);
+}
+
+Obstacle *Obstacle::create(const ObstacleRecord &record, const DistanceField *field, const TriangleMesh *mesh)
+{
+	const float *v = record.values;
+	switch (record.kind)
+	{
+	case ObstacleRecord::sphere:
+		return new SphereObstacle(getVector(v), v[3]);
+	case ObstacleRecord::plane:
+		return new PlaneObstacle(getVector(v), v[3]);
+	case ObstacleRecord::box:
+		return new BoxObstacle(getVector(v), getVector(v + 3));
+	case ObstacleRecord::capsule:
+		return new CapsuleObstacle(getVector(v), getVector(v + 3), v[6]);
+	case ObstacleRecord::field:
+		return field != 0 ? new FieldObstacle(field, mesh) : 0;
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+#ifndef OBSTACLE_H
+#define OBSTACLE_H
+
+#include <vecmath.h>
+
+#include "distanceField.h"
+#include "triangleMesh.h"
+
+// An obstacle's kind and parameters, as checkpoints hold it: a sphere's
+// center and radius, a plane's unit normal and offset, a box's center and
+// half size, a capsule's ends and radius. A field obstacle records only
+// its kind; its field is restored by whoever owns it.
+struct ObstacleRecord
+{
+	enum Kind { sphere, plane, box, capsule, field };
+
+	int kind;
+	float values[7];
+};
+
+// A static shape particles collide with. Shapes are queried a block of
+// particles at a time, on component arrays like ParticleState's, so the
+// analytic ones can run four particles per SSE instruction (see float4.h)
+// instead of one virtual call and a few Vector3f temporaries per particle.
+class Obstacle
+{
+public:
+	virtual ~Obstacle(){}
+
+	// for the count points (x[k], y[k], z[k]): the signed distance to the
+	// surface (negative inside) into gap[k], and the outward unit normal at
+	// the nearest surface point into (nx[k], ny[k], nz[k])
+	virtual void evaluate(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz) const = 0;
+
+	// the same for a single point
+	float distance(const Vector3f &p, Vector3f &normal) const;
+
+	virtual void draw() const = 0;
+
+	virtual ObstacleRecord record() const = 0;
+
+	// the obstacle a record describes, a field one on field and mesh; 0 if
+	// the kind is unknown or there is no field for it
+	static Obstacle *create(const ObstacleRecord &record, const DistanceField *field = 0,
+		const TriangleMesh *mesh = 0);
+};
+
+class SphereObstacle:public Obstacle
+{
+public:
+	SphereObstacle(const Vector3f &center, float radius):m_center(center), m_radius(radius){}
+
+	void evaluate(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz) const;
+	void draw() const;
+	ObstacleRecord record() const;
+
+private:
+	Vector3f m_center;
+	float m_radius;
+};
+
+// the half-space below the plane through point with the given normal; not
+// drawn, the scene draws its own floor
+class PlaneObstacle:public Obstacle
+{
+public:
+	PlaneObstacle(const Vector3f &normal, const Vector3f &point);
+
+	// the plane normal . x = offset, normal already of unit length
+	PlaneObstacle(const Vector3f &normal, float offset):m_normal(normal), m_offset(offset){}
+
+	void evaluate(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz) const;
+	void draw() const {}
+	ObstacleRecord record() const;
+
+private:
+	Vector3f m_normal;
+	float m_offset;	// normal . point
+};
+
+// axis-aligned
+class BoxObstacle:public Obstacle
+{
+public:
+	BoxObstacle(const Vector3f &center, const Vector3f &halfSize):m_center(center), m_halfSize(halfSize){}
+
+	void evaluate(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz) const;
+	void draw() const;
+	ObstacleRecord record() const;
+
+private:
+	Vector3f m_center, m_halfSize;
+};
+
+// the points within radius of the segment a-b
+class CapsuleObstacle:public Obstacle
+{
+public:
+	CapsuleObstacle(const Vector3f &a, const Vector3f &b, float radius):m_a(a), m_b(b), m_radius(radius){}
+
+	void evaluate(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz) const;
+	void draw() const;
+	ObstacleRecord record() const;
+
+private:
+	Vector3f m_a, m_b;
+	float m_radius;
+};
+
+// any shape, through its distance field, drawn as mesh if one is given.
+// Neither is copied; both must outlive the obstacle.
+class FieldObstacle:public Obstacle
+{
+public:
+	FieldObstacle(const DistanceField *field, const TriangleMesh *mesh = 0):m_field(field), m_mesh(mesh){}
+
+	void evaluate(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz) const;
+	void draw() const;
+	ObstacleRecord record() const;
+
+private:
+	const DistanceField *m_field;
+	const TriangleMesh *m_mesh;
+};
+
+#endif
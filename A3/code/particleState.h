@@ -0,0 +1,101 @@
+#ifndef PARTICLESTATE_H
+#define PARTICLESTATE_H
+
+#include <vector>
+#include <vecmath.h>
+
+using namespace std;
+
+// Structure-of-arrays state of a particle system. The six components
+// (x, y, z, vx, vy, vz) are stored as contiguous float arrays back to back,
+// so force passes walk memory linearly and a stepper can treat the whole
+// state as a single vector of length().
+//
+// A derivative f(X,t) uses the same layout: dx/dt lives in the position
+// arrays and dv/dt in the velocity arrays.
+class ParticleState
+{
+public:
+
+	ParticleState(int numParticles=0) { resize(numParticles); }
+
+	void resize(int numParticles)
+	{
+		m_numParticles = numParticles;
+		m_data.resize(6 * numParticles);
+	}
+
+	int size() const { return m_numParticles; }
+
+	// all components as one flat array
+	int length() const { return 6 * m_numParticles; }
+	float *data() { return m_data.empty() ? 0 : &m_data[0]; }
+	const float *data() const { return m_data.empty() ? 0 : &m_data[0]; }
+
+	// contiguous arrays of one position / velocity component
+	float *pos(int axis) { return data() + axis * m_numParticles; }
+	float *vel(int axis) { return data() + (3 + axis) * m_numParticles; }
+	const float *pos(int axis) const { return data() + axis * m_numParticles; }
+	const float *vel(int axis) const { return data() + (3 + axis) * m_numParticles; }
+
+	Vector3f position(int i) const { return Vector3f(pos(0)[i], pos(1)[i], pos(2)[i]); }
+	Vector3f velocity(int i) const { return Vector3f(vel(0)[i], vel(1)[i], vel(2)[i]); }
+
+	void setPosition(int i, const Vector3f &p)
+	{
+		pos(0)[i] = p[0];
+		pos(1)[i] = p[1];
+		pos(2)[i] = p[2];
+	}
+
+	void setVelocity(int i, const Vector3f &v)
+	{
+		vel(0)[i] = v[0];
+		vel(1)[i] = v[1];
+		vel(2)[i] = v[2];
+	}
+
+	void addVelocity(int i, const Vector3f &v)
+	{
+		vel(0)[i] += v[0];
+		vel(1)[i] += v[1];
+		vel(2)[i] += v[2];
+	}
+
+	// exchanges storage with another state of any size, without copying
+	void swap(ParticleState &other)
+	{
+		int n = m_numParticles;
+		m_numParticles = other.m_numParticles;
+		other.m_numParticles = n;
+		m_data.swap(other.m_data);
+	}
+
+	// adapters for the interleaved layout [x0, v0, x1, v1, ...]
+	void toVector(vector<Vector3f> &state) const
+	{
+		state.resize(2 * m_numParticles);
+		for (int i = 0; i < m_numParticles; i++)
+		{
+			state[2*i] = position(i);
+			state[2*i + 1] = velocity(i);
+		}
+	}
+
+	void fromVector(const vector<Vector3f> &state)
+	{
+		resize(state.size() / 2);
+		for (int i = 0; i < m_numParticles; i++)
+		{
+			setPosition(i, state[2*i]);
+			setVelocity(i, state[2*i + 1]);
+		}
+	}
+
+private:
+
+	int m_numParticles;
+	vector<float> m_data;
+};
+
+#endif
@@ -1,3 +1,1092 @@
 #include "particleSystem.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "philox.h"
+
+namespace
+{
+	// particles an obstacle evaluates per call: enough to amortize the
+	// virtual call, few enough for the results to stay in L1
+	const int obstacleBlock = 256;
+
+	// conservative advancement stops this close to a surface, and gives up
+	// (leaving the particle to the discrete test) after this many rounds
+	const float sweepTolerance = 1e-3f;
+	const int maxSweepRounds = 12;
+
+	// particles sleep in blocks of sleepBlock consecutive indices, after
+	// moving slower than sleepSpeed for sleepSteps steps. A particle faster
+	// than wakeSpeed wakes the blocks it touches; one tied to a sleeping
+	// block by a spring wakes it if it moves faster than sleepSpeed, or if
+	// such a spring's strain rises sleepStrain above what it was when the
+	// block fell asleep.
+	const int sleepBlock = 64;
+	const int sleepSteps = 25;
+	const float sleepSpeed = 0.05f;
+	const float wakeSpeed = 0.5f;
+	const float sleepStrain = 0.001f;
+
+	// the entry equal to from in values[begin, end), replaced by to
+	inline void replaceEntry(vector<int> &values, int begin, int end, int from, int to)
+	{
+		for (int e = begin; e < end; e++)
+			if (values[e] == from)
+			{
+				values[e] = to;
+				return;
+			}
+	}
+
+	// removes the component of (x, y, z) along -n, if it has one
+	inline void removeInward(float &x, float &y, float &z, float nx, float ny, float nz)
+	{
+		float d = x * nx + y * ny + z * nz;
+		if (d < 0)
+		{
+			x -= d * nx;
+			y -= d * ny;
+			z -= d * nz;
+		}
+	}
+
+	// colors tracked by color_springs; beyond that springs share an overflow
+	// color that is evaluated serially
+	const int maxSpringColors = 32;
+
+	// spring forces of one color; its springs share no particle, so chunks
+	// of them can scatter concurrently
+	class SpringColorTask:public ParallelTask
+	{
+	public:
+		const Spring *springs;
+		const int *order;
+		const char *asleep;	// skips springs between sleeping particles, if set
+		const float *x, *y, *z;
+		float *dvx, *dvy, *dvz;
+		float mass;
+
+		void run(int begin, int end)
+		{
+			for (int n = begin; n < end; n++)
+			{
+				const Spring &spring = springs[order[n]];
+				int i = spring.i, j = spring.j;
+				if (asleep && asleep[i] && asleep[j])
+					continue;
+
+				float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+				float d = sqrtf(dx*dx + dy*dy + dz*dz);
+				float k = -spring.stiff * (d - spring.len);
+				float Fx = k * dx / d / mass, Fy = k * dy / d / mass, Fz = k * dz / d / mass;
+
+				dvx[i] += Fx; dvy[i] += Fy; dvz[i] += Fz;
+				dvx[j] -= Fx; dvy[j] -= Fy; dvz[j] -= Fz;
+			}
+		}
+	};
+
+	// spring forces gathered for a range of adjacency rows
+	class SpringGatherTask:public ParallelTask
+	{
+	public:
+		const SpringAdjacency *adjacency;
+		const ParticleState *state;
+		ParticleState *f;
+		const char *asleep;
+		float mass;
+
+		void run(int begin, int end)
+		{
+			adjacency->gatherForces(*state, *f, mass, begin, end, asleep);
+		}
+	};
+
+	// sums the repulsion on one particle from its neighbors in the hash
+	class Repulsion
+	{
+	public:
+		float radius, stiffness;
+		float Fx, Fy, Fz;
+
+		void operator()(int j, float dx, float dy, float dz, float d2)
+		{
+			float d = sqrtf(d2);
+			if (d <= 0)
+				return;
+			float k = stiffness * (radius - d) / d;
+			Fx += k * dx;
+			Fy += k * dy;
+			Fz += k * dz;
+		}
+	};
+
+	// wind on a range of particles, see apply_wind_forces
+	class WindTask:public ParallelTask
+	{
+	public:
+		const WindField *field;
+		Philox random;
+		unsigned int step;
+		double time;
+		const float *x, *y, *z;
+		float *dvx, *dvy, *dvz;
+		float gust[3];
+		float strength;	// per unit of mass
+
+		void run(int begin, int end)
+		{
+			field->add(x + begin, y + begin, z + begin, end - begin, time, 0.5f * strength,
+			           dvx + begin, dvy + begin, dvz + begin);
+			for (int i = begin; i < end; i++)
+			{
+				unsigned int r[4];
+				random.generate(step, i, 0, 0, r);
+				dvx[i] += strength * (gust[0] + 0.1f * Philox::centered(r[0]));
+				dvy[i] += strength * (gust[1] + 0.1f * Philox::centered(r[1]));
+				dvz[i] += strength * (gust[2] + 0.1f * Philox::centered(r[2]));
+			}
+		}
+	};
+
+	class SelfCollisionTask:public ParallelTask
+	{
+	public:
+		const SpatialHash *grid;
+		const char *asleep;
+		float *dvx, *dvy, *dvz;
+		float radius, stiffness, mass;
+
+		void run(int begin, int end)
+		{
+			Repulsion repulsion;
+			repulsion.radius = radius;
+			repulsion.stiffness = stiffness;
+
+			for (int i = begin; i < end; i++)
+			{
+				if (asleep && asleep[i])
+					continue;
+				repulsion.Fx = repulsion.Fy = repulsion.Fz = 0;
+				grid->forNeighbors(i, radius, repulsion);
+				dvx[i] += repulsion.Fx / mass;
+				dvy[i] += repulsion.Fy / mass;
+				dvz[i] += repulsion.Fz / mass;
+			}
+		}
+	};
+}
+
 ParticleSystem::ParticleSystem(int nParticles):m_numParticles(nParticles){
+	for (int axis = 0; axis < 3; axis++) {
+		swing[axis] = false;
+		swing_forwad[axis] = true;
+	}
+	swing_length = 0;
+	wind_exist = false;
+	m_windStep = 0;
+	m_windTime = 0;
+	m_revision = 0;
+	tear_strain = 0;
+	sleeping_enabled = false;
+	m_sleepingCount = 0;
+	m_activeSpringsValid = false;
+
+	mass = 1;
+	drag_coefficient = 0;
+
+	m_state.resize(nParticles);
+
+	m_pool = &ThreadPool::global();
+	spring_evaluation = SPRINGS_SCATTER;
+
+	m_sweptHits = m_pushedOut = 0;
+	m_changedBegin = m_changedEnd = 0;
+	pthread_mutex_init(&m_topologyMutex, 0);
+}
+
+const float ParticleSystem::defaultTearStrain = 0.6f;
+
+ParticleSystem::~ParticleSystem()
+{
+	for (size_t o = 0; o < obstacles.size(); o++)
+		delete obstacles[o];
+	pthread_mutex_destroy(&m_topologyMutex);
+}
+
+// greedy coloring: every spring takes the lowest color neither endpoint has
+// used yet. Colors are tracked as one bit mask per particle; springs that
+// would need more than maxSpringColors (no grid cloth comes close) go to the
+// overflow color.
+void ParticleSystem::color_springs()
+{
+	const int maxColors = maxSpringColors;
+	vector<unsigned int> used(m_numParticles, 0);
+	vector<int> color(springs.size());
+	vector<int> count(maxColors + 1, 0);
+
+	for (size_t s = 0; s < springs.size(); s++)
+	{
+		unsigned int taken = used[springs[s].i] | used[springs[s].j];
+		int c = 0;
+		while (c < maxColors && (taken & (1u << c)))
+			c++;
+		if (c < maxColors)
+		{
+			used[springs[s].i] |= 1u << c;
+			used[springs[s].j] |= 1u << c;
+		}
+		color[s] = c;
+		count[c]++;
+	}
+
+	int numColors = maxColors + 1;
+	while (numColors > 0 && count[numColors - 1] == 0)
+		numColors--;
+
+	// counting sort of the spring indices by color
+	m_colorStart.assign(numColors + 1, 0);
+	for (int c = 0; c < numColors; c++)
+		m_colorStart[c + 1] = m_colorStart[c] + count[c];
+
+	vector<int> next(m_colorStart.begin(), m_colorStart.end() - 1);
+	m_springOrder.resize(springs.size());
+	m_springSlot.resize(springs.size());
+	for (size_t s = 0; s < springs.size(); s++)
+	{
+		m_springSlot[s] = next[color[s]];
+		m_springOrder[next[color[s]]++] = (int)s;
+	}
+}
+
+// The hole spring s leaves in its color is filled by the color's last
+// spring, which moves the hole to the first place of the next color, and so
+// on until it reaches the end of the order.
+void ParticleSystem::uncolor_spring(int s)
+{
+	int hole = m_springSlot[s];
+	int numColors = (int)m_colorStart.size() - 1;
+	int c = (int)(upper_bound(m_colorStart.begin(), m_colorStart.end(), hole) - m_colorStart.begin()) - 1;
+
+	for (; c < numColors; c++)
+	{
+		int last = m_colorStart[c + 1] - 1;
+		if (last != hole)
+		{
+			m_springOrder[hole] = m_springOrder[last];
+			m_springSlot[m_springOrder[hole]] = hole;
+			hole = last;
+		}
+		m_colorStart[c + 1]--;
+	}
+	m_springOrder.pop_back();
+}
+
+void ParticleSystem::index_triangles()
+{
+	int count = (int)triangles.size() / 3;
+	m_triangleIds.resize(count);
+	for (int t = 0; t < count; t++)
+		m_triangleIds[t] = t;
+
+	m_vertexTriangleStart.assign(m_numParticles + 1, 0);
+	for (size_t k = 0; k < triangles.size(); k++)
+		m_vertexTriangleStart[triangles[k] + 1]++;
+	for (int i = 0; i < m_numParticles; i++)
+		m_vertexTriangleStart[i + 1] += m_vertexTriangleStart[i];
+
+	m_vertexTriangleEnd.assign(m_vertexTriangleStart.begin(), m_vertexTriangleStart.end() - 1);
+	m_vertexTriangles.resize(triangles.size());
+	for (size_t k = 0; k < triangles.size(); k++)
+		m_vertexTriangles[m_vertexTriangleEnd[triangles[k]]++] = (int)k / 3;
+}
+
+void ParticleSystem::remove_triangle(int t)
+{
+	int last = (int)triangles.size() / 3 - 1;
+	m_tornTriangles.push_back(m_triangleIds[t]);
+
+	for (int k = 0; k < 3; k++)
+	{
+		int i = triangles[3*t + k];
+		int end = --m_vertexTriangleEnd[i];
+		replaceEntry(m_vertexTriangles, m_vertexTriangleStart[i], end + 1, t, m_vertexTriangles[end]);
+	}
+
+	if (last != t)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int i = triangles[3*last + k];
+			replaceEntry(m_vertexTriangles, m_vertexTriangleStart[i], m_vertexTriangleEnd[i], last, t);
+			triangles[3*t + k] = i;
+		}
+		m_triangleIds[t] = m_triangleIds[last];
+	}
+	triangles.resize(3 * last);
+	m_triangleIds.pop_back();
+
+	m_changedBegin = min(m_changedBegin, 3 * t);
+	m_changedEnd = max(m_changedEnd, 3 * t + 3);
+}
+
+void ParticleSystem::remove_spring(int s)
+{
+	int i = springs[s].i, j = springs[s].j;
+	int last = (int)springs.size() - 1;
+	m_tornSprings.push_back(springs[s]);
+	m_activeSpringsValid = false;
+
+	if (m_adjacency.matches(springs.size(), m_numParticles))
+		m_adjacency.remove(s, springs);
+
+	bool colored = m_springOrder.size() == springs.size();
+	if (colored)
+		uncolor_spring(s);
+
+	// the triangles with edge (i, j); removing one swaps another into place
+	if (!triangles.empty())
+	{
+		if ((int)m_triangleIds.size() * 3 != (int)triangles.size())
+			index_triangles();
+		for (int e = m_vertexTriangleStart[i]; e < m_vertexTriangleEnd[i]; )
+		{
+			const int *tri = &triangles[3 * m_vertexTriangles[e]];
+			if (tri[0] == j || tri[1] == j || tri[2] == j)
+				remove_triangle(m_vertexTriangles[e]);
+			else
+				e++;
+		}
+	}
+
+	if (last != s)
+	{
+		springs[s] = springs[last];
+		if (colored)
+		{
+			m_springSlot[s] = m_springSlot[last];
+			m_springOrder[m_springSlot[s]] = s;
+		}
+	}
+	springs.pop_back();
+	if (colored)
+		m_springSlot.pop_back();
+}
+
+// springs go from the back, so the ones still to go keep their indices
+int ParticleSystem::tear_springs(float maxStrain)
+{
+	const float *x = m_state.pos(0), *y = m_state.pos(1), *z = m_state.pos(2);
+	float limit = (1 + maxStrain) * (1 + maxStrain);
+
+	m_tearing.clear();
+	for (size_t s = 0; s < springs.size(); s++)
+	{
+		const Spring &spring = springs[s];
+		int i = spring.i, j = spring.j;
+		float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+		if (dx*dx + dy*dy + dz*dz > limit * spring.len * spring.len)
+			m_tearing.push_back((int)s);
+	}
+
+	if (m_tearing.empty())
+		return 0;
+
+	lockTopology();
+	for (int k = (int)m_tearing.size() - 1; k >= 0; k--)
+		remove_spring(m_tearing[k]);
+	unlockTopology();
+	return (int)m_tearing.size();
+}
+
+bool ParticleSystem::isIndependentColor(int c) const
+{
+	return c < maxSpringColors;
+}
+
+void ParticleSystem::apply_spring_forces_parallel(const ParticleState &state, ParticleState &f, float mass)
+{
+	SpringColorTask task;
+	task.springs = &springs[0];
+	task.order = &m_springOrder[0];
+	task.asleep = m_sleepingCount > 0 ? &m_asleep[0] : 0;
+	task.x = state.pos(0); task.y = state.pos(1); task.z = state.pos(2);
+	task.dvx = f.vel(0); task.dvy = f.vel(1); task.dvz = f.vel(2);
+	task.mass = mass;
+
+	int numColors = (int)m_colorStart.size() - 1;
+	for (int c = 0; c < numColors; c++)
+	{
+		int begin = m_colorStart[c], end = m_colorStart[c + 1];
+		// the overflow color may have conflicts
+		if (c == maxSpringColors)
+			task.run(begin, end);
+		else
+			m_pool->parallelFor(begin, end, task, 2048);
+	}
+}
+
+void ParticleSystem::interpolateDisplay(const float *previous, const float *current, float alpha)
+{
+	int n = m_numParticles;
+	m_display.resize(n);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float *x0 = previous + axis * n;
+		const float *x1 = current + axis * n;
+		for (int i = 0; i < n; i++)
+			m_display[i][axis] = x0[i] + alpha * (x1[i] - x0[i]);
+	}
+}
+
+const SpringAdjacency &ParticleSystem::getSpringAdjacency()
+{
+	if (!m_adjacency.matches(springs.size(), m_numParticles))
+		m_adjacency.build(springs, m_state);
+	return m_adjacency;
+}
+
+void ParticleSystem::apply_spring_forces_gather(const ParticleState &state, ParticleState &f, float mass)
+{
+	SpringGatherTask task;
+	task.adjacency = &getSpringAdjacency();
+	task.state = &state;
+	task.f = &f;
+	task.asleep = m_sleepingCount > 0 ? &m_asleep[0] : 0;
+	task.mass = mass;
+
+	m_pool->parallelFor(0, m_adjacency.numRows(), task, 1024);
+}
+
+void ParticleSystem::apply_self_collision_forces(const ParticleState &state, ParticleState &f, float radius, float stiffness, float mass)
+{
+	m_spatialHash.build(state, radius, *m_pool);
+
+	SelfCollisionTask task;
+	task.grid = &m_spatialHash;
+	task.asleep = m_sleepingCount > 0 ? &m_asleep[0] : 0;
+	task.dvx = f.vel(0); task.dvy = f.vel(1); task.dvz = f.vel(2);
+	task.radius = radius;
+	task.stiffness = stiffness;
+	task.mass = mass;
+
+	m_pool->parallelFor(0, m_numParticles, task, 1024);
+}
+
+vector<Vector3f> ParticleSystem::evalF(vector<Vector3f> state)
+{
+	ParticleState x, dx;
+	x.fromVector(state);
+	evalF(x, dx);
+
+	vector<Vector3f> f;
+	dx.toVector(f);
+	return f;
+}
+
+void ParticleSystem::apply_wind_forces(const ParticleState &state, ParticleState &f, double wind, float mass)
+{
+	if (!wind_exist)
+		return;
+
+	WindTask task;
+	task.field = &m_windField;
+	task.step = m_windStep;
+	task.time = m_windTime;
+	task.x = state.pos(0); task.y = state.pos(1); task.z = state.pos(2);
+	task.dvx = f.vel(0); task.dvy = f.vel(1); task.dvz = f.vel(2);
+	task.strength = (float)(wind / mass);
+
+	// the gust is the stream's particle -1
+	unsigned int r[4];
+	task.random.generate(m_windStep, 0xffffffffu, 0, 0, r);
+	task.gust[0] = Philox::centered(r[0]);
+	task.gust[1] = 0;
+	task.gust[2] = Philox::centered(r[1]);
+
+	m_pool->parallelFor(0, m_numParticles, task, 1024);
+}
+
+void ParticleSystem::apply_collision_forces(const ParticleState &state, ParticleState &f, float mass)
+{
+	m_obstacleScratch.resize(4 * obstacleBlock);
+	float *gap = &m_obstacleScratch[0];
+	float *nx = gap + obstacleBlock, *ny = nx + obstacleBlock, *nz = ny + obstacleBlock;
+	const float *x = state.pos(0), *y = state.pos(1), *z = state.pos(2);
+
+	for (size_t o = 0; o < obstacles.size(); o++)
+		for (int r = 0; r < num_awake_ranges(); r++)
+		{
+			int first, last;
+			awake_range(r, first, last);
+			for (int begin = first; begin < last; begin += obstacleBlock)
+			{
+				int count = min(obstacleBlock, last - begin);
+				obstacles[o]->evaluate(x + begin, y + begin, z + begin, count, gap, nx, ny, nz);
+
+				for (int k = 0; k < count; k++)
+					if (gap[k] < 0.1)
+					{
+						int i = begin + k;
+						apply_contact_force(f, i, state.velocity(i), -Vector3f(nx[k], ny[k], nz[k]), gap[k]);
+					}
+			}
+		}
+}
+
+void ParticleSystem::evaluate_obstacles(const float *x, const float *y, const float *z, int count,
+	float *gap, float *nx, float *ny, float *nz)
+{
+	obstacles[0]->evaluate(x, y, z, count, gap, nx, ny, nz);
+
+	m_obstacleScratch.resize(4 * obstacleBlock);
+	float *g = &m_obstacleScratch[0];
+	float *gx = g + obstacleBlock, *gy = gx + obstacleBlock, *gz = gy + obstacleBlock;
+
+	for (size_t o = 1; o < obstacles.size(); o++)
+		for (int begin = 0; begin < count; begin += obstacleBlock)
+		{
+			int block = min(obstacleBlock, count - begin);
+			obstacles[o]->evaluate(x + begin, y + begin, z + begin, block, g, gx, gy, gz);
+
+			for (int k = 0; k < block; k++)
+			{
+				int i = begin + k;
+				if (g[k] < gap[i])
+				{
+					gap[i] = g[k];
+					nx[i] = gx[k];
+					ny[i] = gy[k];
+					nz[i] = gz[k];
+				}
+			}
+		}
+}
+
+bool ParticleSystem::nearest_obstacles(const ParticleState &state, vector<float> &gap, vector<float> &normal)
+{
+	if (obstacles.empty())
+		return false;
+
+	int n = m_numParticles;
+	gap.resize(n);
+	normal.resize(3 * n);
+	if (n > 0)
+		evaluate_obstacles(state.pos(0), state.pos(1), state.pos(2), n, &gap[0], &normal[0], &normal[n], &normal[2*n]);
+	return true;
+}
+
+void ParticleSystem::begin_continuous_collisions()
+{
+	m_stepStart.assign(m_state.pos(0), m_state.pos(0) + 3 * m_numParticles);
+}
+
+void ParticleSystem::apply_continuous_collisions()
+{
+	int n = m_numParticles;
+	m_sweptHits = m_pushedOut = 0;
+	if (obstacles.empty() || n == 0 || (int)m_stepStart.size() != 3 * n)
+		return;
+
+	const float *x0 = &m_stepStart[0], *y0 = x0 + n, *z0 = y0 + n;
+	float *x = m_state.pos(0), *y = m_state.pos(1), *z = m_state.pos(2);
+	float *vx = m_state.vel(0), *vy = m_state.vel(1), *vz = m_state.vel(2);
+
+	// every awake particle starts at the beginning of its path, except the
+	// fixed ones, which are not swept at all
+	m_sweepTime.assign(n, 1);
+	for (int r = 0; r < num_awake_ranges(); r++)
+	{
+		int begin, end;
+		awake_range(r, begin, end);
+		for (int i = begin; i < end; i++)
+			m_sweepTime[i] = 0;
+	}
+	for (size_t ind = 0; ind < fixed_particles.size(); ind++)
+		m_sweepTime[fixed_particles[ind]] = 1;
+	m_sweepParticles.clear();
+	for (int i = 0; i < n; i++)
+		if (m_sweepTime[i] < 1)
+			m_sweepParticles.push_back(i);
+
+	for (int round = 0; round < maxSweepRounds && !m_sweepParticles.empty(); round++)
+	{
+		int m = (int)m_sweepParticles.size();
+		m_sweepBuffer.resize(7 * m);
+		float *px = &m_sweepBuffer[0], *py = px + m, *pz = py + m;
+		float *gap = pz + m, *nx = gap + m, *ny = nx + m, *nz = ny + m;
+
+		for (int k = 0; k < m; k++)
+		{
+			int i = m_sweepParticles[k];
+			float t = m_sweepTime[i];
+			px[k] = x0[i] + t * (x[i] - x0[i]);
+			py[k] = y0[i] + t * (y[i] - y0[i]);
+			pz[k] = z0[i] + t * (z[i] - z0[i]);
+		}
+		evaluate_obstacles(px, py, pz, m, gap, nx, ny, nz);
+
+		// a particle can move gap along its path without reaching any
+		// surface; the ones that cannot move on have reached one
+		int kept = 0;
+		for (int k = 0; k < m; k++)
+		{
+			int i = m_sweepParticles[k];
+			float dx = x[i] - x0[i], dy = y[i] - y0[i], dz = z[i] - z0[i];
+			float length = sqrtf(dx*dx + dy*dy + dz*dz);
+
+			if (gap[k] < sweepTolerance)
+			{
+				// the rest of the path, kept out of the tangent plane
+				float rx = x[i] - px[k], ry = y[i] - py[k], rz = z[i] - pz[k];
+				removeInward(rx, ry, rz, nx[k], ny[k], nz[k]);
+				x[i] = px[k] + rx;
+				y[i] = py[k] + ry;
+				z[i] = pz[k] + rz;
+				removeInward(vx[i], vy[i], vz[i], nx[k], ny[k], nz[k]);
+				m_sweptHits++;
+				continue;
+			}
+
+			float t = length > 0 ? m_sweepTime[i] + gap[k] / length : 1;
+			m_sweepTime[i] = t;
+			if (t < 1)
+				m_sweepParticles[kept++] = i;
+		}
+		m_sweepParticles.resize(kept);
+	}
+
+	// what the sweep missed (paths it gave up on, concave surfaces bending
+	// back over the tangent plane) is caught where the particles ended up
+	m_sweepBuffer.assign(4 * n, 0);
+	float *gap = &m_sweepBuffer[0], *nx = gap + n, *ny = nx + n, *nz = ny + n;
+	for (int r = 0; r < num_awake_ranges(); r++)
+	{
+		int begin, end;
+		awake_range(r, begin, end);
+		evaluate_obstacles(x + begin, y + begin, z + begin, end - begin, gap + begin, nx + begin, ny + begin, nz + begin);
+	}
+	for (size_t ind = 0; ind < fixed_particles.size(); ind++)
+		gap[fixed_particles[ind]] = 0;
+
+	for (int i = 0; i < n; i++)
+		if (gap[i] < 0)
+		{
+			x[i] -= gap[i] * nx[i];
+			y[i] -= gap[i] * ny[i];
+			z[i] -= gap[i] * nz[i];
+			removeInward(vx[i], vy[i], vz[i], nx[i], ny[i], nz[i]);
+			m_pushedOut++;
+		}
+}
+
+const vector<int> *ParticleSystem::getActiveSprings()
+{
+	if (m_sleepingCount == 0)
+		return 0;
+	if (!m_activeSpringsValid)
+	{
+		m_activeSprings.clear();
+		for (size_t s = 0; s < springs.size(); s++)
+			if (!m_asleep[springs[s].i] || !m_asleep[springs[s].j])
+				m_activeSprings.push_back((int)s);
+		m_activeSpringsValid = true;
+	}
+	return &m_activeSprings;
+}
+
+void ParticleSystem::mask_sleeping(ParticleState &f) const
+{
+	if (m_sleepingCount == 0)
+		return;
+
+	for (size_t b = 0; b < m_blockAsleep.size(); b++)
+		if (m_blockAsleep[b])
+		{
+			int begin = (int)b * sleepBlock, end = min(begin + sleepBlock, m_numParticles);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				fill(f.pos(axis) + begin, f.pos(axis) + end, 0.0f);
+				fill(f.vel(axis) + begin, f.vel(axis) + end, 0.0f);
+			}
+		}
+}
+
+void ParticleSystem::wake_all()
+{
+	if (m_sleepingCount == 0)
+		return;
+	m_wakeBlock.assign(m_blockAsleep.size(), 1);
+	m_stillSteps.assign(m_blockAsleep.size(), 0);
+	change_sleeping();
+}
+
+namespace
+{
+	// marks the blocks of sleeping particles a fast one comes close to
+	class Waker
+	{
+	public:
+		const char *asleep;
+		char *wake;
+
+		void operator()(int j, float dx, float dy, float dz, float d2)
+		{
+			if (asleep[j])
+				wake[j / sleepBlock] = 1;
+		}
+	};
+}
+
+void ParticleSystem::update_sleeping(float stepSize, float contactRadius)
+{
+	int n = m_numParticles;
+	int blocks = (n + sleepBlock - 1) / sleepBlock;
+	if ((int)m_asleep.size() != n)
+	{
+		m_asleep.assign(n, 0);
+		m_blockAsleep.assign(blocks, 0);
+		m_stillSteps.assign(blocks, 0);
+		m_sleepingCount = 0;
+	}
+	if ((int)m_blockStrain.size() != blocks)
+		m_blockStrain.assign(blocks, -1);
+	if (!sleeping_enabled || wind_exist || (int)m_stepStart.size() != 3 * n)
+	{
+		wake_all();
+		return;
+	}
+
+	const float *x0 = &m_stepStart[0], *y0 = x0 + n, *z0 = y0 + n;
+	const float *x = m_state.pos(0), *y = m_state.pos(1), *z = m_state.pos(2);
+	const float *vx = m_state.vel(0), *vy = m_state.vel(1), *vz = m_state.vel(2);
+	float still = sleepSpeed * stepSize, fast = wakeSpeed * stepSize;
+
+	// sleeping blocks wake if anything moved them; awake ones count the
+	// steps they kept still and note their fast particles
+	m_wakeBlock.assign(blocks, 0);
+	m_fastParticles.clear();
+	for (int b = 0; b < blocks; b++)
+	{
+		int begin = b * sleepBlock, end = min(begin + sleepBlock, n);
+		if (m_blockAsleep[b])
+		{
+			for (int i = begin; i < end; i++)
+				if (x[i] != x0[i] || y[i] != y0[i] || z[i] != z0[i] || vx[i] != 0 || vy[i] != 0 || vz[i] != 0)
+				{
+					m_wakeBlock[b] = 1;
+					break;
+				}
+			continue;
+		}
+
+		float most = 0;
+		for (int i = begin; i < end; i++)
+		{
+			float dx = x[i] - x0[i], dy = y[i] - y0[i], dz = z[i] - z0[i];
+			float d2 = dx*dx + dy*dy + dz*dz;
+			most = max(most, d2);
+			if (d2 > fast * fast)
+				m_fastParticles.push_back(i);
+		}
+		m_stillSteps[b] = most < still * still ? m_stillSteps[b] + 1 : 0;
+	}
+
+	// sleeping blocks wake when a particle tied to them moves or pulls
+	// harder, and fast particles wake the ones they touch
+	if (m_sleepingCount > 0)
+	{
+		m_crossingStrain.assign(blocks, 0);
+		const vector<int> &active = *getActiveSprings();
+		for (size_t k = 0; k < active.size(); k++)
+		{
+			const Spring &spring = springs[active[k]];
+			int i = spring.i, j = spring.j;
+			if (m_asleep[i] == m_asleep[j])
+				continue;
+			int awake = m_asleep[i] ? j : i, b = (m_asleep[i] ? i : j) / sleepBlock;
+			float dx = x[awake] - x0[awake], dy = y[awake] - y0[awake], dz = z[awake] - z0[awake];
+			if (dx*dx + dy*dy + dz*dz > still * still)
+				m_wakeBlock[b] = 1;
+
+			float lx = x[i] - x[j], ly = y[i] - y[j], lz = z[i] - z[j];
+			float strain = fabsf(sqrtf(lx*lx + ly*ly + lz*lz) - spring.len) / spring.len;
+			m_crossingStrain[b] = max(m_crossingStrain[b], strain);
+		}
+
+		// a block that just fell asleep takes the strain it has now
+		for (int b = 0; b < blocks; b++)
+			if (m_blockAsleep[b])
+			{
+				if (m_blockStrain[b] < 0)
+					m_blockStrain[b] = m_crossingStrain[b];
+				else if (m_crossingStrain[b] > m_blockStrain[b] + sleepStrain)
+					m_wakeBlock[b] = 1;
+			}
+
+		if (!m_fastParticles.empty() && contactRadius > 0)
+		{
+			Waker waker;
+			waker.asleep = &m_asleep[0];
+			waker.wake = &m_wakeBlock[0];
+			for (size_t k = 0; k < m_fastParticles.size(); k++)
+				m_spatialHash.forNeighbors(m_fastParticles[k], contactRadius, waker);
+		}
+	}
+
+	change_sleeping();
+}
+
+void ParticleSystem::change_sleeping()
+{
+	int n = m_numParticles;
+	int blocks = (int)m_blockAsleep.size();
+	float *vx = m_state.vel(0), *vy = m_state.vel(1), *vz = m_state.vel(2);
+	bool changed = false;
+
+	for (int b = 0; b < blocks; b++)
+	{
+		int begin = b * sleepBlock, end = min(begin + sleepBlock, n);
+		if (m_blockAsleep[b] && m_wakeBlock[b])
+		{
+			m_blockAsleep[b] = 0;
+			m_stillSteps[b] = 0;
+			fill(m_asleep.begin() + begin, m_asleep.begin() + end, 0);
+			m_sleepingCount -= end - begin;
+			changed = true;
+		}
+		else if (!m_blockAsleep[b] && sleeping_enabled && !wind_exist && m_stillSteps[b] >= sleepSteps)
+		{
+			m_blockAsleep[b] = 1;
+			m_blockStrain[b] = -1;
+			fill(m_asleep.begin() + begin, m_asleep.begin() + end, 1);
+			fill(vx + begin, vx + end, 0.0f);
+			fill(vy + begin, vy + end, 0.0f);
+			fill(vz + begin, vz + end, 0.0f);
+			m_sleepingCount += end - begin;
+			changed = true;
+		}
+	}
+	if (changed)
+	{
+		find_awake_ranges();
+		invalidate_derivative();
+	}
+}
+
+// consecutive awake blocks make one range
+void ParticleSystem::find_awake_ranges()
+{
+	int n = m_numParticles;
+	int blocks = (int)m_blockAsleep.size();
+	m_awakeRanges.clear();
+	for (int b = 0; b < blocks; b++)
+		if (!m_blockAsleep[b])
+		{
+			int begin = b * sleepBlock, end = min(begin + sleepBlock, n);
+			if (!m_awakeRanges.empty() && m_awakeRanges.back() == begin)
+				m_awakeRanges.back() = end;
+			else
+			{
+				m_awakeRanges.push_back(begin);
+				m_awakeRanges.push_back(end);
+			}
+		}
+	m_activeSpringsValid = false;
+}
+
+namespace
+{
+	// the scalar settings of a ParticleSystem, as one checkpoint section
+	struct Settings
+	{
+		int numParticles;
+		float mass, dragCoefficient;
+		float swingLength, tearStrain;
+		char swing[3], swingForward[3];
+		char wind, sleeping;
+		unsigned int windStep;
+		double windTime;
+	};
+
+	bool indicesBelow(const vector<int> &indices, int n)
+	{
+		for (size_t k = 0; k < indices.size(); k++)
+			if (indices[k] < 0 || indices[k] >= n)
+				return false;
+		return true;
+	}
+}
+
+void ParticleSystem::save(CheckpointWriter &out) const
+{
+	Settings settings;
+	memset(&settings, 0, sizeof(settings));
+	settings.numParticles = m_numParticles;
+	settings.mass = mass;
+	settings.dragCoefficient = drag_coefficient;
+	settings.swingLength = swing_length;
+	settings.tearStrain = tear_strain;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		settings.swing[axis] = swing[axis];
+		settings.swingForward[axis] = swing_forwad[axis];
+	}
+	settings.wind = wind_exist;
+	settings.windStep = m_windStep;
+	settings.windTime = m_windTime;
+	settings.sleeping = sleeping_enabled;
+
+	out.putValue("settings", settings);
+	out.put("state", m_state.data(), m_state.length() * sizeof(float));
+	out.putVector("springs", springs);
+	out.putVector("fixed", fixed_particles);
+	out.putVector("triangles", triangles);
+	out.putVector("springOrder", m_springOrder);
+	out.putVector("colorStart", m_colorStart);
+	out.putVector("springSlot", m_springSlot);
+	out.putVector("tornSprings", m_tornSprings);
+	out.putVector("tornTriangles", m_tornTriangles);
+	out.putVector("triangleIds", m_triangleIds);
+	out.putVector("sleepBlocks", m_blockAsleep);
+	out.putVector("stillSteps", m_stillSteps);
+	out.putVector("sleepStrain", m_blockStrain);
+
+	vector<ObstacleRecord> records(obstacles.size());
+	for (size_t o = 0; o < obstacles.size(); o++)
+		records[o] = obstacles[o]->record();
+	out.putVector("obstacles", records);
+}
+
+bool ParticleSystem::restore_obstacles(const CheckpointReader &in, const DistanceField *field,
+	const TriangleMesh *mesh)
+{
+	vector<ObstacleRecord> records;
+	if (!in.getVector("obstacles", records))
+		return false;
+
+	vector<Obstacle *> created;
+	for (size_t o = 0; o < records.size(); o++)
+	{
+		Obstacle *obstacle = Obstacle::create(records[o], field, mesh);
+		if (obstacle == 0)
+		{
+			for (size_t k = 0; k < created.size(); k++)
+				delete created[k];
+			return false;
+		}
+		created.push_back(obstacle);
+	}
+	obstacles.insert(obstacles.end(), created.begin(), created.end());
+	return true;
+}
+
+bool ParticleSystem::restore(const CheckpointReader &in)
+{
+	Settings settings;
+	vector<float> state;
+	vector<Spring> newSprings, tornSprings;
+	vector<int> fixed, newTriangles, order, colorStart, slot, tornTriangles, ids, stillSteps;
+	vector<char> blockAsleep;
+	vector<float> blockStrain;
+	if (!in.getValue("settings", settings) || !in.getVector("state", state) ||
+	    !in.getVector("springs", newSprings) || !in.getVector("fixed", fixed) ||
+	    !in.getVector("triangles", newTriangles) || !in.getVector("springOrder", order) ||
+	    !in.getVector("colorStart", colorStart) || !in.getVector("springSlot", slot) ||
+	    !in.getVector("tornSprings", tornSprings) || !in.getVector("tornTriangles", tornTriangles) ||
+	    !in.getVector("triangleIds", ids) || !in.getVector("sleepBlocks", blockAsleep) ||
+	    !in.getVector("stillSteps", stillSteps) || !in.getVector("sleepStrain", blockStrain))
+		return false;
+
+	int n = settings.numParticles;
+	if (n < 0 || state.size() != 6 * (size_t)n || newTriangles.size() % 3 != 0 ||
+	    !indicesBelow(fixed, n) || !indicesBelow(newTriangles, n))
+		return false;
+	for (size_t s = 0; s < newSprings.size(); s++)
+		if (newSprings[s].i < 0 || newSprings[s].i >= n || newSprings[s].j < 0 || newSprings[s].j >= n)
+			return false;
+
+	// colors are recomputed if they do not fit the springs
+	bool colored = order.size() == newSprings.size() && slot.size() == newSprings.size() &&
+		!colorStart.empty() && colorStart.back() == (int)order.size() &&
+		indicesBelow(order, (int)newSprings.size()) && indicesBelow(slot, (int)newSprings.size());
+
+	lockTopology();
+	m_numParticles = n;
+	m_state.resize(n);
+	if (n > 0)
+		memcpy(m_state.data(), &state[0], state.size() * sizeof(float));
+	springs.swap(newSprings);
+	fixed_particles.swap(fixed);
+	triangles.swap(newTriangles);
+	m_tornSprings.swap(tornSprings);
+	m_tornTriangles.swap(tornTriangles);
+
+	mass = settings.mass;
+	drag_coefficient = settings.dragCoefficient;
+	swing_length = settings.swingLength;
+	tear_strain = settings.tearStrain;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		swing[axis] = settings.swing[axis] != 0;
+		swing_forwad[axis] = settings.swingForward[axis] != 0;
+	}
+	wind_exist = settings.wind != 0;
+	m_windStep = settings.windStep;
+	m_windTime = settings.windTime;
+	sleeping_enabled = settings.sleeping != 0;
+
+	// the tearing index keeps the triangles' original numbers
+	m_vertexTriangleStart.clear();
+	m_vertexTriangleEnd.clear();
+	m_vertexTriangles.clear();
+	m_triangleIds.clear();
+	if (ids.size() * 3 == triangles.size() && !ids.empty())
+	{
+		index_triangles();
+		m_triangleIds.swap(ids);
+	}
+	m_changedBegin = 0;
+	m_changedEnd = (int)triangles.size();
+	unlockTopology();
+
+	if (colored)
+	{
+		m_springOrder.swap(order);
+		m_colorStart.swap(colorStart);
+		m_springSlot.swap(slot);
+	}
+	else
+		color_springs();
+
+	// the blocks asleep as they were, their velocities already zero; with
+	// none recorded, update_sleeping starts afresh
+	int blocks = (n + sleepBlock - 1) / sleepBlock;
+	m_asleep.clear();
+	m_sleepingCount = 0;
+	if ((int)blockAsleep.size() == blocks && (int)stillSteps.size() == blocks && (int)blockStrain.size() == blocks)
+	{
+		m_asleep.assign(n, 0);
+		m_blockAsleep.swap(blockAsleep);
+		m_stillSteps.swap(stillSteps);
+		m_blockStrain.swap(blockStrain);
+		for (int b = 0; b < blocks; b++)
+			if (m_blockAsleep[b])
+			{
+				int begin = b * sleepBlock, end = min(begin + sleepBlock, n);
+				fill(m_asleep.begin() + begin, m_asleep.begin() + end, 1);
+				m_sleepingCount += end - begin;
+			}
+		find_awake_ranges();
+	}
+
+	// everything derived from the old system is rebuilt on first use
+	m_display.clear();
+	m_adjacency = SpringAdjacency();
+	m_activeSpringsValid = false;
+	m_stepStart.clear();
+	invalidate_derivative();
+	return true;
 }
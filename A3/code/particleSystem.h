@@ -1,11 +1,19 @@
 #ifndef PARTICLESYSTEM_H
 #define PARTICLESYSTEM_H
 
+#include <cmath>
 #include <vector>
 #include <vecmath.h>
 #include <GL/glut.h>
 #include <ctime>
 #include "spring.h"
+#include "particleState.h"
+#include "threadPool.h"
+#include "springAdjacency.h"
+#include "spatialHash.h"
+#include "obstacle.h"
+#include "checkpoint.h"
+#include "windField.h"
 
 using namespace std;
 
@@ -14,39 +22,58 @@ inline int get_time()
 	return time(NULL);
 }
 
-class Sphere {
-public:
-	Sphere(Vector3f c, float r):center(c), radius(r){}
-
-	Vector3f center;
-	float radius;
-};
-
 class ParticleSystem
 {
 public:
 
 	ParticleSystem(int numParticles=0);
+	virtual ~ParticleSystem();
 
 	int m_numParticles;
 
-	// for a given state, evaluate derivative f(X,t)
-	virtual vector<Vector3f> evalF(vector<Vector3f> state) = 0;
+	// for a given interleaved state, evaluate derivative f(X,t)
+	// (allocating wrapper around the in-place evalF below)
+	virtual vector<Vector3f> evalF(vector<Vector3f> state);
 	
-	// getter method for the system's state
-	vector<Vector3f> getState(){ return m_vVecState; };
+	// getter method for the system's state, interleaved as [x0, v0, x1, v1, ...]
+	vector<Vector3f> getState(){ vector<Vector3f> state; m_state.toVector(state); return state; };
+
+	// copies the interleaved state into a caller-owned buffer (no allocation
+	// once the buffer has grown to the state size)
+	void getState(vector<Vector3f> &state) const { m_state.toVector(state); }
 	
-	// setter method for the system's state
-	void setState(const vector<Vector3f>  & newState) { m_vVecState = newState; };
+	// setter method for the system's state, interleaved as [x0, v0, x1, v1, ...]
+	void setState(const vector<Vector3f>  & newState) { m_state.fromVector(newState); };
 	
 	virtual void draw() = 0;
 
+	// for a given state, write the derivative f(X,t) into f.
+	// f is owned by the caller and only resized when its size is wrong, so a
+	// buffer reused across steps never touches the heap.
+	virtual void evalF(const ParticleState &state, ParticleState &f) = 0;
+
+	// the system's state itself; steppers read and update it in place
+	ParticleState &getParticleState() { return m_state; }
+
+	// sets the positions draw() shows to previous + alpha (current - previous),
+	// a blend of two position snapshots laid out like ParticleState's
+	// position arrays (x of every particle, then y, then z)
+	void interpolateDisplay(const float *previous, const float *current, float alpha);
+
+	// where draw() puts particle i: the interpolated display position once
+	// one has been set, otherwise the simulated one. Once set, draw() never
+	// reads m_state, so it can run while another thread steps the system.
+	Vector3f displayPosition(int i) const
+	{
+		return (int)m_display.size() == m_numParticles ? m_display[i] : m_state.position(i);
+	}
+
 	int mod(int i){ return (i + m_numParticles) % m_numParticles; }
 
 	void drawline(int i, int j)
 	{
-		Vector3f p_i = m_vVecState[2*i];//  position of particle i
-		Vector3f p_j = m_vVecState[2*j];//  position of particle j
+		Vector3f p_i = displayPosition(i);//  position of particle i
+		Vector3f p_j = displayPosition(j);//  position of particle j
 		glLineWidth(5.0f);
 		glBegin(GL_LINES);
 		glVertex3d(p_i[0], p_i[1], p_i[2]);
@@ -64,6 +91,7 @@ public:
 	void add_spring(int i, int j, float length, float stiffness)
 	{
 		springs.push_back(Spring(i, j, length, stiffness));
+		m_activeSpringsValid = false;
 	}
 
 	void add_fixed_particle(int i)
@@ -71,212 +99,464 @@ public:
 		fixed_particles.push_back(i);
 	}
 
-	void add_obstacle(Vector3f center, float radius)
+	// a surface triangle, for systems that have a surface
+	void add_triangle(int a, int b, int c)
 	{
-		obstacles.push_back(Sphere(center, radius));
+		triangles.push_back(a);
+		triangles.push_back(b);
+		triangles.push_back(c);
 	}
 
-	void init_f(vector<Vector3f> state, vector<Vector3f> &f)
+	// the system takes ownership of obstacle
+	void add_obstacle(Obstacle *obstacle)
 	{
-		for (int i = 0; i < m_numParticles; i++)
-		{
-			Vector3f v = state[2*i + 1];
-			f.push_back(v);
-
-			Vector3f a = Vector3f(0, 0, 0);
-			f.push_back(a);
-		}
+		obstacles.push_back(obstacle);
 	}
 
-	void apply_gravity_forces(vector<Vector3f> state, vector<Vector3f> &f)
+	void add_obstacle(Vector3f center, float radius)
 	{
-		Vector3f g = Vector3f(0, -9.8, 0);
-		
-		for (int i = 0; i < m_numParticles; i++)
-			f[2*i + 1] += g;
+		add_obstacle(new SphereObstacle(center, radius));
 	}
 
-
-	void apply_drag_forces(vector<Vector3f> state, vector<Vector3f> &f, float drag_coefficient, float mass)
+	// for every particle of state, the obstacle surface nearest to it: its
+	// signed distance (negative inside) into gap, and the outward normal
+	// there into normal, laid out like ParticleState's position arrays.
+	// False, with nothing written, if there are no obstacles.
+	bool nearest_obstacles(const ParticleState &state, vector<float> &gap, vector<float> &normal);
+
+	// Continuous collision handling against the obstacles, for systems that
+	// call these from beginStep and endStep. The positions at the start of
+	// the step are recorded, and afterwards every free particle's straight
+	// path over the step is swept against the obstacles by conservative
+	// advancement. A particle whose path reaches a surface is put back on
+	// the outer side of the tangent plane where it did, and one still
+	// inside an obstacle after that is pushed out to its surface. Either
+	// way the particle loses its velocity into the surface.
+	void begin_continuous_collisions();
+	void apply_continuous_collisions();
+
+	void draw_obstacles() const
 	{
-		for (int i = 0; i < m_numParticles; i++)
-		{
-			Vector3f v = state[2*i + 1];
-			f[2*i + 1] += -v * drag_coefficient / mass;
-		}
+		for (size_t o = 0; o < obstacles.size(); o++)
+			obstacles[o]->draw();
 	}
 
-	void apply_spring_forces(vector<Vector3f> state, vector<Vector3f> &f, float mass)
+	void init_f(const ParticleState &state, ParticleState &f)
 	{
-		for (size_t s = 0; s < springs.size(); s++)
+		f.resize(m_numParticles);
+
+		for (int axis = 0; axis < 3; axis++)
 		{
-			Spring spring = springs[s];
-			Vector3f p_i = state[2 * spring.i];
-			Vector3f p_j = state[2 * spring.j];
-			f[2*spring.i + 1] += spring.getForce(p_i, p_j) / mass;
-			f[2*spring.j + 1] += spring.getForce(p_j, p_i) / mass;
+			const float *v = state.vel(axis);
+			float *dx = f.pos(axis);
+			float *dv = f.vel(axis);
+
+			for (int i = 0; i < m_numParticles; i++)
+			{
+				dx[i] = v[i];
+				dv[i] = 0;
+			}
 		}
 	}
 
-	void apply_collision_forces(vector<Vector3f> state, vector<Vector3f> &f, float mass)
+	void apply_gravity_forces(const ParticleState &state, ParticleState &f)
 	{
-		for (size_t o = 0; o < obstacles.size(); o++)
-		{
-			Vector3f center = obstacles[o].center;
-			float radius = obstacles[o].radius;
-			
-			for (int i = 0; i < m_numParticles; i++)
-			{
-				Vector3f p_i = state[2*i];
-				Vector3f v_i = state[2*i + 1];
+		float g = -9.8;
+		float *dv = f.vel(1);
+		
+		for (int i = 0; i < m_numParticles; i++)
+			dv[i] += g;
+	}
 
-				float k = 160;		// spring model for collision response
-				float c_paral = 40;	// damping factor
-				float c_perp = 5;	// friction effect
 
-				if ((p_i - center).abs() < radius + 0.1)
-				{
-					float dist = max(((p_i - center).abs() - radius) / 1e-2, 1.0);
-					Vector3f d = center - p_i;
-					Vector3f n = d / d.abs();
-					Vector3f v_paral = Vector3f::dot(v_i, n) * n;
-					Vector3f v_perp = v_i - v_paral;
-					Vector3f F = -k/(dist)*n
-								 -c_paral*v_paral
-								 -c_perp*v_perp/v_perp.abs();
-					f[2*i + 1] += F;
-				}
+	void apply_drag_forces(const ParticleState &state, ParticleState &f, float drag_coefficient, float mass)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float *v = state.vel(axis);
+			float *dv = f.vel(axis);
 
-				// // 1
-				// if ((p_i - center + v_i*h).abs() < radius + 1e-2) // && Vector3f::dot(v_i, (p_i - center)) < 0)
-				// {
-				// 	f[2*i] = ((center + (p_i - center)/(p_i - center).abs() * (radius + 1e-1)) - p_i) / h;
-				// 	f[2*i + 1] -= ((center + (p_i - center)/(p_i - center).abs() * (1e-1)) - p_i) / h;
-
-				// 	// best so far
-				// 	f[2*i] += (p_i - center);
-				// 	f[2*i + 1] += (p_i - center);
-
-				// 	if (Vector3f::dot(f[2*i + 1], (p_i - center)) < 0) {
-				// 		f[2*i + 1] = Vector3f(0, 0, 0);
-				// 	}
-				// }
-				// // 2
-				// else if((p_i - center + 2*v_i*h).abs() < radius + 1e-2)
-				// {
-				// 	Vector3f b = p_i - center;
-				// 	Vector3f v_paral = Vector3f::dot(v_i, b) * b / b.absSquared();
-
-				// 	f[2*i + 1] = -v_paral / h;
-				// }
-			}
+			for (int i = 0; i < m_numParticles; i++)
+				dv[i] += -v[i] * drag_coefficient / mass;
 		}
 	}
 
-	void apply_self_collision_forces(vector<Vector3f> state, vector<Vector3f> &f, float scale, float mass)
+	// Splits springs into colors such that no two springs of a color share a
+	// particle, so each color can scatter its forces from several threads at
+	// once. Call after the last add_spring.
+	void color_springs();
+
+	// Tearing: every spring stretched beyond (1 + maxStrain) times its rest
+	// length is removed, and with it the triangles it is an edge of. Both
+	// are swap-removed, and the spring colors, the adjacency and the
+	// triangles' vertex lists are patched in place, so past the one scan for
+	// overstretched springs the cost is proportional to what tears. Returns
+	// the number of springs removed.
+	int tear_springs(float maxStrain);
+
+	// held while tearing changes the springs and triangles, and by drawing
+	// code that reads them from another thread
+	void lockTopology() { pthread_mutex_lock(&m_topologyMutex); }
+	void unlockTopology() { pthread_mutex_unlock(&m_topologyMutex); }
+
+	// removes spring s, moving the last spring into its place
+	void remove_spring(int s);
+
+	// everything torn so far, in order: the springs as they were, and the
+	// triangles by their index among the triangles before any tearing
+	const vector<Spring> &getTornSprings() const { return m_tornSprings; }
+	const vector<int> &getTornTriangles() const { return m_tornTriangles; }
+
+	// the entries [begin, end) of getTriangles() that changed since the
+	// last clearTriangleChanges, for renderers that keep them in an index
+	// buffer; begin >= end if none did. Entries past the end were dropped.
+	void getTriangleChanges(int &begin, int &end) const { begin = m_changedBegin; end = m_changedEnd; }
+	void clearTriangleChanges() { m_changedBegin = (int)triangles.size(); m_changedEnd = 0; }
+
+	// the forces of apply_spring_forces, one color at a time on m_pool
+	void apply_spring_forces_parallel(const ParticleState &state, ParticleState &f, float mass);
+
+	// the forces of apply_spring_forces, gathered per particle on m_pool
+	void apply_spring_forces_gather(const ParticleState &state, ParticleState &f, float mass);
+
+	void apply_spring_forces(const ParticleState &state, ParticleState &f, float mass)
 	{
-		int scale_rev = 5;
-		float scale2 = scale;
-		vector<int> grid[scale_rev][scale_rev][scale_rev];
+		if (spring_evaluation == SPRINGS_CONSTRAINED)
+			return;
 
-		for (int i = 0; i < m_numParticles; i++)
+		if (spring_evaluation == SPRINGS_GATHER)
 		{
-			Vector3f p_i = state[2*i];
+			apply_spring_forces_gather(state, f, mass);
+			return;
+		}
 
-			int x_ind = int(abs(p_i.x() / scale2)) % scale_rev;
-			int y_ind = int(abs(p_i.y() / scale2)) % scale_rev;
-			int z_ind = int(abs(p_i.z() / scale2)) % scale_rev;
+		// large systems go color by color across the thread pool
+		if (m_pool->size() > 1 && springs.size() >= 4096 && m_springOrder.size() == springs.size())
+		{
+			apply_spring_forces_parallel(state, f, mass);
+			return;
+		}
 
-			// printf("%d %d %d\n", x_ind, y_ind, z_ind);
+		const float *x = state.pos(0), *y = state.pos(1), *z = state.pos(2);
+		float *dvx = f.vel(0), *dvy = f.vel(1), *dvz = f.vel(2);
 
-			vector<int>* cell = &(grid[x_ind][y_ind][z_ind]);
-			
-			for (unsigned int ind = 0; ind < cell->size(); ind++)
-			{
-				int j = (*cell)[ind];
-				Vector3f p_j = state[2*j];
-
-				if ((p_i - p_j).abs() < scale * 1.5)
-				{
-					printf("collision detected! %ld\n", cell->size());
-					
-					float structural_length = 1 * scale;
-					float structural_stiffness = 1000 * scale;
-
-					Spring spring = Spring(i, j, structural_length, structural_stiffness);
-					f[2*i + 1] += spring.getForce(p_i, p_j) / mass;
-					f[2*j + 1] += spring.getForce(p_j, p_i) / mass;
-				}
+		const vector<int> *active = getActiveSprings();
+		size_t count = active ? active->size() : springs.size();
 
+		for (size_t ind = 0; ind < count; ind++)
+		{
+			const Spring &spring = springs[active ? (*active)[ind] : ind];
+			int i = spring.i, j = spring.j;
 
-				
-			}
+			// same arithmetic as Spring::getForce, on the component arrays
+			float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+			float d = sqrtf(dx*dx + dy*dy + dz*dz);
+			float k = -spring.stiff * (d - spring.len);
+			float Fx = k * dx / d / mass, Fy = k * dy / d / mass, Fz = k * dz / d / mass;
 
-			cell->push_back(i);
+			dvx[i] += Fx; dvy[i] += Fy; dvz[i] += Fz;
+			dvx[j] -= Fx; dvy[j] -= Fy; dvz[j] -= Fz;
 		}
 	}
 
-	void apply_wind_forces(vector<Vector3f> state, vector<Vector3f> &f, double wind, float mass)
+	// penalty response of particle i, moving at v_i, to an obstacle whose
+	// surface is gap away along the inward unit normal n
+	void apply_contact_force(ParticleState &f, int i, const Vector3f &v_i, const Vector3f &n, float gap)
 	{
-		if (!wind_exist)
-			return;
-
-		double my_rand = (double) rand() / (RAND_MAX) - 0.5;
-		double my_rand2 = (double) rand() / (RAND_MAX) - 0.5;
-
-		for (int i = 0; i < m_numParticles; i++)
-		{
-
-			Vector3f wind_force = Vector3f(wind*(my_rand2), 0, wind * i/m_numParticles * (my_rand));
-			f[2*i + 1] += wind_force / mass;
-		}
+		float k = 160;		// spring model for collision response
+		float c_paral = 40;	// damping factor
+		float c_perp = 5;	// friction effect
+
+		float dist = max(gap / 1e-2, 1.0);
+		Vector3f v_paral = Vector3f::dot(v_i, n) * n;
+		Vector3f v_perp = v_i - v_paral;
+		Vector3f F = -k/(dist)*n
+					 -c_paral*v_paral;
+		// friction has no direction for a particle at rest
+		if (v_perp.absSquared() > 0)
+			F -= c_perp*v_perp/v_perp.abs();
+		f.addVelocity(i, F);
 	}
 
-	void apply_fixed_particles(vector<Vector3f> state, vector<Vector3f> &f)
+	// penalty forces of every obstacle on the particles within 0.1 of it,
+	// evaluated a block of particles at a time
+	void apply_collision_forces(const ParticleState &state, ParticleState &f, float mass);
+
+	// Repulsion between particles closer than radius, from any part of the
+	// system: a penalty force stiffness (radius - d) along the line between
+	// them. Pairs are found with a spatial hash rebuilt on every call, and
+	// each particle sums its own repulsion, in parallel on m_pool.
+	void apply_self_collision_forces(const ParticleState &state, ParticleState &f, float radius, float stiffness, float mass);
+
+	// Wind of strength wind: a horizontal gust shared by every particle,
+	// the turbulence of m_windField where each particle is, and a flutter
+	// of its own. The random parts are drawn from a Philox stream keyed by
+	// the wind step and the particle, so every stage of a step sees the
+	// same wind, and the forces are computed in parallel on m_pool with the
+	// same results for any number of threads.
+	void apply_wind_forces(const ParticleState &state, ParticleState &f, double wind, float mass);
+
+	// moves the wind on to the next step; systems with wind call this from
+	// beginStep
+	void advance_wind(float stepSize) { m_windStep++; m_windTime += stepSize; }
+
+	void apply_fixed_particles(const ParticleState &state, ParticleState &f)
 	{
 		for (size_t ind = 0; ind < fixed_particles.size(); ind++)
 		{
 			int i = fixed_particles[ind];
-			// Vector3f p_i = state[2*i];
-			Vector3f p_mid = state[2*fixed_particles[fixed_particles.size()/2]];
+			// Vector3f p_i = state.position(i);
+			Vector3f p_mid = state.position(fixed_particles[fixed_particles.size()/2]);
 
-			f[2*i] = Vector3f(0, 0, 0);
-			f[2*i + 1] = Vector3f(0, 0, 0);
+			Vector3f dx = Vector3f(0, 0, 0);
+			f.setVelocity(i, Vector3f(0, 0, 0));
 
 			Vector3f unit[3] = {Vector3f::RIGHT, Vector3f::UP, -Vector3f::FORWARD};
 			for (int axis = 0; axis < 3; axis++)
 				if (swing[axis])
 				{
 					if (swing_forwad[axis] && p_mid[axis] > -swing_length)
-						f[2*i] += -5 * unit[axis];
+						dx += -5 * unit[axis];
 					else
 					if (!swing_forwad[axis] && p_mid[axis] < swing_length)
-						f[2*i] += +5 * unit[axis];
+						dx += +5 * unit[axis];
 					else {
 						swing_forwad[axis] = !swing_forwad[axis];
-						f[2*i] += (swing_forwad[axis] ? -5 : 5) * unit[axis];
+						dx += (swing_forwad[axis] ? -5 : 5) * unit[axis];
 					}
 				}
+
+			f.setPosition(i, dx);
 		}
 	}
 
 	bool getSwing(int axis) { return swing[axis]; }
-	void toggleSwing(int axis) { swing[axis] = !swing[axis]; }
+	void toggleSwing(int axis) { swing[axis] = !swing[axis]; wake_all(); }
 	
-	void toggleWind() { wind_exist = !wind_exist; }
+	void toggleWind() { wind_exist = !wind_exist; wake_all(); invalidate_derivative(); }
+
+	// Sleeping: particles fall asleep a block of consecutive indices at a
+	// time, once every particle of the block has moved slower than a
+	// threshold for a number of steps, and then keep still: evalF skips
+	// them, steppers hold them like fixed particles and the obstacle sweep
+	// leaves them out. A block wakes when one of its particles is moved
+	// anyway (by a collision response), when an awake particle tied to it
+	// by a spring moves or the strain of such a spring rises, when a fast
+	// awake particle comes within contactRadius of it, and every block
+	// wakes when the wind or the swing is toggled. Nothing sleeps while the
+	// wind blows. Sleeping is off until toggled on. Systems that support
+	// sleeping call update_sleeping from endStep, after the step's
+	// positions are final and with the ones begin_continuous_collisions
+	// recorded, and mask_sleeping at the end of evalF.
+	void update_sleeping(float stepSize, float contactRadius);
+	void mask_sleeping(ParticleState &f) const;
+	void wake_all();
+
+	bool getSleepingEnabled() const { return sleeping_enabled; }
+	void toggleSleeping() { sleeping_enabled = !sleeping_enabled; wake_all(); }
+
+	// per particle, nonzero if it is asleep; empty until update_sleeping
+	// first runs
+	const vector<char> &getSleeping() const { return m_asleep; }
+	bool isAsleep(int i) const { return !m_asleep.empty() && m_asleep[i]; }
+
+	// particles asleep after the last step; the rest are awake
+	int getSleepingCount() const { return m_sleepingCount; }
+
+	// the indices of the springs with an awake end, or 0 while nothing
+	// sleeps and every spring counts
+	const vector<int> *getActiveSprings();
+
+	// the strain at which springs tear, or 0 if they never do; it is up to
+	// the system to call tear_springs with it
+	float getTearStrain() const { return tear_strain; }
+	void setTearStrain(float strain) { tear_strain = strain; }
+	void toggleTearing() { tear_strain = tear_strain > 0 ? 0 : defaultTearStrain; }
+	static const float defaultTearStrain;
+
+	// physical description of the system, for steppers that need more than f(X)
+	float getMass() const { return mass; }
+	float getDragCoefficient() const { return drag_coefficient; }
+	const vector<Spring> &getSprings() const { return springs; }
+	const vector<int> &getFixedParticles() const { return fixed_particles; }
+	const vector<Obstacle *> &getObstacles() const { return obstacles; }
+	// 3 particle indices per triangle
+	const vector<int> &getTriangles() const { return triangles; }
+
+	// called by the driver before every takeStep
+	virtual void beginStep(float stepSize) {}
+
+	// called by the driver after every takeStep, for corrections that work
+	// on the stepped state rather than through forces
+	virtual void endStep(float stepSize) {}
+
+	// A stepper may keep the derivative it ends a step with for the next
+	// step (see VelocityVerlet), which holds only while the state and the
+	// forces stay as the step left them. Systems call invalidate_derivative
+	// when they change either outside the stepper, from beginStep and
+	// endStep or when a setting changes; getRevision counts the calls.
+	void invalidate_derivative() { m_revision++; }
+	unsigned int getRevision() const { return m_revision; }
+
+	// prints whatever the system measures about its own cost
+	virtual void printStats() {}
+
+	// Checkpoints (see checkpoint.h). save writes the particles, springs,
+	// fixed particles, triangles, spring colors, what tore, which blocks
+	// sleep, the obstacles, and the swing, wind, tearing and sleeping
+	// settings. restore reads them back into a system just constructed
+	// empty, all but the obstacles; systems add their own sections and
+	// recreate the obstacles with restore_obstacles. False, with the system
+	// unchanged, if a section is missing or inconsistent.
+	virtual void save(CheckpointWriter &out) const;
+	virtual bool restore(const CheckpointReader &in);
+
+	// threads used for force evaluation, ThreadPool::global() by default
+	void setThreadPool(ThreadPool *pool) { m_pool = pool; }
+	ThreadPool &getThreadPool() { return *m_pool; }
+
+	// how apply_spring_forces accumulates: scattering every spring into both
+	// particles (serially or by color), or gathering per particle through
+	// the CSR adjacency, which is built on first use. Constrained springs
+	// exert no force at all; a position-based stepper enforces them.
+	enum SpringEvaluation { SPRINGS_SCATTER, SPRINGS_GATHER, SPRINGS_CONSTRAINED };
+	void setSpringEvaluation(SpringEvaluation mode) { spring_evaluation = mode; }
+	SpringEvaluation getSpringEvaluation() const { return spring_evaluation; }
+
+	// particle-to-spring adjacency, (re)built if the springs changed
+	const SpringAdjacency &getSpringAdjacency();
+
+	// spring indices grouped by color_springs (empty before it is called):
+	// color c is getSpringOrder()[getSpringColorStart()[c], ...[c+1])
+	const vector<int> &getSpringOrder() const { return m_springOrder; }
+	const vector<int> &getSpringColorStart() const { return m_colorStart; }
+
+	// whether no two springs of color c share a particle; only the overflow
+	// color can fail this
+	bool isIndependentColor(int c) const;
 
 protected:
 
-	vector<Vector3f> m_vVecState;
 	vector<Spring> springs;
 	vector<int> fixed_particles;
-	vector<Sphere> obstacles;
+	vector<Obstacle *> obstacles;	// owned
+	vector<int> triangles;
 
 	bool swing[3];
 	bool swing_forwad[3];
 	float swing_length;
 
 	bool wind_exist;
+	WindField m_windField;
+	unsigned int m_windStep;
+	double m_windTime;	// simulated time the wind has blown for
+
+	unsigned int m_revision;	// see invalidate_derivative
+
+	float tear_strain;
+	bool sleeping_enabled;
+
+	// mass of every particle and coefficient of the drag force -c v
+	float mass;
+	float drag_coefficient;
+
+	// position and velocity of every particle, structure-of-arrays
+	ParticleState m_state;
+
+	// positions to draw, see interpolateDisplay
+	vector<Vector3f> m_display;
+
+	ThreadPool *m_pool;
+
+	// spring indices grouped by color; color c is
+	// m_springOrder[m_colorStart[c], m_colorStart[c+1])
+	vector<int> m_springOrder;
+	vector<int> m_colorStart;
+	vector<int> m_springSlot;	// spring -> its place in m_springOrder
+
+	// what tearing removed, and the scratch list of springs to remove
+	vector<Spring> m_tornSprings;
+	vector<int> m_tornTriangles;
+	vector<int> m_tearing;
+
+	// the triangles around every particle, for finding those of a torn
+	// spring: particle i's are m_vertexTriangles[m_vertexTriangleStart[i],
+	// m_vertexTriangleEnd[i]). Built on the first tear, together with the
+	// index every triangle had before tearing.
+	vector<int> m_vertexTriangleStart, m_vertexTriangleEnd, m_vertexTriangles;
+	vector<int> m_triangleIds;
+	int m_changedBegin, m_changedEnd;	// see getTriangleChanges
+	pthread_mutex_t m_topologyMutex;
+
+	void index_triangles();
+	void remove_triangle(int t);
+	void uncolor_spring(int s);
+
+	// sleeping state per particle and per block, steps each awake block has
+	// been still, and the [begin, end) particle ranges of the awake blocks
+	vector<char> m_asleep, m_blockAsleep, m_wakeBlock;
+	vector<int> m_stillSteps;
+	vector<float> m_blockStrain;	// of the springs into a sleeping block when it fell asleep, or -1
+	vector<float> m_crossingStrain;	// the same for the current step
+	vector<int> m_awakeRanges;
+	vector<int> m_fastParticles;
+	int m_sleepingCount;
+
+	// see getActiveSprings, rebuilt after sleeping or the springs change
+	vector<int> m_activeSprings;
+	bool m_activeSpringsValid;
+
+	// the blocks to wake are marked in m_wakeBlock; applies the marks and
+	// puts the blocks still long enough to sleep
+	void change_sleeping();
+	void find_awake_ranges();
+
+	// the particles to evaluate: range r of num_awake_ranges() is
+	// [begin, end), all of them while nothing sleeps
+	int num_awake_ranges() const { return m_sleepingCount > 0 ? (int)m_awakeRanges.size() / 2 : 1; }
+	void awake_range(int r, int &begin, int &end) const
+	{
+		begin = m_sleepingCount > 0 ? m_awakeRanges[2*r] : 0;
+		end = m_sleepingCount > 0 ? m_awakeRanges[2*r + 1] : m_numParticles;
+	}
+
+	SpringEvaluation spring_evaluation;
+	SpringAdjacency m_adjacency;
+
+	// broadphase of apply_self_collision_forces
+	SpatialHash m_spatialHash;
+
+	// the nearest obstacle to each of the count points: like
+	// Obstacle::evaluate, for the union of all obstacles
+	void evaluate_obstacles(const float *x, const float *y, const float *z, int count,
+		float *gap, float *nx, float *ny, float *nz);
+
+	// adds the obstacles save recorded, field ones on field and mesh; false,
+	// with none added, if the section is missing or holds one that cannot
+	// be made (see Obstacle::create)
+	bool restore_obstacles(const CheckpointReader &in, const DistanceField *field = 0,
+		const TriangleMesh *mesh = 0);
+
+	// gaps and normals of one block of particles, for apply_collision_forces
+	// and evaluate_obstacles
+	vector<float> m_obstacleScratch;
+
+	// state of the continuous collision sweep: positions at the start of the
+	// step, how far along its path each particle is, the particles still
+	// being advanced, and their current points, gaps and normals
+	vector<float> m_stepStart;
+	vector<float> m_sweepTime;
+	vector<int> m_sweepParticles;
+	vector<float> m_sweepBuffer;
+
+	// particles the last apply_continuous_collisions stopped on a surface
+	// mid-path, and pushed out of an obstacle after the step
+	int m_sweptHits, m_pushedOut;
+
+private:
+	// obstacles are owned; not copyable
+	ParticleSystem(const ParticleSystem &);
+	ParticleSystem &operator=(const ParticleSystem &);
 };
 
 #endif
@@ -4,6 +4,9 @@
 PendulumSystem::PendulumSystem(int numParticles):ParticleSystem(numParticles)
 {
 	m_numParticles = numParticles;
+
+	mass = 1;
+	drag_coefficient = 0.5;
 	
 	// initializing the state based on the number of particles
 	for (int i = 0; i < m_numParticles; i++) {
@@ -12,12 +15,12 @@ PendulumSystem::PendulumSystem(int numParticles):ParticleSystem(numParticles)
 
 		if (i == 0) {
 			
-			m_vVecState.push_back(Vector3f(0, 0, 0));	// x
-			m_vVecState.push_back(Vector3f(0, 0, 0));	// v
+			m_state.setPosition(i, Vector3f(0, 0, 0));	// x
+			m_state.setVelocity(i, Vector3f(0, 0, 0));	// v
 		}
 		else {
-			m_vVecState.push_back(Vector3f(i - m_numParticles/2.0, -i, 0));	// x
-			m_vVecState.push_back(Vector3f(0, 0, 0));	// v
+			m_state.setPosition(i, Vector3f(i - m_numParticles/2.0, -i, 0));	// x
+			m_state.setVelocity(i, Vector3f(0, 0, 0));	// v
 		}
 	}
 
@@ -29,34 +32,27 @@ PendulumSystem::PendulumSystem(int numParticles):ParticleSystem(numParticles)
 	}
 
 	add_fixed_particle(0);
+
+	color_springs();
 }
 
 
 // TODO: implement evalF
 // for a given state, evaluate f(X,t)
-vector<Vector3f> PendulumSystem::evalF(vector<Vector3f> state)
+void PendulumSystem::evalF(const ParticleState &state, ParticleState &f)
 {
-	vector<Vector3f> f;
-
-	float mass = 1;
-	float drag_coefficient = 0.5;
-
 	init_f(state, f);
 	apply_gravity_forces(state, f);
 	apply_drag_forces(state, f, drag_coefficient, mass);
 	apply_spring_forces(state, f, mass);
 	apply_fixed_particles(state, f);
-
-	return f;
 }
 
 // render the system (ie draw the particles)
 void PendulumSystem::draw()
 {
-	vector<Vector3f> state = getState();
-
 	for (int i = 0; i < m_numParticles; i++) {
-		Vector3f pos = state[2*i];//  position of particle i
+		Vector3f pos = displayPosition(i);//  position of particle i
 		glPushMatrix();
 		glTranslatef(pos[0], pos[1], pos[2] );
 		glutSolidSphere(0.075f,10.0f,10.0f);
@@ -12,7 +12,7 @@ class PendulumSystem: public ParticleSystem
 public:
 	PendulumSystem(int numParticles);
 	
-	vector<Vector3f> evalF(vector<Vector3f> state);
+	void evalF(const ParticleState &state, ParticleState &f);
 	
 	void draw();
 	
@@ -0,0 +1,52 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3"), a counter-based random number generator: the four words for a
+// counter are a fixed function of the counter and the key, with no state
+// carried from one draw to the next. Keying the counter by what a number
+// is for (a step and a particle, say) gives every use its own stream, so
+// the numbers do not depend on the order they are drawn in or on which
+// thread draws them.
+class Philox
+{
+public:
+	explicit Philox(unsigned int key0 = 0, unsigned int key1 = 0)
+	{
+		m_key[0] = key0;
+		m_key[1] = key1;
+	}
+
+	// the four words for counter (c0, c1, c2, c3)
+	void generate(unsigned int c0, unsigned int c1, unsigned int c2, unsigned int c3, unsigned int out[4]) const
+	{
+		unsigned int c[4] = {c0, c1, c2, c3};
+		unsigned int k0 = m_key[0], k1 = m_key[1];
+		for (int round = 0; round < 10; round++)
+		{
+			unsigned long long p0 = (unsigned long long)0xD2511F53u * c[0];
+			unsigned long long p1 = (unsigned long long)0xCD9E8D57u * c[2];
+			unsigned int hi0 = (unsigned int)(p0 >> 32), lo0 = (unsigned int)p0;
+			unsigned int hi1 = (unsigned int)(p1 >> 32), lo1 = (unsigned int)p1;
+			c[0] = hi1 ^ c[1] ^ k0;
+			c[1] = lo1;
+			c[2] = hi0 ^ c[3] ^ k1;
+			c[3] = lo0;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		for (int k = 0; k < 4; k++)
+			out[k] = c[k];
+	}
+
+	// a word's top 24 bits as a float in [-0.5, 0.5)
+	static float centered(unsigned int word)
+	{
+		return (word >> 8) * (1.0f / 16777216.0f) - 0.5f;
+	}
+
+private:
+	unsigned int m_key[2];
+};
+
+#endif
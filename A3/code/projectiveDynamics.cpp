@@ -0,0 +1,241 @@
+#include "projectiveDynamics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	// the local step for a range of springs: p_s = x_i - x_j at rest length
+	class ProjectionTask:public ParallelTask
+	{
+	public:
+		const Spring *springs;
+		const float *x, *y, *z;
+		float *projections;
+
+		void run(int begin, int end)
+		{
+			for (int s = begin; s < end; s++)
+			{
+				const Spring &spring = springs[s];
+				int i = spring.i, j = spring.j;
+
+				float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+				float d = sqrtf(dx*dx + dy*dy + dz*dz);
+				float scale = d > 0 ? spring.len / d : 0;
+
+				float *p = projections + 3*s;
+				p[0] = scale * dx;
+				p[1] = scale * dy;
+				p[2] = scale * dz;
+			}
+		}
+	};
+}
+
+ProjectiveDynamics::ProjectiveDynamics(int iterations):m_iterations(iterations), m_factorizations(0),
+	m_numSprings(0), m_numTorn(0), m_numParticles(0), m_stepSize(0), m_failed(false)
+{
+}
+
+// springs that tore since the factorization still count as matching
+bool ProjectiveDynamics::matches(ParticleSystem* particleSystem, float stepSize) const
+{
+	size_t torn = particleSystem->getTornSprings().size() - m_numTorn;
+	// a matrix that failed is tried again once anything about it changes
+	if (m_failed && torn > 0)
+		return false;
+	return (m_cholesky.size() > 0 || m_failed) && m_stepSize == stepSize &&
+		m_numSprings == particleSystem->getSprings().size() + torn &&
+		m_numParticles == particleSystem->getParticleState().size() &&
+		m_fixed == m_pinned;
+}
+
+void ProjectiveDynamics::factor(ParticleSystem* particleSystem, float stepSize)
+{
+	const vector<Spring> &springs = particleSystem->getSprings();
+	int n = particleSystem->getParticleState().size();
+
+	m_numSprings = springs.size();
+	m_numTorn = particleSystem->getTornSprings().size();
+	m_numParticles = n;
+	m_fixed = m_pinned;
+	m_stepSize = stepSize;
+	m_factorizations++;
+
+	m_unknown.assign(n, 0);
+	for (size_t ind = 0; ind < m_fixed.size(); ind++)
+		m_unknown[m_fixed[ind]] = -1;
+	int unknowns = 0;
+	for (int i = 0; i < n; i++)
+		if (m_unknown[i] == 0)
+			m_unknown[i] = unknowns++;
+
+	// m/h^2 on the diagonal plus the spring Laplacian, lower triangle
+	vector<int> rows, cols;
+	vector<double> values;
+	double inertia = particleSystem->getMass() / ((double)stepSize * stepSize);
+	for (int u = 0; u < unknowns; u++)
+	{
+		rows.push_back(u);
+		cols.push_back(u);
+		values.push_back(inertia);
+	}
+
+	for (size_t s = 0; s < springs.size(); s++)
+	{
+		int ri = m_unknown[springs[s].i], rj = m_unknown[springs[s].j];
+		double k = springs[s].stiff;
+		if (ri >= 0)
+		{
+			rows.push_back(ri);
+			cols.push_back(ri);
+			values.push_back(k);
+		}
+		if (rj >= 0)
+		{
+			rows.push_back(rj);
+			cols.push_back(rj);
+			values.push_back(k);
+		}
+		if (ri >= 0 && rj >= 0 && ri != rj)
+		{
+			rows.push_back(max(ri, rj));
+			cols.push_back(min(ri, rj));
+			values.push_back(-k);
+		}
+	}
+
+	m_failed = !m_cholesky.factor(unknowns, rows, cols, values);
+	if (m_failed)
+		cerr << "Projective dynamics: the global matrix is not positive definite, using implicit Euler" << endl;
+}
+
+bool ProjectiveDynamics::removeTorn(ParticleSystem* particleSystem)
+{
+	const vector<Spring> &torn = particleSystem->getTornSprings();
+	for (; m_numTorn < torn.size(); m_numTorn++)
+	{
+		const Spring &spring = torn[m_numTorn];
+		int ri = m_unknown[spring.i], rj = m_unknown[spring.j];
+		if (ri < 0)
+			swap(ri, rj);
+		if (ri >= 0 && !m_cholesky.downdate(ri, rj, spring.stiff))
+			return false;
+	}
+	m_numSprings = particleSystem->getSprings().size();
+	return true;
+}
+
+void ProjectiveDynamics::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	const vector<Spring> &springs = particleSystem->getSprings();
+	float h = stepSize;
+	int n = state.size();
+
+	// sleeping particles are held like fixed ones, which costs a new
+	// factorization whenever a block falls asleep or wakes
+	m_pinned = particleSystem->getFixedParticles();
+	for (int i = 0; particleSystem->getSleepingCount() > 0 && i < n; i++)
+		if (particleSystem->isAsleep(i))
+			m_pinned.push_back(i);
+
+	if (!matches(particleSystem, stepSize) || (!m_failed && !removeTorn(particleSystem)))
+		factor(particleSystem, stepSize);
+	if (m_failed)
+	{
+		m_fallback.takeStep(particleSystem, stepSize);
+		return;
+	}
+
+	// everything but the springs, which the solve handles
+	ParticleSystem::SpringEvaluation mode = particleSystem->getSpringEvaluation();
+	particleSystem->setSpringEvaluation(ParticleSystem::SPRINGS_CONSTRAINED);
+	evalF(particleSystem, state, m_f);
+	particleSystem->setSpringEvaluation(mode);
+
+	// s = x + h (dx/dt + h dv/dt): where free particles would go without the
+	// springs, and where fixed ones are prescribed to go. It is also the
+	// first guess.
+	m_previous.assign(state.pos(0), state.pos(0) + 3 * n);
+	m_inertial.resize(3 * n);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float *px = state.pos(axis);
+		float *pv = state.vel(axis);
+		const float *dx = m_f.pos(axis);
+		const float *dv = m_f.vel(axis);
+		float *s = &m_inertial[axis * n];
+
+		for (int i = 0; i < n; i++)
+		{
+			pv[i] += h * dv[i];
+			s[i] = px[i] + h * (dx[i] + h * dv[i]);
+			px[i] = s[i];
+		}
+	}
+
+	int unknowns = m_cholesky.size();
+	m_projections.resize(3 * springs.size());
+	m_rhs.resize(3 * unknowns);
+	float inertia = particleSystem->getMass() / (h * h);
+
+	ProjectionTask task;
+	task.springs = springs.empty() ? 0 : &springs[0];
+	task.x = state.pos(0); task.y = state.pos(1); task.z = state.pos(2);
+	task.projections = springs.empty() ? 0 : &m_projections[0];
+
+	for (int iteration = 0; iteration < m_iterations && unknowns > 0; iteration++)
+	{
+		particleSystem->getThreadPool().parallelFor(0, (int)springs.size(), task, 4096);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float *px = state.pos(axis);
+			const float *s = &m_inertial[axis * n];
+			float *rhs = &m_rhs[axis * unknowns];
+
+			for (int i = 0; i < n; i++)
+				if (m_unknown[i] >= 0)
+					rhs[m_unknown[i]] = inertia * s[i];
+
+			// k (e_i - e_j) p_s, with the fixed ends moved to the right side
+			for (size_t sp = 0; sp < springs.size(); sp++)
+			{
+				const Spring &spring = springs[sp];
+				float kp = spring.stiff * m_projections[3*sp + axis];
+				int ri = m_unknown[spring.i], rj = m_unknown[spring.j];
+				if (ri >= 0)
+					rhs[ri] += kp + (rj < 0 ? spring.stiff * px[spring.j] : 0);
+				if (rj >= 0)
+					rhs[rj] += -kp + (ri < 0 ? spring.stiff * px[spring.i] : 0);
+			}
+		}
+
+		m_cholesky.solve(&m_rhs[0], &m_rhs[unknowns], &m_rhs[2 * unknowns]);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float *px = state.pos(axis);
+			const float *rhs = &m_rhs[axis * unknowns];
+			for (int i = 0; i < n; i++)
+				if (m_unknown[i] >= 0)
+					px[i] = rhs[m_unknown[i]];
+		}
+	}
+
+	// the velocity that moved the free particles where they ended up
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float *px = state.pos(axis);
+		const float *x0 = &m_previous[axis * n];
+		float *pv = state.vel(axis);
+
+		for (int i = 0; i < n; i++)
+			if (m_unknown[i] >= 0)
+				pv[i] = (px[i] - x0[i]) / h;
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef PROJECTIVEDYNAMICS_H
+#define PROJECTIVEDYNAMICS_H
+
+#include <vector>
+
+#include "TimeStepper.hpp"
+#include "implicitEuler.h"
+#include "sparseCholesky.h"
+
+// Projective dynamics (Bouaziz et al., "Projective Dynamics: Fusing
+// Constraint Projections for Fast Simulation") for mass-spring systems.
+// Each step minimizes the implicit Euler energy
+//
+//   m/(2h^2) |x - s|^2 + sum_s k_s/2 |x_i - x_j - p_s|^2
+//
+// by alternating a local step, which sets p_s to x_i - x_j scaled to the
+// spring's rest length, and a global step, which solves for x with the
+// matrix m/h^2 I + sum_s k_s (e_i - e_j)(e_i - e_j)^T. That matrix does not
+// depend on the state, so it is factored once (see SparseCholesky) and a
+// global step is two triangular solves per axis. s is the position the
+// forces evalF gives without the springs (gravity, drag, wind, obstacles)
+// would reach.
+//
+// Fixed particles follow their prescribed motion and are eliminated from
+// the global system. It is refactored only when the number of particles or
+// springs, the fixed or sleeping particles or the step size change; like
+// SpringAdjacency it assumes springs change by being added or removed.
+// Springs that tore (see ParticleSystem::tear_springs) are instead taken
+// out of the factor by a downdate each. If the matrix cannot be factored,
+// steps are taken with implicit Euler until it changes.
+class ProjectiveDynamics:public TimeStepper
+{
+public:
+  ProjectiveDynamics(int iterations = 10);
+
+  void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  void setIterations(int iterations) { m_iterations = iterations; }
+  int getIterations() const { return m_iterations; }
+
+  // times the global matrix has been factored
+  int getFactorizations() const { return m_factorizations; }
+
+  // the next step refactors
+  void reset() { m_numParticles = -1; }
+
+private:
+  bool matches(ParticleSystem* particleSystem, float stepSize) const;
+  void factor(ParticleSystem* particleSystem, float stepSize);
+
+  // downdates the factor for the springs torn since it was last brought
+  // up to date; false if it has to be refactored instead
+  bool removeTorn(ParticleSystem* particleSystem);
+
+  int m_iterations;
+  int m_factorizations;
+
+  // what the factorization was made for
+  size_t m_numSprings;
+  size_t m_numTorn;	// of getTornSprings(), those already out of the factor
+  int m_numParticles;
+  vector<int> m_fixed;	// fixed, then sleeping particles
+  vector<int> m_pinned;	// the same for the current step
+  float m_stepSize;
+
+  SparseCholesky m_cholesky;
+  bool m_failed;	// the factorization failed, so m_fallback steps
+  ImplicitEuler m_fallback;
+  vector<int> m_unknown;	// per particle, its row in the global system or -1 if fixed
+
+  ParticleState m_f;
+  vector<float> m_previous;	// positions at the start of the step
+  vector<float> m_inertial;	// s, 3n like ParticleState's positions
+  vector<float> m_projections;	// p, 3 per spring
+  vector<float> m_rhs;	// the global system's x, y and z right-hand sides
+};
+
+#endif
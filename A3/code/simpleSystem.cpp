@@ -3,33 +3,32 @@
 
 using namespace std;
 
-SimpleSystem::SimpleSystem()
+SimpleSystem::SimpleSystem():ParticleSystem(1)
 {
-    m_vVecState.push_back(Vector3f(0.5, 0.5, 0));
+    m_state.setPosition(0, Vector3f(0.5, 0.5, 0));
 }
 
 // for a given state, evaluate f(X,t)
-vector<Vector3f> SimpleSystem::evalF(vector<Vector3f> state)
+// (the particle is moved directly by the position derivative; its velocity
+// slot is unused and stays zero)
+void SimpleSystem::evalF(const ParticleState &state, ParticleState &f)
 {
-	vector<Vector3f> f;
+	f.resize(state.size());
 
-	for (size_t i = 0; i < state.size(); i ++)
+	for (int i = 0; i < state.size(); i ++)
 	{
-		Vector3f particle = state[i];
-		Vector3f f_particle = Vector3f(-particle.y(), particle.x(), 0);
-		f.push_back(f_particle);
+		Vector3f particle = state.position(i);
+		f.setPosition(i, Vector3f(-particle.y(), particle.x(), 0));
+		f.setVelocity(i, Vector3f(0, 0, 0));
 	}
-
-	return f;
 }
 
 // render the system (ie draw the particles)
 void SimpleSystem::draw()
 {
-	vector<Vector3f> state = getState();
-	for (size_t i = 0; i < state.size(); i++)
+	for (int i = 0; i < m_state.size(); i++)
 	{
-		Vector3f pos = state[i];//YOUR PARTICLE POSITION
+		Vector3f pos = displayPosition(i);//YOUR PARTICLE POSITION
 		glPushMatrix();
 		glTranslatef(pos[0], pos[1], pos[2] );
 		glutSolidSphere(0.075f,10.0f,10.0f);
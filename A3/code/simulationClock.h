@@ -0,0 +1,76 @@
+#ifndef SIMULATIONCLOCK_H
+#define SIMULATIONCLOCK_H
+
+#include <time.h>
+
+// monotonic wall-clock time in seconds, comparable across threads
+inline double wallTime()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Fixed-timestep accumulator. Elapsed wall-clock time is fed in as it
+// passes and converted into a whole number of simulation steps of a fixed
+// size, so the simulated speed no longer depends on how often frames come
+// and the step size can shrink without the motion slowing down. The part of
+// a step left over is reported as alpha() for drawing a blend of the last
+// two states.
+//
+// When the simulation cannot keep up, at most maxSubsteps steps are taken
+// per advance() and the rest of the backlog is dropped: the scene slows down
+// instead of spending ever longer frames catching up.
+class SimulationClock
+{
+public:
+	// timeScale is the number of simulated seconds per wall-clock second
+	SimulationClock(float stepSize, int maxSubsteps = 8, float timeScale = 1)
+		:m_stepSize(stepSize), m_maxSubsteps(maxSubsteps), m_timeScale(timeScale),
+		m_accumulator(0), m_droppedSteps(0)
+	{
+	}
+
+	void setStepSize(float stepSize)
+	{
+		m_stepSize = stepSize;
+		m_accumulator = 0;
+	}
+
+	float getStepSize() const { return m_stepSize; }
+	float getTimeScale() const { return m_timeScale; }
+	void setTimeScale(float timeScale) { m_timeScale = timeScale; }
+
+	// adds elapsed wall-clock seconds; returns the number of steps to take now
+	int advance(float seconds)
+	{
+		if (seconds > 0)
+			m_accumulator += seconds * m_timeScale;
+
+		int steps = (int)(m_accumulator / m_stepSize);
+		m_accumulator -= steps * m_stepSize;
+
+		if (steps > m_maxSubsteps)
+		{
+			m_droppedSteps += steps - m_maxSubsteps;
+			steps = m_maxSubsteps;
+		}
+		return steps;
+	}
+
+	// fraction of a step simulated time is ahead of the last step taken
+	float alpha() const { return m_accumulator / m_stepSize; }
+
+	// steps skipped so far because the simulation fell behind
+	int getDroppedSteps() const { return m_droppedSteps; }
+
+private:
+	float m_stepSize;
+	int m_maxSubsteps;
+	float m_timeScale;
+
+	float m_accumulator;
+	int m_droppedSteps;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "simulationThread.h"
+
+#include <cstdio>
+
+SimulationThread::SimulationThread()
+	:m_system(0), m_stepper(0), m_clock(0.04f), m_running(false), m_recorder(0),
+	 m_checkpointsWritten(0), m_checkpointsFailed(0)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+void SimulationThread::start(ParticleSystem *system, TimeStepper *stepper, float stepSize, float timeScale)
+{
+	stop();
+
+	m_system = system;
+	m_stepper = stepper;
+	m_clock.setStepSize(stepSize);
+	m_clock.setTimeScale(timeScale);
+
+	// the initial state, so there is something to draw right away
+	const ParticleState &state = m_system->getParticleState();
+	m_previous.assign(state.pos(0), state.pos(0) + 3 * state.size());
+	publish(m_previous);
+	record();
+
+	m_running = true;
+	pthread_create(&m_thread, 0, &SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+	if (!m_running)
+		return;
+
+	__atomic_store_n(&m_running, false, __ATOMIC_RELEASE);
+	pthread_join(m_thread, 0);
+}
+
+bool SimulationThread::post(const SimulationCommand &command)
+{
+	return m_commands.push(command);
+}
+
+const SimulationSnapshot &SimulationThread::latestSnapshot()
+{
+	m_snapshots.update();
+	return m_snapshots.front();
+}
+
+void *SimulationThread::run(void *self)
+{
+	static_cast<SimulationThread *>(self)->loop();
+	return 0;
+}
+
+void SimulationThread::loop()
+{
+	double last = wallTime();
+
+	while (__atomic_load_n(&m_running, __ATOMIC_ACQUIRE))
+	{
+		SimulationCommand command;
+		while (m_commands.pop(command))
+			execute(command);
+
+		double now = wallTime();
+		int steps = m_clock.advance(now - last);
+		last = now;
+
+		for (int s = 0; s < steps; s++)
+		{
+			if (s == steps - 1)
+			{
+				const ParticleState &state = m_system->getParticleState();
+				m_previous.assign(state.pos(0), state.pos(0) + 3 * state.size());
+			}
+			m_system->beginStep(m_clock.getStepSize());
+			m_stepper->takeStep(m_system, m_clock.getStepSize());
+			m_system->endStep(m_clock.getStepSize());
+			record();
+		}
+
+		if (steps > 0)
+			publish(m_previous);
+
+		// sleep until the next step is due, but look at the command queue at
+		// least every 5 ms
+		double wait = (1 - m_clock.alpha()) * m_clock.getStepSize() / m_clock.getTimeScale();
+		if (wait > 0.005)
+			wait = 0.005;
+		if (wait > 0)
+		{
+			timespec t;
+			t.tv_sec = 0;
+			t.tv_nsec = (long)(wait * 1e9);
+			nanosleep(&t, 0);
+		}
+	}
+}
+
+void SimulationThread::execute(const SimulationCommand &command)
+{
+	switch (command.type)
+	{
+	case SimulationCommand::TOGGLE_WIND:
+		m_system->toggleWind();
+		break;
+	case SimulationCommand::TOGGLE_SWING:
+		m_system->toggleSwing(command.axis);
+		printf("swing %s\n", m_system->getSwing(command.axis) ? "on" : "off");
+		break;
+	case SimulationCommand::TOGGLE_TEARING:
+		m_system->toggleTearing();
+		printf("tearing %s\n", m_system->getTearStrain() > 0 ? "on" : "off");
+		break;
+	case SimulationCommand::TOGGLE_SLEEPING:
+		m_system->toggleSleeping();
+		printf("sleeping %s\n", m_system->getSleepingEnabled() ? "on" : "off");
+		break;
+	case SimulationCommand::RESET:
+	{
+		// the UI thread may still be drawing the old system, so it is not
+		// deleted here
+		m_system = command.system;
+		m_stepper->reset();
+		const ParticleState &state = m_system->getParticleState();
+		m_previous.assign(state.pos(0), state.pos(0) + 3 * state.size());
+		publish(m_previous);
+		break;
+	}
+	case SimulationCommand::SAVE_CHECKPOINT:
+		saveCheckpoint(command.path);
+		break;
+	case SimulationCommand::PRINT_STATS:
+		printStats();
+		break;
+	}
+}
+
+void SimulationThread::publish(const vector<float> &previous)
+{
+	SimulationSnapshot &snapshot = m_snapshots.back();
+	const ParticleState &state = m_system->getParticleState();
+
+	snapshot.system = m_system;
+	snapshot.previous.assign(previous.begin(), previous.end());
+	snapshot.current.assign(state.pos(0), state.pos(0) + 3 * state.size());
+	snapshot.sleeping = m_system->getSleepingCount();
+	snapshot.time = wallTime();
+	snapshot.alpha = m_clock.alpha();
+	snapshot.alphaRate = m_clock.getTimeScale() / m_clock.getStepSize();
+
+	m_snapshots.publish();
+}
+
+void SimulationThread::saveCheckpoint(const char *path)
+{
+	double start = wallTime();
+	CheckpointWriter checkpoint;
+	m_system->save(checkpoint);
+	if (checkpoint.write(path))
+	{
+		printf("checkpoint saved to %s in %.1f ms\n", path, (wallTime() - start) * 1e3);
+		__atomic_add_fetch(&m_checkpointsWritten, 1, __ATOMIC_RELEASE);
+	}
+	else
+		__atomic_add_fetch(&m_checkpointsFailed, 1, __ATOMIC_RELEASE);
+}
+
+void SimulationThread::record()
+{
+	const ParticleState &state = m_system->getParticleState();
+	if (m_recorder != 0 && state.size() == m_recorder->getNumParticles())
+		m_recorder->record(state.pos(0));
+}
+
+// how much work the integrator has done so far
+void SimulationThread::printStats()
+{
+	printf("%d steps, %d evaluations of f, %.2f per step\n",
+	       m_stepper->getSteps(), m_stepper->getEvaluations(),
+	       m_stepper->getEvaluationsPerStep());
+	printf("  %d steps dropped to stay real-time\n", m_clock.getDroppedSteps());
+
+	DormandPrince *adaptive = dynamic_cast<DormandPrince *>(m_stepper);
+	if (adaptive != 0)
+		printf("  %d substeps accepted, %d rejected\n",
+		       adaptive->getAcceptedSteps(), adaptive->getRejectedSteps());
+
+	m_system->printStats();
+}
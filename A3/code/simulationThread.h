@@ -0,0 +1,110 @@
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+
+#include <pthread.h>
+#include <vector>
+
+#include "particleSystem.h"
+#include "TimeStepper.hpp"
+#include "simulationClock.h"
+#include "tripleBuffer.h"
+#include "commandQueue.h"
+#include "trajectoryCache.h"
+
+// Positions of a system around its last step, as published by the
+// simulation thread. Positions are laid out like ParticleState's position
+// arrays.
+struct SimulationSnapshot
+{
+	SimulationSnapshot():system(0), sleeping(0), time(0), alpha(0), alphaRate(0){}
+
+	ParticleSystem *system;
+	vector<float> previous;	// before the last step
+	vector<float> current;	// after it
+	int sleeping;			// particles asleep after it
+
+	double time;		// wallTime() when published
+	float alpha;		// clock alpha() at that time
+	float alphaRate;	// alpha gained per wall-clock second
+
+	// interpolation weight for drawing at wall-clock time now
+	float alphaAt(double now) const
+	{
+		float a = alpha + (float)(now - time) * alphaRate;
+		return a < 0 ? 0 : (a > 1 ? 1 : a);
+	}
+};
+
+// A request from the UI thread, carried out on the simulation thread
+// between steps.
+struct SimulationCommand
+{
+	enum Type { TOGGLE_WIND, TOGGLE_SWING, TOGGLE_TEARING, TOGGLE_SLEEPING, RESET, SAVE_CHECKPOINT, PRINT_STATS };
+
+	SimulationCommand(Type t = PRINT_STATS, int a = 0, ParticleSystem *s = 0, const char *p = 0)
+		:type(t), axis(a), system(s), path(p){}
+
+	Type type;
+	int axis;					// TOGGLE_SWING
+	ParticleSystem *system;		// RESET: system to continue with
+	const char *path;			// SAVE_CHECKPOINT: file to write, kept alive by the poster
+};
+
+// Steps a particle system on its own thread, in fixed steps of real time
+// (see SimulationClock), and publishes a snapshot after every batch of
+// steps. The UI thread reads snapshots without blocking and talks to the
+// system only through post().
+class SimulationThread
+{
+public:
+	SimulationThread();
+	~SimulationThread();
+
+	// takes over stepping system with stepper; timeScale is the number of
+	// simulated seconds per wall-clock second
+	void start(ParticleSystem *system, TimeStepper *stepper, float stepSize, float timeScale = 1);
+	void stop();
+
+	// every step from now on is also recorded to recorder, which must be open
+	// for the system's particle count; 0 stops recording
+	void setRecorder(TrajectoryWriter *recorder) { m_recorder = recorder; }
+
+	// queues a command for the simulation thread; false if the queue is full
+	bool post(const SimulationCommand &command);
+
+	// UI side: the newest snapshot published so far (system is 0 before the
+	// thread was started). Stays valid until the next call.
+	const SimulationSnapshot &latestSnapshot();
+
+	// UI side: how many SAVE_CHECKPOINT commands have written their file so
+	// far, and how many could not. Together they reach the number of saves
+	// posted once all have been carried out.
+	int checkpointsWritten() const { return __atomic_load_n(&m_checkpointsWritten, __ATOMIC_ACQUIRE); }
+	int checkpointsFailed() const { return __atomic_load_n(&m_checkpointsFailed, __ATOMIC_ACQUIRE); }
+
+private:
+	static void *run(void *self);
+	void loop();
+	void execute(const SimulationCommand &command);
+	void publish(const vector<float> &previous);
+	void printStats();
+	void record();
+	void saveCheckpoint(const char *path);
+
+	ParticleSystem *m_system;
+	TimeStepper *m_stepper;
+	SimulationClock m_clock;
+
+	pthread_t m_thread;
+	bool m_running;
+
+	TripleBuffer<SimulationSnapshot> m_snapshots;
+	CommandQueue<SimulationCommand, 64> m_commands;
+	TrajectoryWriter *m_recorder;
+
+	int m_checkpointsWritten, m_checkpointsFailed;	// written by the simulation thread only
+
+	vector<float> m_previous;
+};
+
+#endif
@@ -0,0 +1,407 @@
+#include "sparseCholesky.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// parts this small are not dissected further
+	const int leafSize = 64;
+
+	// the graph of A in compressed rows, without the diagonal
+	struct Graph
+	{
+		vector<int> start, adjacent;
+	};
+
+	// Nested dissection (George, "Nested Dissection of a Regular Finite
+	// Element Mesh"), with separators from level structures: a
+	// breadth-first search from a pseudo-peripheral node splits the nodes
+	// into levels, which only touch the levels next to them, so a middle
+	// level separates the ones before it from the ones after. Both sides
+	// are ordered first, recursively, and the separator last, which keeps
+	// the fill of a cloth's graph near O(n log n).
+	class Dissection
+	{
+	public:
+		Dissection(const Graph &graph, vector<int> &order)
+			:m_graph(graph), m_order(order), m_set(graph.start.size() - 1, -1),
+			 m_level(graph.start.size() - 1, -1), m_sets(0)
+		{
+		}
+
+		// appends nodes to the order, each connected part on its own
+		void order(const vector<int> &nodes)
+		{
+			if ((int)nodes.size() <= leafSize)
+			{
+				m_order.insert(m_order.end(), nodes.begin(), nodes.end());
+				return;
+			}
+
+			int set = mark(nodes);
+			vector<vector<int> > parts;
+			for (size_t k = 0; k < nodes.size(); k++)
+				if (m_level[nodes[k]] < 0)
+				{
+					parts.push_back(vector<int>());
+					search(nodes[k], set, parts.back());
+				}
+			if (parts.size() == 1)
+				dissect(parts[0]);
+			else
+				for (size_t p = 0; p < parts.size(); p++)
+					order(parts[p]);
+		}
+
+	private:
+		// nodes become a new set, none of them searched yet
+		int mark(const vector<int> &nodes)
+		{
+			int set = m_sets++;
+			for (size_t k = 0; k < nodes.size(); k++)
+			{
+				m_set[nodes[k]] = set;
+				m_level[nodes[k]] = -1;
+			}
+			return set;
+		}
+
+		// orders connected nodes: both sides of a middle level, then the level
+		void dissect(const vector<int> &nodes)
+		{
+			// a pseudo-peripheral node: start again from the far end for as
+			// long as that makes the structure deeper
+			int set = mark(nodes);
+			vector<int> reached;
+			int root = nodes[0];
+			int levels = search(root, set, reached);
+			for (int sweep = 0; sweep < 4; sweep++)
+			{
+				int far = reached.back();
+				set = mark(nodes);
+				int deeper = search(far, set, reached);
+				if (deeper <= levels)
+				{
+					set = mark(nodes);
+					search(root, set, reached);
+					break;
+				}
+				root = far;
+				levels = deeper;
+			}
+			if (levels < 3)
+			{
+				m_order.insert(m_order.end(), nodes.begin(), nodes.end());
+				return;
+			}
+
+			// the level of the median node; reached is in level order
+			int middle = m_level[reached[reached.size() / 2]];
+			middle = max(1, min(middle, levels - 2));
+			vector<int> before, after, separator;
+			for (size_t k = 0; k < reached.size(); k++)
+			{
+				int v = reached[k];
+				if (m_level[v] < middle)
+					before.push_back(v);
+				else if (m_level[v] > middle)
+					after.push_back(v);
+				else
+					separator.push_back(v);
+			}
+			order(before);
+			order(after);
+			m_order.insert(m_order.end(), separator.begin(), separator.end());
+		}
+
+		// breadth-first search of the unsearched nodes of set from root: the
+		// nodes reached in level order, their levels in m_level; returns the
+		// number of levels
+		int search(int root, int set, vector<int> &reached)
+		{
+			reached.clear();
+			reached.push_back(root);
+			m_level[root] = 0;
+			for (size_t k = 0; k < reached.size(); k++)
+			{
+				int v = reached[k];
+				for (int a = m_graph.start[v]; a < m_graph.start[v + 1]; a++)
+				{
+					int u = m_graph.adjacent[a];
+					if (m_set[u] == set && m_level[u] < 0)
+					{
+						m_level[u] = m_level[v] + 1;
+						reached.push_back(u);
+					}
+				}
+			}
+			return m_level[reached.back()] + 1;
+		}
+
+		const Graph &m_graph;
+		vector<int> &m_order;
+		vector<int> m_set;	// per node, the set it was last marked in
+		vector<int> m_level;	// in the last search of its set, or -1
+		int m_sets;
+	};
+}
+
+bool SparseCholesky::factor(int n, const vector<int> &rows, const vector<int> &cols, const vector<double> &values)
+{
+	m_n = n;
+
+	// graph of A
+	Graph graph;
+	graph.start.assign(n + 1, 0);
+	for (size_t k = 0; k < rows.size(); k++)
+		if (rows[k] != cols[k])
+		{
+			graph.start[rows[k] + 1]++;
+			graph.start[cols[k] + 1]++;
+		}
+	for (int v = 0; v < n; v++)
+		graph.start[v + 1] += graph.start[v];
+	graph.adjacent.resize(graph.start[n]);
+	vector<int> free(graph.start.begin(), graph.start.end() - 1);
+	for (size_t k = 0; k < rows.size(); k++)
+		if (rows[k] != cols[k])
+		{
+			graph.adjacent[free[rows[k]]++] = cols[k];
+			graph.adjacent[free[cols[k]]++] = rows[k];
+		}
+
+	m_order.clear();
+	m_order.reserve(n);
+	vector<int> nodes(n);
+	for (int v = 0; v < n; v++)
+		nodes[v] = v;
+	Dissection(graph, m_order).order(nodes);
+
+	vector<int> position(n);
+	for (int k = 0; k < n; k++)
+		position[m_order[k]] = k;
+
+	// symbolic factorization (Liu, "The Role of Elimination Trees in Sparse
+	// Factorization"): row k of L holds the columns met walking up the
+	// elimination tree from each j < k with A(k, j) nonzero, up to k. The
+	// first pass builds the tree and counts, the second fills the columns
+	// in increasing row order.
+	vector<int> parent(n, -1), flag(n, -1), at;
+	m_colStart.assign(n + 1, 0);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			for (int k = 0; k < n; k++)
+				m_colStart[k + 1] += m_colStart[k] + 1;
+			m_rows.resize(m_colStart[n]);
+			at.resize(n);
+			for (int k = 0; k < n; k++)
+			{
+				m_rows[m_colStart[k]] = k;
+				at[k] = m_colStart[k] + 1;
+			}
+			flag.assign(n, -1);
+		}
+		for (int k = 0; k < n; k++)
+		{
+			flag[k] = k;
+			int v = m_order[k];
+			for (int a = graph.start[v]; a < graph.start[v + 1]; a++)
+				for (int j = position[graph.adjacent[a]]; j < k && flag[j] != k; j = parent[j])
+				{
+					if (pass == 0)
+					{
+						if (parent[j] < 0)
+							parent[j] = k;
+						m_colStart[j + 1]++;
+					}
+					else
+						m_rows[at[j]++] = k;
+					flag[j] = k;
+				}
+		}
+	}
+
+	m_position = position;
+	m_update.assign(n, 0);
+
+	// the lower triangle of P A P^T by column
+	vector<int> aStart(n + 1, 0), aRows(rows.size());
+	vector<double> aValues(rows.size());
+	for (size_t k = 0; k < rows.size(); k++)
+		aStart[min(position[rows[k]], position[cols[k]]) + 1]++;
+	for (int k = 0; k < n; k++)
+		aStart[k + 1] += aStart[k];
+	vector<int> next(aStart.begin(), aStart.end() - 1);
+	for (size_t k = 0; k < rows.size(); k++)
+	{
+		int r = position[rows[k]], c = position[cols[k]];
+		int at = next[min(r, c)]++;
+		aRows[at] = max(r, c);
+		aValues[at] = values[k];
+	}
+
+	// left-looking factorization. Column j is linked into the list of the
+	// next row below the ones already used, so the columns updating column
+	// k are exactly those in list k when it comes up.
+	m_values.assign(m_rows.size(), 0);
+	vector<double> work(n, 0);
+	vector<int> head(n, -1), link(n, -1), used(n);
+
+	for (int k = 0; k < n; k++)
+	{
+		for (int a = aStart[k]; a < aStart[k + 1]; a++)
+			work[aRows[a]] += aValues[a];
+
+		int j = head[k];
+		while (j >= 0)
+		{
+			int following = link[j];
+			int p = used[j];
+			double lkj = m_values[p];
+			for (int q = p; q < m_colStart[j + 1]; q++)
+				work[m_rows[q]] -= lkj * m_values[q];
+
+			if (++used[j] < m_colStart[j + 1])
+			{
+				int r = m_rows[used[j]];
+				link[j] = head[r];
+				head[r] = j;
+			}
+			j = following;
+		}
+
+		double d = work[k];
+		if (!(d > 0))
+		{
+			m_n = 0;	// nothing to solve with
+			return false;
+		}
+		d = sqrt(d);
+
+		m_values[m_colStart[k]] = d;
+		work[k] = 0;
+		for (int q = m_colStart[k] + 1; q < m_colStart[k + 1]; q++)
+		{
+			m_values[q] = work[m_rows[q]] / d;
+			work[m_rows[q]] = 0;
+		}
+
+		used[k] = m_colStart[k] + 1;
+		if (used[k] < m_colStart[k + 1])
+		{
+			int r = m_rows[used[k]];
+			link[k] = head[r];
+			head[r] = k;
+		}
+	}
+
+	m_work.resize(3 * n);
+	return true;
+}
+
+bool SparseCholesky::downdate(int i, int j, double k)
+{
+	double *w = &m_update[0];
+	double root = sqrt(k);
+	int first = m_position[i];
+	w[first] = root;
+	if (j >= 0)
+	{
+		w[m_position[j]] = -root;
+		first = min(first, m_position[j]);
+	}
+
+	// column c changes only if w is nonzero there, and then spreads w to
+	// the rows below its diagonal, all of which lie further up the tree; the
+	// parent of c is the first of them
+	bool definite = true;
+	for (int c = first; c >= 0; )
+	{
+		int diagonal = m_colStart[c], end = m_colStart[c + 1];
+		int parent = diagonal + 1 < end ? m_rows[diagonal + 1] : -1;
+		double wc = w[c];
+		w[c] = 0;
+
+		if (wc != 0 && definite)
+		{
+			double lcc = m_values[diagonal];
+			double r2 = lcc * lcc - wc * wc;
+			if (r2 > 0)
+			{
+				double r = sqrt(r2);
+				double cosine = r / lcc, sine = wc / lcc;
+				m_values[diagonal] = r;
+				for (int q = diagonal + 1; q < end; q++)
+				{
+					double l = (m_values[q] - sine * w[m_rows[q]]) / cosine;
+					w[m_rows[q]] = cosine * w[m_rows[q]] - sine * l;
+					m_values[q] = l;
+				}
+			}
+			else
+				definite = false;	// go on only to clear w
+		}
+		c = parent;
+	}
+	return definite;
+}
+
+void SparseCholesky::solve(float *x, float *y, float *z) const
+{
+	int n = m_n;
+	double *w = n > 0 ? &m_work[0] : 0;
+	for (int k = 0; k < n; k++)
+	{
+		int i = m_order[k];
+		w[3*k] = x[i];
+		w[3*k + 1] = y[i];
+		w[3*k + 2] = z[i];
+	}
+
+	// L w' = w
+	for (int k = 0; k < n; k++)
+	{
+		double inv = 1 / m_values[m_colStart[k]];
+		double a = w[3*k] * inv, b = w[3*k + 1] * inv, c = w[3*k + 2] * inv;
+		w[3*k] = a;
+		w[3*k + 1] = b;
+		w[3*k + 2] = c;
+		for (int q = m_colStart[k] + 1; q < m_colStart[k + 1]; q++)
+		{
+			double l = m_values[q];
+			double *r = w + 3 * m_rows[q];
+			r[0] -= l * a;
+			r[1] -= l * b;
+			r[2] -= l * c;
+		}
+	}
+
+	// L^T w'' = w'
+	for (int k = n - 1; k >= 0; k--)
+	{
+		double a = w[3*k], b = w[3*k + 1], c = w[3*k + 2];
+		for (int q = m_colStart[k] + 1; q < m_colStart[k + 1]; q++)
+		{
+			double l = m_values[q];
+			const double *r = w + 3 * m_rows[q];
+			a -= l * r[0];
+			b -= l * r[1];
+			c -= l * r[2];
+		}
+		double inv = 1 / m_values[m_colStart[k]];
+		w[3*k] = a * inv;
+		w[3*k + 1] = b * inv;
+		w[3*k + 2] = c * inv;
+	}
+
+	for (int k = 0; k < n; k++)
+	{
+		int i = m_order[k];
+		x[i] = (float)w[3*k];
+		y[i] = (float)w[3*k + 1];
+		z[i] = (float)w[3*k + 2];
+	}
+}
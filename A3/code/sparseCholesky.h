@@ -0,0 +1,50 @@
+#ifndef SPARSECHOLESKY_H
+#define SPARSECHOLESKY_H
+
+#include <vector>
+
+using namespace std;
+
+// Sparse Cholesky factorization P A P^T = L L^T of a symmetric positive
+// definite matrix, for systems that are solved many times with the same
+// matrix. The ordering P is a nested dissection of the graph of A, and
+// the pattern of L comes from its elimination tree; both take time about
+// linear in the size of the graph and of L. The numeric factorization is
+// left-looking, column by column, in doubles.
+class SparseCholesky
+{
+public:
+	SparseCholesky():m_n(0){}
+
+	// factors the n x n matrix whose lower triangle is given as entries
+	// (rows[k], cols[k], values[k]) with rows[k] >= cols[k]; duplicates are
+	// summed. False, with size() 0, if the matrix turns out not to be
+	// positive definite.
+	bool factor(int n, const vector<int> &rows, const vector<int> &cols, const vector<double> &values);
+
+	// x = A^-1 x, y = A^-1 y and z = A^-1 z, for n values at each; the
+	// three share every read of L
+	void solve(float *x, float *y, float *z) const;
+
+	// refactors in place for A - k (e_i - e_j)(e_i - e_j)^T, or A - k e_i
+	// e_i^T if j is -1, by a rank-one downdate along the path from the
+	// column of i or j up the elimination tree; the pattern of L stays
+	// valid since nothing is added. False, with the factor spoiled, if the
+	// result is not positive definite.
+	bool downdate(int i, int j, double k);
+
+	int size() const { return m_n; }
+	int nonZeros() const { return (int)m_values.size(); }
+
+private:
+	int m_n;
+	vector<int> m_order;	// elimination position -> original index
+	vector<int> m_position;	// original index -> elimination position
+	vector<int> m_colStart;	// n + 1 offsets into m_rows and m_values
+	vector<int> m_rows;	// per column: the diagonal, then increasing rows
+	vector<double> m_values;
+	mutable vector<double> m_work;	// 3 per row
+	vector<double> m_update;	// per row, zero outside downdate
+};
+
+#endif
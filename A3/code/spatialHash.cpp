@@ -0,0 +1,73 @@
+#include "spatialHash.h"
+
+#include <cmath>
+
+// cell coordinates and bucket of a range of particles
+class SpatialHash::CellTask:public ParallelTask
+{
+public:
+	SpatialHash *grid;
+	const ParticleState *state;
+
+	void run(int begin, int end)
+	{
+		const float *x = state->pos(0), *y = state->pos(1), *z = state->pos(2);
+		float inv = 1 / grid->m_cellSize;
+
+		for (int i = begin; i < end; i++)
+		{
+			Entry &e = grid->m_entries[i];
+			e.x = x[i];
+			e.y = y[i];
+			e.z = z[i];
+			e.cx = (int)floorf(x[i] * inv);
+			e.cy = (int)floorf(y[i] * inv);
+			e.cz = (int)floorf(z[i] * inv);
+			e.particle = i;
+			e.bucket = grid->hash(e.cx, e.cy, e.cz);
+		}
+	}
+};
+
+void SpatialHash::build(const ParticleState &state, float cellSize, ThreadPool &pool)
+{
+	int n = state.size();
+
+	// power of two table with at least two buckets per particle, and more
+	// than a run of three
+	unsigned int buckets = 4;
+	while (buckets < 2u * (unsigned int)n)
+		buckets <<= 1;
+
+	m_cellSize = cellSize;
+	m_mask = buckets - 1;
+
+	m_entries.resize(n);
+	CellTask task;
+	task.grid = this;
+	task.state = &state;
+	pool.parallelFor(0, n, task, 4096);
+
+	// counting sort by bucket; the serial passes keep the order within a
+	// bucket, and therefore the force sums, deterministic
+	m_bucketStart.assign(buckets + 1, 0);
+	for (int i = 0; i < n; i++)
+		m_bucketStart[m_entries[i].bucket + 1]++;
+	for (unsigned int b = 0; b < buckets; b++)
+		m_bucketStart[b + 1] += m_bucketStart[b];
+
+	m_sorted.resize(n);
+	m_slot.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		// m_bucketStart[b] serves as the fill cursor of bucket b ...
+		int k = m_bucketStart[m_entries[i].bucket]++;
+		m_sorted[k] = m_entries[i];
+		m_slot[i] = k;
+	}
+
+	// ... which leaves it at the start of bucket b + 1
+	for (unsigned int b = buckets; b > 0; b--)
+		m_bucketStart[b] = m_bucketStart[b - 1];
+	m_bucketStart[0] = 0;
+}
@@ -0,0 +1,102 @@
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <vector>
+
+#include "particleState.h"
+#include "threadPool.h"
+
+using namespace std;
+
+// Uniform grid broadphase over particle positions. Cells are cubes of the
+// given size, hashed into a table about twice the particle count, so memory
+// does not depend on how far the particles spread. Every build() bins all
+// particles from scratch with a counting sort: one pass counts particles
+// per bucket, a prefix sum turns counts into offsets and a second pass
+// places the particles, so a bucket's particles end up contiguous. Each
+// entry carries a copy of the particle's position and cell, so a query
+// touches one cache line per candidate.
+//
+// A query visits the 27 cells around a point. The hash is linear in the z
+// cell coordinate, so each column of three cells is one contiguous run of
+// buckets and a query reads 9 ranges instead of 27. Different cells can
+// land in the same bucket, so each candidate also carries its cell
+// coordinates and is only reported if it is in one of the 27 cells.
+class SpatialHash
+{
+public:
+	SpatialHash():m_cellSize(1), m_mask(0){}
+
+	// bins the positions of state; cell coordinates are computed on pool
+	void build(const ParticleState &state, float cellSize, ThreadPool &pool);
+
+	// calls visitor(j, dx, dy, dz, d2) for every binned particle j != i with
+	// p_i - p_j = (dx, dy, dz) and squared distance d2 < radius^2; radius
+	// must not exceed the cell size. Safe to call concurrently.
+	template <class Visitor>
+	void forNeighbors(int i, float radius, Visitor &visitor) const
+	{
+		const Entry &p = m_sorted[m_slot[i]];
+		const int cx = p.cx, cy = p.cy, cz = p.cz;
+		const float r2 = radius * radius;
+
+		for (int ox = -1; ox <= 1; ox++)
+			for (int oy = -1; oy <= 1; oy++)
+			{
+				int x = cx + ox, y = cy + oy;
+				unsigned int first = hash(x, y, cz - 1);
+
+				// buckets of cells z-1, z, z+1, unless the run wraps around
+				int runs[2][2] = {{m_bucketStart[first], 0}, {0, 0}};
+				if (first + 3 <= m_mask + 1)
+					runs[0][1] = m_bucketStart[first + 3];
+				else
+				{
+					runs[0][1] = m_bucketStart[m_mask + 1];
+					runs[1][1] = m_bucketStart[first + 3 - (m_mask + 1)];
+				}
+
+				for (int r = 0; r < 2; r++)
+					for (int k = runs[r][0]; k < runs[r][1]; k++)
+					{
+						const Entry &q = m_sorted[k];
+						if (q.cx != x || q.cy != y || (unsigned int)(q.cz - cz + 1) > 2u || q.particle == i)
+							continue;
+
+						float dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+						float d2 = dx*dx + dy*dy + dz*dz;
+						if (d2 < r2)
+							visitor(q.particle, dx, dy, dz, d2);
+					}
+			}
+	}
+
+	int numBuckets() const { return (int)m_bucketStart.size() - 1; }
+
+private:
+	unsigned int hash(int x, int y, int z) const
+	{
+		return (((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u) + (unsigned int)z) & m_mask;
+	}
+
+	struct Entry
+	{
+		float x, y, z;
+		int cx, cy, cz;
+		int particle;
+		unsigned int bucket;
+	};
+
+	class CellTask;
+
+	float m_cellSize;
+	unsigned int m_mask;
+
+	vector<int> m_bucketStart;	// numBuckets + 1 offsets into the sorted arrays
+
+	vector<Entry> m_entries;	// per particle
+	vector<Entry> m_sorted;		// by bucket
+	vector<int> m_slot;			// per particle, index into m_sorted
+};
+
+#endif
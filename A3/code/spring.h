@@ -21,7 +21,7 @@ public:
 		stiff = stiffness;
 	}
 
-	Vector3f getForce(Vector3f p_i, Vector3f p_j) {
+	Vector3f getForce(const Vector3f &p_i, const Vector3f &p_j) const {
 		Vector3f d = p_i - p_j;
 		return -stiff * (d.abs() - len) * d / d.abs();
 	}
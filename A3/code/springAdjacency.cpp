@@ -0,0 +1,162 @@
+#include "springAdjacency.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// spreads the low 10 bits of v so that two zero bits follow each one
+	unsigned int spreadBits(unsigned int v)
+	{
+		v &= 0x3ff;
+		v = (v | (v << 16)) & 0x030000ff;
+		v = (v | (v << 8)) & 0x0300f00f;
+		v = (v | (v << 4)) & 0x030c30c3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	// position quantized to 10 bits per axis inside [lo, lo + size]
+	unsigned int mortonKey(const Vector3f &p, const Vector3f &lo, const Vector3f &size)
+	{
+		unsigned int key = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float t = size[axis] > 0 ? (p[axis] - lo[axis]) / size[axis] : 0;
+			unsigned int q = (unsigned int)(t * 1023.0f + 0.5f);
+			key |= spreadBits(q) << axis;
+		}
+		return key;
+	}
+}
+
+void SpringAdjacency::build(const vector<Spring> &springs, const ParticleState &state)
+{
+	int n = state.size();
+
+	// space-filling row order
+	Vector3f lo = n > 0 ? state.position(0) : Vector3f::ZERO, hi = lo;
+	for (int i = 1; i < n; i++)
+	{
+		Vector3f p = state.position(i);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = min(lo[axis], p[axis]);
+			hi[axis] = max(hi[axis], p[axis]);
+		}
+	}
+
+	vector<pair<unsigned int, int> > keys(n);
+	for (int i = 0; i < n; i++)
+		keys[i] = make_pair(mortonKey(state.position(i), lo, hi - lo), i);
+	sort(keys.begin(), keys.end());
+
+	m_order.resize(n);
+	m_rowOf.resize(n);
+	vector<int> &rowOf = m_rowOf;
+	for (int r = 0; r < n; r++)
+	{
+		m_order[r] = keys[r].second;
+		rowOf[keys[r].second] = r;
+	}
+
+	// count the springs of every row, then fill the rows in spring order
+	m_rowStart.assign(n + 1, 0);
+	for (size_t s = 0; s < springs.size(); s++)
+	{
+		m_rowStart[rowOf[springs[s].i] + 1]++;
+		m_rowStart[rowOf[springs[s].j] + 1]++;
+	}
+	for (int r = 0; r < n; r++)
+		m_rowStart[r + 1] += m_rowStart[r];
+
+	int entries = m_rowStart[n];
+	m_neighbor.resize(entries);
+	m_spring.resize(entries);
+	m_restLength.resize(entries);
+	m_stiffness.resize(entries);
+
+	vector<int> next(m_rowStart.begin(), m_rowStart.end() - 1);
+	for (size_t s = 0; s < springs.size(); s++)
+	{
+		const Spring &spring = springs[s];
+		int ends[2] = {spring.i, spring.j};
+		for (int e = 0; e < 2; e++)
+		{
+			int k = next[rowOf[ends[e]]]++;
+			m_neighbor[k] = ends[1 - e];
+			m_spring[k] = (int)s;
+			m_restLength[k] = spring.len;
+			m_stiffness[k] = spring.stiff;
+		}
+	}
+
+	m_rowEnd.assign(m_rowStart.begin() + 1, m_rowStart.end());
+	m_numSprings = springs.size();
+}
+
+void SpringAdjacency::eraseEntry(int row, int s)
+{
+	int e = m_rowStart[row];
+	while (m_spring[e] != s)
+		e++;
+
+	int last = --m_rowEnd[row];
+	m_neighbor[e] = m_neighbor[last];
+	m_spring[e] = m_spring[last];
+	m_restLength[e] = m_restLength[last];
+	m_stiffness[e] = m_stiffness[last];
+}
+
+void SpringAdjacency::renumberEntry(int row, int from, int to)
+{
+	int e = m_rowStart[row];
+	while (m_spring[e] != from)
+		e++;
+	m_spring[e] = to;
+}
+
+void SpringAdjacency::remove(int s, const vector<Spring> &springs)
+{
+	int last = (int)springs.size() - 1;
+	eraseEntry(m_rowOf[springs[s].i], s);
+	eraseEntry(m_rowOf[springs[s].j], s);
+	if (last != s)
+	{
+		renumberEntry(m_rowOf[springs[last].i], last, s);
+		renumberEntry(m_rowOf[springs[last].j], last, s);
+	}
+	m_numSprings--;
+}
+
+void SpringAdjacency::gatherForces(const ParticleState &state, ParticleState &f, float mass, int begin, int end,
+	const char *asleep) const
+{
+	const float *x = state.pos(0), *y = state.pos(1), *z = state.pos(2);
+	float *dvx = f.vel(0), *dvy = f.vel(1), *dvz = f.vel(2);
+
+	for (int r = begin; r < end; r++)
+	{
+		int i = m_order[r];
+		if (asleep && asleep[i])
+			continue;
+		float Fx = 0, Fy = 0, Fz = 0;
+
+		for (int e = m_rowStart[r]; e < m_rowEnd[r]; e++)
+		{
+			int j = m_neighbor[e];
+
+			// same arithmetic as the scatter loop, seen from particle i
+			float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+			float d = sqrtf(dx*dx + dy*dy + dz*dz);
+			float k = -m_stiffness[e] * (d - m_restLength[e]);
+			Fx += k * dx / d / mass;
+			Fy += k * dy / d / mass;
+			Fz += k * dz / d / mass;
+		}
+
+		dvx[i] += Fx;
+		dvy[i] += Fy;
+		dvz[i] += Fz;
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef SPRINGADJACENCY_H
+#define SPRINGADJACENCY_H
+
+#include <vector>
+
+#include "spring.h"
+#include "particleState.h"
+
+using namespace std;
+
+// Particle-to-spring adjacency in compressed sparse row form: row r lists
+// every spring incident on particle particleOf(r), together with the
+// particle at its other end. Each particle can then gather its spring
+// forces without writing anywhere else, so rows can be evaluated in any
+// order and on any number of threads. The spring index of every entry is
+// kept so the same structure can drive per-spring work such as Jacobian
+// assembly.
+//
+// Rows follow a Morton (Z-order) curve through the particle positions the
+// adjacency was built with, so consecutive rows, and the chunks of rows a
+// thread takes, touch particles that are close in space. Rest length and
+// stiffness are copied into every entry to keep the gather loop on
+// contiguous arrays.
+//
+// Springs can be removed in place (see remove): a row keeps its start and
+// gives up its last entry, so the rows no longer tile the entry arrays.
+class SpringAdjacency
+{
+public:
+	SpringAdjacency():m_numSprings(0){}
+
+	void build(const vector<Spring> &springs, const ParticleState &state);
+
+	// true if built for this many springs and particles
+	bool matches(size_t numSprings, int numParticles) const
+	{
+		return m_numSprings == numSprings && (int)m_order.size() == numParticles && numParticles > 0;
+	}
+
+	int numRows() const { return (int)m_order.size(); }
+	int particleOf(int row) const { return m_order[row]; }
+
+	// entries of row r are [rowStart(r), rowEnd(r))
+	int rowStart(int row) const { return m_rowStart[row]; }
+	int rowEnd(int row) const { return m_rowEnd[row]; }
+	int neighbor(int entry) const { return m_neighbor[entry]; }
+	int spring(int entry) const { return m_spring[entry]; }
+
+	// adds the spring forces / mass of rows [begin, end) to f's velocity
+	// arrays, skipping the particles asleep is set for if it is given
+	void gatherForces(const ParticleState &state, ParticleState &f, float mass, int begin, int end,
+		const char *asleep = 0) const;
+
+	// follows springs through the removal of spring s, which moves the last
+	// spring into its place; call before springs itself changes. Costs the
+	// rows of the four particles involved.
+	void remove(int s, const vector<Spring> &springs);
+
+private:
+	// the entry of spring s in row, moved over by the row's last entry
+	void eraseEntry(int row, int s);
+
+	// the entry of spring from in row, renumbered to spring to
+	void renumberEntry(int row, int from, int to);
+
+	vector<int> m_order;		// row -> particle
+	vector<int> m_rowOf;		// particle -> row
+	vector<int> m_rowStart;		// numRows + 1 offsets
+	vector<int> m_rowEnd;		// per row, one past its last entry
+	vector<int> m_neighbor;		// per entry, particle at the other end
+	vector<int> m_spring;		// per entry, index into the springs
+	vector<float> m_restLength;	// per entry
+	vector<float> m_stiffness;	// per entry
+	size_t m_numSprings;
+};
+
+#endif
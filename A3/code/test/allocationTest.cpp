@@ -0,0 +1,120 @@
+// Steady-state stepping must not touch the heap. Every system is stepped
+// through every integrator the viewer offers: after a warm-up the state is
+// kept, a stretch of steps is taken, and then the same stretch is taken
+// again from the kept state under a counting operator new. The buffers
+// have grown for exactly those steps by then (a cloth that comes to touch
+// more of itself needs more room for its contacts), so whatever the replay
+// allocates, every step would. Exits nonzero on any allocation.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "TimeStepper.hpp"
+#include "simpleSystem.h"
+#include "pendulumSystem.h"
+#include "ClothSystem.h"
+
+namespace
+{
+	// allocations while counting is on, from any thread
+	int counting = 0;
+	int allocations = 0;
+
+	const int warmupSteps = 20;
+	const int countedSteps = 20;
+	const float stepSize = 0.005f;
+
+	const char steppers[] = "etrsvdixp";
+
+	ParticleSystem *makeSystem(int kind)
+	{
+		switch (kind)
+		{
+		case 0: return new SimpleSystem();
+		case 1: return new PendulumSystem(4);
+		default: return new ClothSystem(20, 20);
+		}
+	}
+
+	const char *systemName(int kind)
+	{
+		return kind == 0 ? "simple" : (kind == 1 ? "pendulum" : "cloth");
+	}
+
+	// as the simulation thread steps a system
+	void step(ParticleSystem *system, TimeStepper *stepper)
+	{
+		system->beginStep(stepSize);
+		stepper->takeStep(system, stepSize);
+		system->endStep(stepSize);
+	}
+}
+
+void *operator new(size_t size) throw(std::bad_alloc)
+{
+	if (__atomic_load_n(&counting, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == 0)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+// not inlined, so the compiler does not pair a free with the new
+// expressions of this file
+__attribute__((noinline)) void operator delete(void *p) throw()
+{
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) throw()
+{
+	free(p);
+}
+
+int main()
+{
+	int failures = 0;
+	for (int kind = 0; kind < 3; kind++)
+		for (const char *name = steppers; *name != 0; name++)
+		{
+			ParticleSystem *system = makeSystem(kind);
+			TimeStepper *stepper = makeTimeStepper(*name);
+
+			for (int k = 0; k < warmupSteps; k++)
+				step(system, stepper);
+			ParticleState kept = system->getParticleState();
+			for (int k = 0; k < countedSteps; k++)
+				step(system, stepper);
+			system->getParticleState() = kept;
+			system->invalidate_derivative();
+
+			allocations = 0;
+			__atomic_store_n(&counting, 1, __ATOMIC_SEQ_CST);
+			for (int k = 0; k < countedSteps; k++)
+				step(system, stepper);
+			__atomic_store_n(&counting, 0, __ATOMIC_SEQ_CST);
+			int counted = __atomic_load_n(&allocations, __ATOMIC_SEQ_CST);
+
+			printf("%-8s %c: %d allocations in %d steps\n", systemName(kind), *name, counted, countedSteps);
+			if (counted > 0)
+				failures++;
+
+			delete stepper;
+			delete system;
+		}
+
+	if (failures > 0)
+	{
+		printf("FAILED: %d system and stepper pairs allocate while stepping\n", failures);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include "threadPool.h"
+
+#include <unistd.h>
+
+ThreadPool::ThreadPool(int numThreads)
+	:m_generation(0), m_busy(0), m_quit(false), m_task(0), m_end(0), m_grain(1), m_next(0)
+{
+	if (numThreads <= 0)
+		numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads < 1)
+		numThreads = 1;
+
+	pthread_mutex_init(&m_mutex, 0);
+	pthread_cond_init(&m_start, 0);
+	pthread_cond_init(&m_done, 0);
+
+	m_workers.resize(numThreads - 1);
+	for (size_t t = 0; t < m_workers.size(); t++)
+		pthread_create(&m_workers[t], 0, &ThreadPool::workerMain, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	pthread_mutex_lock(&m_mutex);
+	m_quit = true;
+	pthread_cond_broadcast(&m_start);
+	pthread_mutex_unlock(&m_mutex);
+
+	for (size_t t = 0; t < m_workers.size(); t++)
+		pthread_join(m_workers[t], 0);
+
+	pthread_cond_destroy(&m_done);
+	pthread_cond_destroy(&m_start);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+ThreadPool &ThreadPool::global()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::parallelFor(int begin, int end, ParallelTask &task, int grain)
+{
+	if (grain < 1)
+		grain = 1;
+	if (m_workers.empty() || end - begin <= grain)
+	{
+		if (begin < end)
+			task.run(begin, end);
+		return;
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	m_task = &task;
+	m_end = end;
+	m_grain = grain;
+	m_next = begin;
+	m_busy = (int)m_workers.size();
+	m_generation++;
+	pthread_cond_broadcast(&m_start);
+	pthread_mutex_unlock(&m_mutex);
+
+	runChunks();
+
+	pthread_mutex_lock(&m_mutex);
+	while (m_busy > 0)
+		pthread_cond_wait(&m_done, &m_mutex);
+	m_task = 0;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void *ThreadPool::workerMain(void *self)
+{
+	static_cast<ThreadPool *>(self)->workerLoop();
+	return 0;
+}
+
+void ThreadPool::workerLoop()
+{
+	int seen = 0;
+
+	pthread_mutex_lock(&m_mutex);
+	for (;;)
+	{
+		while (m_generation == seen && !m_quit)
+			pthread_cond_wait(&m_start, &m_mutex);
+		if (m_quit)
+			break;
+		seen = m_generation;
+		pthread_mutex_unlock(&m_mutex);
+
+		runChunks();
+
+		pthread_mutex_lock(&m_mutex);
+		if (--m_busy == 0)
+			pthread_cond_signal(&m_done);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void ThreadPool::runChunks()
+{
+	for (;;)
+	{
+		int begin = __atomic_fetch_add(&m_next, m_grain, __ATOMIC_RELAXED);
+		if (begin >= m_end)
+			break;
+		int end = begin + m_grain < m_end ? begin + m_grain : m_end;
+		m_task->run(begin, end);
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+// A loop body for ThreadPool::parallelFor: run() handles the indices in
+// [begin, end) and may be called concurrently for disjoint ranges.
+class ParallelTask
+{
+public:
+	virtual ~ParallelTask(){}
+	virtual void run(int begin, int end) = 0;
+};
+
+// Fixed set of worker threads for data-parallel loops. parallelFor() splits
+// an index range into chunks of grain indices that the workers and the
+// calling thread take dynamically, and returns when all of them are done,
+// so consecutive calls act as barriers.
+//
+// Only one thread may call parallelFor() on a pool at a time.
+class ThreadPool
+{
+public:
+	// numThreads counts the calling thread; 0 means one per online core
+	explicit ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	int size() const { return (int)m_workers.size() + 1; }
+
+	void parallelFor(int begin, int end, ParallelTask &task, int grain = 1024);
+
+	// pool shared by the particle systems
+	static ThreadPool &global();
+
+private:
+	static void *workerMain(void *self);
+	void workerLoop();
+	void runChunks();
+
+	vector<pthread_t> m_workers;
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_start;
+	pthread_cond_t m_done;
+	int m_generation;	// incremented for every parallelFor
+	int m_busy;			// workers still in the current one
+	bool m_quit;
+
+	// the current loop
+	ParallelTask *m_task;
+	int m_end, m_grain;
+	int m_next;			// first index not yet taken, atomic
+};
+
+#endif
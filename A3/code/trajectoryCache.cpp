@@ -0,0 +1,305 @@
+#include "trajectoryCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	const char magic[8] = {'A', '3', 'T', 'R', 'A', 'J', '0', '1'};
+	const size_t fileHeaderBytes = 16;	// magic, particle count, step size
+	const size_t frameHeaderBytes = 32;	// bytes, key, lo, hi
+
+	unsigned char *putVarint(unsigned char *out, unsigned int z)
+	{
+		while (z >= 0x80)
+		{
+			*out++ = (unsigned char)(z | 0x80);
+			z >>= 7;
+		}
+		*out++ = (unsigned char)z;
+		return out;
+	}
+
+	// 0 at the end of the data
+	const unsigned char *getVarint(const unsigned char *in, const unsigned char *end, unsigned int &z)
+	{
+		z = 0;
+		for (int shift = 0; in < end && shift < 32; shift += 7)
+		{
+			unsigned char b = *in++;
+			z |= (unsigned int)(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return in;
+		}
+		return 0;
+	}
+}
+
+TrajectoryWriter::TrajectoryWriter()
+	:m_file(0), m_numParticles(0), m_frames(0), m_closing(false), m_head(0), m_count(0), m_written(0)
+{
+	pthread_mutex_init(&m_mutex, 0);
+	pthread_cond_init(&m_changed, 0);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	close();
+	pthread_cond_destroy(&m_changed);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+bool TrajectoryWriter::open(const char *path, int numParticles, float stepSize)
+{
+	close();
+
+	m_file = fopen(path, "wb");
+	if (m_file == 0)
+		return false;
+
+	int count = numParticles;
+	fwrite(magic, 1, sizeof(magic), m_file);
+	fwrite(&count, sizeof(count), 1, m_file);
+	fwrite(&stepSize, sizeof(stepSize), 1, m_file);
+
+	m_numParticles = numParticles;
+	m_frames = m_written = 0;
+	m_head = m_count = 0;
+	m_closing = false;
+	m_previous.assign(3 * numParticles, 0);
+	m_record.resize(frameHeaderBytes + 3 * 3 * numParticles);
+
+	pthread_create(&m_thread, 0, &TrajectoryWriter::run, this);
+	return true;
+}
+
+void TrajectoryWriter::record(const float *positions)
+{
+	if (m_file == 0)
+		return;
+
+	pthread_mutex_lock(&m_mutex);
+	while (m_count == queueDepth)
+		pthread_cond_wait(&m_changed, &m_mutex);
+	vector<float> &slot = m_slots[(m_head + m_count) % queueDepth];
+	pthread_mutex_unlock(&m_mutex);
+
+	// the writer does not touch slots outside the queue
+	slot.assign(positions, positions + 3 * m_numParticles);
+
+	pthread_mutex_lock(&m_mutex);
+	m_count++;
+	m_frames++;
+	pthread_cond_broadcast(&m_changed);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void TrajectoryWriter::close()
+{
+	if (m_file == 0)
+		return;
+
+	pthread_mutex_lock(&m_mutex);
+	m_closing = true;
+	pthread_cond_broadcast(&m_changed);
+	pthread_mutex_unlock(&m_mutex);
+	pthread_join(m_thread, 0);
+
+	fclose(m_file);
+	m_file = 0;
+}
+
+void *TrajectoryWriter::run(void *self)
+{
+	static_cast<TrajectoryWriter *>(self)->loop();
+	return 0;
+}
+
+void TrajectoryWriter::loop()
+{
+	while (true)
+	{
+		pthread_mutex_lock(&m_mutex);
+		while (m_count == 0 && !m_closing)
+			pthread_cond_wait(&m_changed, &m_mutex);
+		if (m_count == 0)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			break;
+		}
+		const vector<float> &slot = m_slots[m_head];
+		pthread_mutex_unlock(&m_mutex);
+
+		encode(&slot[0], m_written % keyInterval == 0);
+		m_written++;
+
+		pthread_mutex_lock(&m_mutex);
+		m_head = (m_head + 1) % queueDepth;
+		m_count--;
+		pthread_cond_broadcast(&m_changed);
+		pthread_mutex_unlock(&m_mutex);
+	}
+	fflush(m_file);
+}
+
+void TrajectoryWriter::encode(const float *positions, bool key)
+{
+	int n = m_numParticles;
+	float lo[3], hi[3];
+	unsigned char *out = &m_record[frameHeaderBytes];
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float *x = positions + axis * n;
+		unsigned short *previous = n > 0 ? &m_previous[axis * n] : 0;
+
+		// box of the finite values; anything else quantizes to lo
+		lo[axis] = 1e30f;
+		hi[axis] = -1e30f;
+		for (int i = 0; i < n; i++)
+			if (x[i] > -1e30f && x[i] < 1e30f)
+			{
+				lo[axis] = min(lo[axis], x[i]);
+				hi[axis] = max(hi[axis], x[i]);
+			}
+		if (lo[axis] > hi[axis])
+			lo[axis] = hi[axis] = 0;
+
+		float scale = hi[axis] > lo[axis] ? 65535 / (hi[axis] - lo[axis]) : 0;
+		for (int i = 0; i < n; i++)
+		{
+			float t = (x[i] - lo[axis]) * scale;
+			unsigned short q = t > 0 ? (t < 65535 ? (unsigned short)(t + 0.5f) : 65535) : 0;
+			short d = (short)(unsigned short)(q - (key ? 0 : previous[i]));
+			out = putVarint(out, (unsigned short)((d << 1) ^ (d >> 15)));
+			previous[i] = q;
+		}
+	}
+
+	unsigned int header[2];
+	header[0] = (unsigned int)(out - &m_record[0]);
+	header[1] = key ? 1 : 0;
+	memcpy(&m_record[0], header, sizeof(header));
+	memcpy(&m_record[8], lo, sizeof(lo));
+	memcpy(&m_record[20], hi, sizeof(hi));
+	fwrite(&m_record[0], 1, header[0], m_file);
+}
+
+TrajectoryReader::TrajectoryReader()
+	:m_data(0), m_size(0), m_numParticles(0), m_stepSize(0), m_decoded(-1)
+{
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+	close();
+}
+
+bool TrajectoryReader::open(const char *path)
+{
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && (size_t)info.st_size >= fileHeaderBytes)
+		data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);	// the mapping stays
+	if (data == MAP_FAILED)
+		return false;
+
+	m_data = (const unsigned char *)data;
+	m_size = info.st_size;
+	int count;
+	memcpy(&count, m_data + 8, sizeof(count));
+	memcpy(&m_stepSize, m_data + 12, sizeof(m_stepSize));
+	if (memcmp(m_data, magic, sizeof(magic)) != 0 || count < 0)
+	{
+		close();
+		return false;
+	}
+	m_numParticles = count;
+	m_values.assign(3 * count, 0);
+
+	// index the complete records
+	size_t at = fileHeaderBytes;
+	while (at + frameHeaderBytes <= m_size)
+	{
+		unsigned int bytes;
+		memcpy(&bytes, m_data + at, sizeof(bytes));
+		if (bytes < frameHeaderBytes || bytes > m_size - at)
+			break;
+		m_offsets.push_back(at);
+		at += bytes;
+	}
+	return true;
+}
+
+void TrajectoryReader::close()
+{
+	if (m_data != 0)
+		munmap((void *)m_data, m_size);
+	m_data = 0;
+	m_size = 0;
+	m_numParticles = 0;
+	m_offsets.clear();
+	m_decoded = -1;
+}
+
+void TrajectoryReader::frame(int k, float *positions)
+{
+	if (k != m_decoded)
+	{
+		// decode forward from the last key frame at or before k, or from
+		// the frame decoded last if that is closer
+		int start = k;
+		while (start > 0 && start != m_decoded + 1)
+		{
+			unsigned int key;
+			memcpy(&key, m_data + m_offsets[start] + 4, sizeof(key));
+			if (key)
+				break;
+			start--;
+		}
+		for (int f = start; f <= k; f++)
+			decode(f);
+	}
+
+	float lo[3], hi[3];
+	memcpy(lo, m_data + m_offsets[k] + 8, sizeof(lo));
+	memcpy(hi, m_data + m_offsets[k] + 20, sizeof(hi));
+	int n = m_numParticles;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float step = (hi[axis] - lo[axis]) / 65535;
+		const unsigned short *q = n > 0 ? &m_values[axis * n] : 0;
+		float *x = positions + axis * n;
+		for (int i = 0; i < n; i++)
+			x[i] = lo[axis] + q[i] * step;
+	}
+}
+
+void TrajectoryReader::decode(int k)
+{
+	const unsigned char *record = m_data + m_offsets[k];
+	unsigned int header[2];
+	memcpy(header, record, sizeof(header));
+	const unsigned char *in = record + frameHeaderBytes, *end = record + header[0];
+
+	unsigned short *q = m_values.empty() ? 0 : &m_values[0];
+	for (int v = 0; v < 3 * m_numParticles; v++)
+	{
+		unsigned int z = 0;
+		if (in != 0)
+			in = getVarint(in, end, z);	// a damaged record leaves the rest unchanged
+		unsigned short d = (unsigned short)((z >> 1) ^ -(int)(z & 1));
+		q[v] = (unsigned short)((header[1] ? 0 : q[v]) + d);
+	}
+	m_decoded = k;
+}
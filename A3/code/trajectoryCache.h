@@ -0,0 +1,103 @@
+#ifndef TRAJECTORYCACHE_H
+#define TRAJECTORYCACHE_H
+
+#include <pthread.h>
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+// Binary cache of particle positions over time, for reviewing long runs
+// without simulating them again. A file is a header (magic, particle count,
+// step size) followed by one record per frame:
+//
+//   uint32 bytes, uint32 key, float lo[3], float hi[3], payload
+//
+// Every coordinate is quantized to 16 bits within the frame's bounding box
+// lo..hi. For the x, y and then z arrays, the payload holds each quantized
+// value's difference from the previous frame's (from 0 in key frames, one
+// every keyInterval frames) as a zigzag varint, so a particle that barely
+// moves costs a byte per axis. A record cut short by a crash is ignored
+// when reading.
+
+// Streams frames to a cache. record() only copies the positions into a
+// queue; quantizing, encoding and writing happen on the writer's own thread.
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter();
+	~TrajectoryWriter();
+
+	// starts a cache of numParticles particles; false if the file cannot
+	// be created
+	bool open(const char *path, int numParticles, float stepSize);
+
+	// queues a frame of 3n positions laid out like ParticleState's position
+	// arrays; waits only if the writer is queueDepth frames behind
+	void record(const float *positions);
+
+	// writes out the queued frames and closes the file
+	void close();
+
+	bool isOpen() const { return m_file != 0; }
+	int getNumParticles() const { return m_numParticles; }
+	int getFrames() const { return m_frames; }
+
+	enum { queueDepth = 8, keyInterval = 64 };
+
+private:
+	static void *run(void *self);
+	void loop();
+	void encode(const float *positions, bool key);
+
+	FILE *m_file;
+	int m_numParticles;
+	int m_frames;	// recorded so far
+
+	pthread_t m_thread;
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_changed;	// a frame was queued or written, or closing
+	bool m_closing;
+
+	// ring of frames; [m_head, m_head + m_count) are queued
+	vector<float> m_slots[queueDepth];
+	int m_head, m_count;
+
+	// writer thread only
+	vector<unsigned short> m_previous;	// quantized values of the last frame
+	vector<unsigned char> m_record;
+	int m_written;
+};
+
+// Reads a cache through a read-only mapping of the file.
+class TrajectoryReader
+{
+public:
+	TrajectoryReader();
+	~TrajectoryReader();
+
+	// false if the file is missing or not a cache
+	bool open(const char *path);
+	void close();
+
+	int getNumParticles() const { return m_numParticles; }
+	float getStepSize() const { return m_stepSize; }
+	int getFrames() const { return (int)m_offsets.size(); }
+
+	// decodes frame k into 3n positions laid out like ParticleState's
+	// position arrays; cheapest for the frame after the one decoded last
+	void frame(int k, float *positions);
+
+private:
+	void decode(int k);
+
+	const unsigned char *m_data;
+	size_t m_size;
+	int m_numParticles;
+	float m_stepSize;
+	vector<size_t> m_offsets;	// of each frame's record
+	vector<unsigned short> m_values;	// quantized values of frame m_decoded
+	int m_decoded;
+};
+
+#endif
@@ -0,0 +1,332 @@
+#include "triangleBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// orders triangle indices by one coordinate of their centroids
+	class CentroidLess
+	{
+	public:
+		CentroidLess(const vector<float> &centroids, int axis):m_centroids(centroids), m_axis(axis){}
+
+		bool operator()(int a, int b) const
+		{
+			return m_centroids[3*a + m_axis] < m_centroids[3*b + m_axis];
+		}
+
+	private:
+		const vector<float> &m_centroids;
+		int m_axis;
+	};
+
+	const int leafSize = 4;
+
+	const float pi = 3.14159265f;
+
+	// angle between two unit vectors, safe against rounding past +-1
+	inline float angleBetween(const float *a, const float *b)
+	{
+		float c = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+		return acos(c > 1 ? 1 : (c < -1 ? -1 : c));
+	}
+
+	// normalizes v in place; false if it is too short to have a direction
+	inline bool normalize(float *v)
+	{
+		float length = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+		if (length <= 1e-12f)
+			return false;
+		v[0] /= length; v[1] /= length; v[2] /= length;
+		return true;
+	}
+
+	// area-weighted normal of triangle t, (b - a) x (c - a)
+	inline void triangleNormal(const float *const x[3], const int *t, float *n)
+	{
+		float e1[3], e2[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			e1[axis] = x[axis][t[1]] - x[axis][t[0]];
+			e2[axis] = x[axis][t[2]] - x[axis][t[0]];
+		}
+		n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+		n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+		n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+	}
+
+	int findRoot(vector<int> &parent, int k)
+	{
+		while (parent[k] != k)
+			k = parent[k] = parent[parent[k]];
+		return k;
+	}
+}
+
+void TriangleBVH::build(const vector<int> &triangles, const ParticleState &state)
+{
+	m_triangles = triangles;
+	int n = (int)triangles.size() / 3;
+
+	vector<float> centroids(3 * n);
+	for (int t = 0; t < n; t++)
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float *x = state.pos(axis);
+			centroids[3*t + axis] = (x[triangles[3*t]] + x[triangles[3*t + 1]] + x[triangles[3*t + 2]]) / 3;
+		}
+
+	m_order.resize(n);
+	for (int t = 0; t < n; t++)
+		m_order[t] = t;
+
+	m_stamp.assign(state.size(), -1);
+	m_touched.resize(state.size());
+
+	m_nodes.clear();
+	m_nodes.reserve(n > 0 ? 2 * ((n + leafSize - 1) / leafSize) : 0);
+	if (n > 0)
+		buildNode(0, n, centroids);
+
+	refit(state, 0);
+}
+
+int TriangleBVH::buildNode(int first, int count, const vector<float> &centroids)
+{
+	int index = (int)m_nodes.size();
+	m_nodes.push_back(Node());
+
+	if (count <= leafSize)
+	{
+		m_nodes[index].first = first;
+		m_nodes[index].count = count;
+		m_nodes[index].left = m_nodes[index].right = -1;
+		m_nodes[index].connected = isConnected(index, first, count);
+		return index;
+	}
+
+	// split at the median along the axis the centroids spread most
+	float lo[3], hi[3];
+	for (int axis = 0; axis < 3; axis++)
+		lo[axis] = hi[axis] = centroids[3*m_order[first] + axis];
+	for (int k = first + 1; k < first + count; k++)
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = min(lo[axis], centroids[3*m_order[k] + axis]);
+			hi[axis] = max(hi[axis], centroids[3*m_order[k] + axis]);
+		}
+
+	int axis = 0;
+	for (int a = 1; a < 3; a++)
+		if (hi[a] - lo[a] > hi[axis] - lo[axis])
+			axis = a;
+
+	int half = count / 2;
+	nth_element(m_order.begin() + first, m_order.begin() + first + half,
+	            m_order.begin() + first + count, CentroidLess(centroids, axis));
+
+	int left = buildNode(first, half, centroids);
+	int right = buildNode(first + half, count - half, centroids);
+
+	m_nodes[index].first = first;
+	m_nodes[index].count = 0;
+	m_nodes[index].left = left;
+	m_nodes[index].right = right;
+	m_nodes[index].connected = isConnected(index, first, count);
+	return index;
+}
+
+// true if triangles m_order[first, first + count) are joined into one patch
+// through shared particles; the topology never changes, so this is only
+// asked once per node
+bool TriangleBVH::isConnected(int index, int first, int count)
+{
+	m_parent.resize(count);
+	for (int k = 0; k < count; k++)
+		m_parent[k] = k;
+
+	int components = count;
+	for (int k = 0; k < count; k++)
+		for (int v = 0; v < 3; v++)
+		{
+			int p = m_triangles[3*m_order[first + k] + v];
+			if (m_stamp[p] != index)
+			{
+				m_stamp[p] = index;
+				m_touched[p] = k;
+				continue;
+			}
+
+			int a = findRoot(m_parent, k), b = findRoot(m_parent, m_touched[p]);
+			if (a != b)
+			{
+				m_parent[a] = b;
+				components--;
+			}
+		}
+
+	return components == 1;
+}
+
+void TriangleBVH::save(CheckpointWriter &out) const
+{
+	out.putVector("bvh.nodes", m_nodes);
+	out.putVector("bvh.order", m_order);
+}
+
+bool TriangleBVH::restore(const CheckpointReader &in, const vector<int> &triangles)
+{
+	vector<Node> nodes;
+	vector<int> order;
+	int n = (int)triangles.size() / 3;
+	if (!in.getVector("bvh.nodes", nodes) || !in.getVector("bvh.order", order) ||
+	    (int)order.size() != n || nodes.empty() != (n == 0))
+		return false;
+
+	vector<char> seen(n, 0);
+	for (int k = 0; k < n; k++)
+	{
+		if (order[k] < 0 || order[k] >= n || seen[order[k]])
+			return false;
+		seen[order[k]] = 1;
+	}
+
+	// children after their parent, leaves within the order and no larger
+	// than refit expects
+	int count = (int)nodes.size();
+	for (int index = 0; index < count; index++)
+	{
+		const Node &node = nodes[index];
+		if (node.count > 0 ? node.count > leafSize || node.first < 0 || node.first > n - node.count
+		                   : node.count < 0 || node.left <= index || node.left >= count ||
+		                     node.right <= index || node.right >= count)
+			return false;
+	}
+
+	m_triangles = triangles;
+	m_nodes.swap(nodes);
+	m_order.swap(order);
+	return true;
+}
+
+void TriangleBVH::overlappingLeaves(vector<pair<int, int> > &pairs, float flatAngle)
+{
+	pairs.clear();
+	if (m_nodes.empty())
+		return;
+
+	vector<pair<int, int> > &stack = m_stack;
+	stack.clear();
+	stack.push_back(make_pair(0, 0));
+
+	while (!stack.empty())
+	{
+		int a = stack.back().first, b = stack.back().second;
+		stack.pop_back();
+		const Node &A = m_nodes[a], &B = m_nodes[b];
+
+		if (a == b)
+		{
+			// a subtree against itself: both halves, and one against the other
+			if (A.connected && A.angle < flatAngle)
+				continue;
+			if (A.count > 0)
+				pairs.push_back(make_pair(a, a));
+			else
+			{
+				stack.push_back(make_pair(A.left, A.left));
+				stack.push_back(make_pair(A.right, A.right));
+				stack.push_back(make_pair(A.left, A.right));
+			}
+			continue;
+		}
+
+		if (A.lo[0] > B.hi[0] || A.hi[0] < B.lo[0] ||
+			A.lo[1] > B.hi[1] || A.hi[1] < B.lo[1] ||
+			A.lo[2] > B.hi[2] || A.hi[2] < B.lo[2])
+			continue;
+
+		if (A.count > 0 && B.count > 0)
+			pairs.push_back(make_pair(min(a, b), max(a, b)));
+		else if (B.count > 0)
+		{
+			stack.push_back(make_pair(A.left, b));
+			stack.push_back(make_pair(A.right, b));
+		}
+		else
+		{
+			stack.push_back(make_pair(a, B.left));
+			stack.push_back(make_pair(a, B.right));
+		}
+	}
+}
+
+void TriangleBVH::refit(const ParticleState &state, float margin)
+{
+	const float *x[3] = {state.pos(0), state.pos(1), state.pos(2)};
+
+	for (int index = (int)m_nodes.size() - 1; index >= 0; index--)
+	{
+		Node &node = m_nodes[index];
+
+		if (node.count > 0)
+		{
+			float n[leafSize][3], *a = node.axis;
+			a[0] = a[1] = a[2] = 0;
+			for (int k = 0; k < node.count; k++)
+			{
+				triangleNormal(x, &m_triangles[3*m_order[node.first + k]], n[k]);
+				a[0] += n[k][0]; a[1] += n[k][1]; a[2] += n[k][2];
+			}
+
+			// the widest normal sets the half-angle; one acos per leaf
+			float least = -1;
+			if (normalize(a))
+			{
+				least = 1;
+				for (int k = 0; k < node.count && least > -1; k++)
+				{
+					float length = sqrt(n[k][0]*n[k][0] + n[k][1]*n[k][1] + n[k][2]*n[k][2]);
+					float c = length > 1e-12f ? (a[0]*n[k][0] + a[1]*n[k][1] + a[2]*n[k][2]) / length : -1;
+					least = min(least, c);
+				}
+			}
+			node.angle = least <= -1 ? pi : acos(min(least, 1.0f));
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.lo[axis] = node.hi[axis] = x[axis][m_triangles[3*m_order[node.first]]];
+				for (int k = node.first; k < node.first + node.count; k++)
+					for (int v = 0; v < 3; v++)
+					{
+						float c = x[axis][m_triangles[3*m_order[k] + v]];
+						node.lo[axis] = min(node.lo[axis], c);
+						node.hi[axis] = max(node.hi[axis], c);
+					}
+				node.lo[axis] -= margin;
+				node.hi[axis] += margin;
+			}
+		}
+		else
+		{
+			const Node &left = m_nodes[node.left], &right = m_nodes[node.right];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.lo[axis] = min(left.lo[axis], right.lo[axis]);
+				node.hi[axis] = max(left.hi[axis], right.hi[axis]);
+			}
+
+			// the cone around the mean of the child axes that holds both
+			float *a = node.axis;
+			for (int axis = 0; axis < 3; axis++)
+				a[axis] = left.axis[axis] + right.axis[axis];
+
+			if (left.angle >= pi || right.angle >= pi || !normalize(a))
+				node.angle = pi;
+			else
+				node.angle = min(pi, max(angleBetween(a, left.axis) + left.angle,
+				                         angleBetween(a, right.axis) + right.angle));
+		}
+	}
+}
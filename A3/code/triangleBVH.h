@@ -0,0 +1,81 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <vector>
+
+#include "particleState.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+// Bounding volume hierarchy of axis-aligned boxes over the triangles of a
+// particle mesh. The tree is built once for the topology and then only
+// refit to the moving particles: every box is recomputed bottom-up, but no
+// triangle ever changes node. That keeps a step O(triangles) with no
+// allocation, at the price of looser boxes when the mesh deforms a lot.
+//
+// Nodes are stored parent-first, so iterating them backwards visits every
+// child before its parent.
+//
+// Every node also keeps a cone bounding the normals of its triangles
+// (Volino and Magnenat-Thalmann, "Efficient Self-Collision Detection on
+// Smoothly Discretized Surface Animations using Geometrical Shape
+// Regularity"). A connected patch whose normals all lie within a narrow
+// cone cannot fold back onto itself, so the self-traversal skips it.
+class TriangleBVH
+{
+public:
+	struct Node
+	{
+		float lo[3], hi[3];	// adjacent, so lo can be read as one 6-float box
+		int first, count;	// leaves: triangles m_order[first, first + count)
+		int left, right;	// inner nodes: children (count == 0)
+		float axis[3], angle;	// normal cone: unit axis, half-angle in radians
+		bool connected;	// triangles form one patch, joined through shared particles
+	};
+
+	TriangleBVH(){}
+
+	// builds the tree over triangles (3 particle indices each) by splitting
+	// at the median centroid along the longest axis
+	void build(const vector<int> &triangles, const ParticleState &state);
+
+	// recomputes every box and normal cone from the current positions, boxes
+	// grown by margin
+	void refit(const ParticleState &state, float margin);
+
+	// the nodes and leaf order as checkpoint sections; restore takes them
+	// back for the same triangles without building, or is false if they do
+	// not form a tree over them
+	void save(CheckpointWriter &out) const;
+	bool restore(const CheckpointReader &in, const vector<int> &triangles);
+
+	bool empty() const { return m_nodes.empty(); }
+	int numTriangles() const { return (int)m_order.size(); }
+	int numNodes() const { return (int)m_nodes.size(); }
+	const Node &node(int index) const { return m_nodes[index]; }
+
+	// triangle k in leaf order; a leaf holds triangleAt(first .. first + count - 1)
+	int triangleAt(int k) const { return m_order[k]; }
+
+	// all pairs of leaves (a <= b, a leaf paired with itself too) whose boxes
+	// overlap, found by traversing the tree against itself; nothing inside a
+	// connected subtree with a normal cone narrower than flatAngle
+	void overlappingLeaves(vector<pair<int, int> > &pairs, float flatAngle);
+
+private:
+	int buildNode(int first, int count, const vector<float> &centroids);
+	bool isConnected(int index, int first, int count);
+
+	vector<int> m_triangles;	// copy of the triangles built over
+	vector<Node> m_nodes;
+	vector<int> m_order;	// triangle indices, grouped by leaf
+
+	vector<pair<int, int> > m_stack;	// for overlappingLeaves
+
+	// scratch for isConnected: per particle the last node and triangle that
+	// touched it, and a union-find forest over one node's triangles
+	vector<int> m_stamp, m_touched, m_parent;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "triangleMesh.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <GL/glut.h>
+
+namespace
+{
+	inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	// skips blanks, but not the end of the line
+	inline const char *skipBlanks(const char *p)
+	{
+		while (isBlank(*p))
+			p++;
+		return p;
+	}
+}
+
+// The file is read whole and parsed in place with strtod and strtol, which
+// keeps meshes of a million triangles to a fraction of a second.
+bool TriangleMesh::load(const char *path)
+{
+	ifstream in(path, ios::binary);
+	if (!in)
+	{
+		cerr << "Cannot open " << path << endl;
+		return false;
+	}
+	string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+	vertices.clear();
+	faces.clear();
+
+	vector<int> polygon;
+	const char *p = text.c_str();
+	while (*p)
+	{
+		p = skipBlanks(p);
+
+		if (p[0] == 'v' && isBlank(p[1]))
+		{
+			Vector3f v(0, 0, 0);
+			p++;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				p = skipBlanks(p);
+				if (*p == '\n' || *p == 0)
+					break;
+				char *end;
+				v[axis] = (float)strtod(p, &end);
+				if (end == p)
+					break;
+				p = end;
+			}
+			vertices.push_back(v);
+		}
+		else if (p[0] == 'f' && isBlank(p[1]))
+		{
+			// "a", "a/b", "a//c" or "a/b/c"; only a, 1-based, matters
+			polygon.clear();
+			p++;
+			while (true)
+			{
+				p = skipBlanks(p);
+				if (*p == '\n' || *p == 0)
+					break;
+				char *end;
+				int index = (int)strtol(p, &end, 10);
+				if (end == p)
+					break;
+				if (index < 0)
+					index += (int)vertices.size() + 1;
+				polygon.push_back(index - 1);
+
+				p = end;
+				while (*p && *p != '\n' && !isBlank(*p))
+					p++;
+			}
+
+			for (size_t k = 2; k < polygon.size(); k++)
+			{
+				faces.push_back(polygon[0]);
+				faces.push_back(polygon[k - 1]);
+				faces.push_back(polygon[k]);
+			}
+		}
+
+		// on to the next line
+		while (*p && *p != '\n')
+			p++;
+		if (*p)
+			p++;
+	}
+
+	for (size_t k = 0; k < faces.size(); k++)
+		if (faces[k] < 0 || faces[k] >= (int)vertices.size())
+		{
+			cerr << path << ": face refers to missing vertex " << faces[k] + 1 << endl;
+			faces.clear();
+			break;
+		}
+
+	if (faces.empty())
+	{
+		cerr << path << " has no triangles" << endl;
+		return false;
+	}
+
+	computeNormals();
+	return true;
+}
+
+void TriangleMesh::bounds(Vector3f &lo, Vector3f &hi) const
+{
+	lo = hi = vertices.empty() ? Vector3f(0, 0, 0) : vertices[0];
+	for (size_t k = 1; k < vertices.size(); k++)
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = min(lo[axis], vertices[k][axis]);
+			hi[axis] = max(hi[axis], vertices[k][axis]);
+		}
+}
+
+void TriangleMesh::fit(const Vector3f &center, float size)
+{
+	Vector3f lo, hi;
+	bounds(lo, hi);
+
+	Vector3f extent = hi - lo;
+	float largest = max(extent[0], max(extent[1], extent[2]));
+	float s = largest > 0 ? size / largest : 1;
+	Vector3f middle = 0.5f * (lo + hi);
+
+	for (size_t k = 0; k < vertices.size(); k++)
+		vertices[k] = center + s * (vertices[k] - middle);
+}
+
+// area-weighted average of the normals of the faces around each vertex
+void TriangleMesh::computeNormals()
+{
+	normals.assign(vertices.size(), Vector3f(0, 0, 0));
+	for (size_t t = 0; t < faces.size(); t += 3)
+	{
+		const Vector3f &a = vertices[faces[t]], &b = vertices[faces[t + 1]], &c = vertices[faces[t + 2]];
+		Vector3f n = Vector3f::cross(b - a, c - a);
+		for (int k = 0; k < 3; k++)
+			normals[faces[t + k]] += n;
+	}
+
+	for (size_t k = 0; k < normals.size(); k++)
+		if (normals[k].absSquared() > 0)
+			normals[k].normalize();
+}
+
+void TriangleMesh::draw() const
+{
+	glBegin(GL_TRIANGLES);
+	for (size_t k = 0; k < faces.size(); k++)
+	{
+		const Vector3f &n = normals[faces[k]], &v = vertices[faces[k]];
+		glNormal3f(n[0], n[1], n[2]);
+		glVertex3f(v[0], v[1], v[2]);
+	}
+	glEnd();
+}
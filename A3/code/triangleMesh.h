@@ -0,0 +1,41 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <vector>
+#include <vecmath.h>
+
+using namespace std;
+
+// A static triangle mesh read from an OBJ file, for obstacles. Only vertex
+// positions and faces are used; polygons are split into fans, and texture
+// and normal indices ("v/vt/vn") are ignored. Smooth vertex normals are
+// computed on load for drawing.
+class TriangleMesh
+{
+public:
+	TriangleMesh(){}
+
+	// replaces the mesh with the contents of an OBJ file; false (with a
+	// message on stderr) if it cannot be read or has no triangles
+	bool load(const char *path);
+
+	// scales and moves the mesh uniformly so its bounding box is centered at
+	// center and its largest side is size long
+	void fit(const Vector3f &center, float size);
+
+	// bounding box of the vertices
+	void bounds(Vector3f &lo, Vector3f &hi) const;
+
+	int numTriangles() const { return (int)faces.size() / 3; }
+
+	void draw() const;
+
+	vector<Vector3f> vertices;
+	vector<Vector3f> normals;	// per vertex
+	vector<int> faces;	// 3 vertex indices per triangle
+
+private:
+	void computeNormals();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+// Lock-free triple buffer between one writer and one reader thread. The
+// writer fills back() and publish()es it; the reader calls update() and
+// reads front(). Neither side ever waits: the third buffer sits between
+// them, and publishing or updating is a single atomic exchange with it.
+// The reader always sees the newest complete buffer; buffers published
+// faster than they are read are simply overwritten.
+//
+// Buffers are reused in rotation, so a T holding vectors stops allocating
+// once all three have grown to size.
+template <class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer():m_back(0), m_middle(1), m_front(2){}
+
+	// writer side
+	T &back() { return m_buffers[m_back]; }
+
+	void publish()
+	{
+		m_back = __atomic_exchange_n(&m_middle, m_back | FRESH, __ATOMIC_ACQ_REL) & INDEX;
+	}
+
+	// reader side: takes the latest published buffer if there is a new one
+	bool update()
+	{
+		if (!(__atomic_load_n(&m_middle, __ATOMIC_ACQUIRE) & FRESH))
+			return false;
+		m_front = __atomic_exchange_n(&m_middle, m_front, __ATOMIC_ACQ_REL) & INDEX;
+		return true;
+	}
+
+	T &front() { return m_buffers[m_front]; }
+
+private:
+	enum { INDEX = 3, FRESH = 4 };
+
+	T m_buffers[3];
+
+	int m_back;		// owned by the writer
+	int m_middle;	// index of the shared buffer, FRESH if not read yet
+	int m_front;	// owned by the reader
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "windField.h"
+
+#include <cmath>
+
+#include "float4.h"
+#include "philox.h"
+
+namespace
+{
+	const double twoPi = 6.283185307179586;
+
+	// cos(2 pi t) from adds and multiplies only: t is reduced to
+	// [-1/2, 1/2] by rounding with the 1.5 * 2^23 trick (exact for
+	// |t| < 2^22), then the Taylor series through the 14th power, which is
+	// within 5e-6 there
+	Float4 cosTurns(Float4 t)
+	{
+		const Float4 magic(12582912.0f);
+		Float4 u = t - ((t + magic) - magic);
+		Float4 u2 = u * u;
+		Float4 r(-1.7143907f);	// -(2 pi)^14 / 14!
+		r = r * u2 + Float4(7.9035364f);
+		r = r * u2 + Float4(-26.426257f);
+		r = r * u2 + Float4(60.244641f);
+		r = r * u2 + Float4(-85.456817f);
+		r = r * u2 + Float4(64.939394f);
+		r = r * u2 + Float4(-19.739209f);
+		return r * u2 + Float4(1.0f);
+	}
+}
+
+WindField::WindField(unsigned int seed, int numModes, float wavelength, float speed)
+{
+	Philox random(seed, 0x57494e44);	// "WIND"
+	double power = 0;
+	for (int m = 0; m < numModes; m++)
+	{
+		unsigned int r[8];
+		random.generate(m, 0, 0, 0, r);
+		random.generate(m, 1, 0, 0, r + 4);
+
+		Vector3f direction(Philox::centered(r[0]), Philox::centered(r[1]), Philox::centered(r[2]));
+		if (direction.absSquared() < 1e-6f)
+			direction = Vector3f(1, 0, 0);
+		float turnsPerLength = (1 + Philox::centered(r[3])) / wavelength;
+		Vector3f k = turnsPerLength * direction.normalized();
+		Vector3f a(Philox::centered(r[4]), Philox::centered(r[5]), Philox::centered(r[6]));
+		Vector3f c = Vector3f::cross(k, a);
+
+		Mode mode;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			mode.k[axis] = k[axis];
+			mode.c[axis] = c[axis];
+		}
+		mode.frequency = speed * turnsPerLength;
+		mode.phase = Philox::centered(r[7]) + 0.5;
+		m_modes.push_back(mode);
+		power += 0.5 * c.absSquared();
+	}
+
+	float normalize = power > 0 ? (float)(1 / sqrt(power)) : 0;
+	for (size_t m = 0; m < m_modes.size(); m++)
+		for (int axis = 0; axis < 3; axis++)
+			m_modes[m].c[axis] *= normalize;
+}
+
+void WindField::add(const float *x, const float *y, const float *z, int count, double time, float scale,
+                    float *u, float *v, float *w) const
+{
+	// the time term in double, so the phases keep their precision in long
+	// runs
+	vector<float> phases(m_modes.size());
+	for (size_t m = 0; m < m_modes.size(); m++)
+	{
+		double turns = m_modes[m].frequency * time + m_modes[m].phase;
+		phases[m] = (float)(turns - floor(turns));
+	}
+
+	for (int i = 0; i < count; i += 4)
+	{
+		// the last group is padded, and goes through the same lanes
+		int lanes = count - i < 4 ? count - i : 4;
+		float px[4] = {0, 0, 0, 0}, py[4] = {0, 0, 0, 0}, pz[4] = {0, 0, 0, 0};
+		for (int l = 0; l < lanes; l++)
+		{
+			px[l] = x[i + l];
+			py[l] = y[i + l];
+			pz[l] = z[i + l];
+		}
+		Float4 X = Float4::load(px), Y = Float4::load(py), Z = Float4::load(pz);
+
+		Float4 U(0.0f), V(0.0f), W(0.0f);
+		for (size_t m = 0; m < m_modes.size(); m++)
+		{
+			const Mode &mode = m_modes[m];
+			Float4 r = cosTurns(Float4(mode.k[0]) * X + Float4(mode.k[1]) * Y + Float4(mode.k[2]) * Z + Float4(phases[m]));
+			U = U + Float4(mode.c[0]) * r;
+			V = V + Float4(mode.c[1]) * r;
+			W = W + Float4(mode.c[2]) * r;
+		}
+
+		float su[4], sv[4], sw[4];
+		(Float4(scale) * U).store(su);
+		(Float4(scale) * V).store(sv);
+		(Float4(scale) * W).store(sw);
+		for (int l = 0; l < lanes; l++)
+		{
+			u[i + l] += su[l];
+			v[i + l] += sv[l];
+			w[i + l] += sw[l];
+		}
+	}
+}
+
+Vector3f WindField::sample(const Vector3f &p, double time) const
+{
+	float u = 0, v = 0, w = 0;
+	add(&p[0], &p[1], &p[2], 1, time, 1, &u, &v, &w);
+	return Vector3f(u, v, w);
+}
@@ -0,0 +1,44 @@
+#ifndef WINDFIELD_H
+#define WINDFIELD_H
+
+#include <vector>
+#include <vecmath.h>
+
+using namespace std;
+
+// Turbulence for wind: the curl of a vector potential made of random
+// Fourier modes, psi = sum_m a_m sin(k_m . x + w_m t + phi_m), which is the
+// divergence-free velocity
+//
+//   v(x, t) = sum_m cos(k_m . x + w_m t + phi_m) (k_m x a_m).
+//
+// The modes are drawn from a Philox stream of the seed, so a field is the
+// same in every run, and scaled to a root mean square speed of 1.
+// Wavelengths are around wavelength, and the pattern drifts at around
+// speed.
+class WindField
+{
+public:
+	explicit WindField(unsigned int seed = 0, int numModes = 8, float wavelength = 4, float speed = 1);
+
+	// adds scale times the field at time to (u, v, w) for count positions
+	// (x, y, z), four at a time. Each result depends only on its own
+	// position, so any split of the positions gives the same values.
+	void add(const float *x, const float *y, const float *z, int count, double time, float scale,
+	         float *u, float *v, float *w) const;
+
+	Vector3f sample(const Vector3f &p, double time) const;
+
+private:
+	// a mode with its wave vector and frequency in turns, and k x a
+	struct Mode
+	{
+		float k[3];
+		float c[3];
+		double frequency, phase;
+	};
+
+	vector<Mode> m_modes;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "xpbd.h"
+
+#include <cmath>
+
+namespace
+{
+	// particles closer than this to an obstacle at their predicted position
+	// get a contact constraint
+	const float contactDistance = 0.1f;
+
+	// one Gauss-Seidel pass over the distance constraints of a range of one
+	// color
+	class DistanceTask:public ParallelTask
+	{
+	public:
+		const Spring *springs;
+		const int *order;
+		const float *inverseMass;
+		float *lambda;
+		float *x, *y, *z;
+		float inverseStepSquared;	// 1 / h^2
+
+		void run(int begin, int end)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				int s = order[k];
+				const Spring &spring = springs[s];
+				int i = spring.i, j = spring.j;
+
+				float wi = inverseMass[i], wj = inverseMass[j];
+				float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+				float d = sqrtf(dx*dx + dy*dy + dz*dz);
+				if (wi + wj == 0 || d == 0)
+					continue;
+
+				// compliance alpha = 1/k, scaled by the step
+				float alpha = inverseStepSquared / spring.stiff;
+				float C = d - spring.len;
+				float dlambda = (-C - alpha * lambda[s]) / (wi + wj + alpha);
+				lambda[s] += dlambda;
+
+				float cx = dlambda * dx / d, cy = dlambda * dy / d, cz = dlambda * dz / d;
+				x[i] += wi * cx; y[i] += wi * cy; z[i] += wi * cz;
+				x[j] -= wj * cx; y[j] -= wj * cy; z[j] -= wj * cz;
+			}
+		}
+	};
+}
+
+XPBD::XPBD(int iterations):m_iterations(iterations)
+{
+}
+
+void XPBD::projectContacts(ParticleState &state)
+{
+	float *x = state.pos(0), *y = state.pos(1), *z = state.pos(2);
+	for (size_t c = 0; c < m_contacts.size(); c++)
+	{
+		int i = m_contacts[c];
+		const float *plane = &m_contactPlanes[4*c];
+		float depth = plane[3] - (plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i]);
+		if (depth > 0)
+		{
+			x[i] += depth * plane[0];
+			y[i] += depth * plane[1];
+			z[i] += depth * plane[2];
+		}
+	}
+}
+
+void XPBD::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+	m_steps++;
+
+	ParticleState &state = particleSystem->getParticleState();
+	const vector<Spring> &springs = particleSystem->getSprings();
+	const vector<int> &fixed = particleSystem->getFixedParticles();
+	float h = stepSize;
+	int n = state.size();
+
+	if (particleSystem->getSpringOrder().size() != springs.size())
+		particleSystem->color_springs();
+
+	// everything but the springs, which are the constraints here
+	ParticleSystem::SpringEvaluation mode = particleSystem->getSpringEvaluation();
+	particleSystem->setSpringEvaluation(ParticleSystem::SPRINGS_CONSTRAINED);
+	evalF(particleSystem, state, m_f);
+	particleSystem->setSpringEvaluation(mode);
+
+	m_inverseMass.assign(n, 1 / particleSystem->getMass());
+	for (size_t ind = 0; ind < fixed.size(); ind++)
+		m_inverseMass[fixed[ind]] = 0;
+	if (particleSystem->getSleepingCount() > 0)
+		for (int i = 0; i < n; i++)
+			if (particleSystem->isAsleep(i))
+				m_inverseMass[i] = 0;
+
+	// prediction: v' = v + h dv/dt, and x' = x + h v' for free particles or
+	// the prescribed motion for fixed ones, as in ImplicitEuler
+	m_previous.assign(state.pos(0), state.pos(0) + 3 * n);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float *px = state.pos(axis);
+		float *pv = state.vel(axis);
+		const float *dx = m_f.pos(axis);
+		const float *dv = m_f.vel(axis);
+
+		for (int i = 0; i < n; i++)
+		{
+			pv[i] += h * dv[i];
+			px[i] += h * (dx[i] + h * dv[i]);
+		}
+	}
+
+	// contact planes at the predicted positions
+	m_contacts.clear();
+	m_contactPlanes.clear();
+	if (particleSystem->nearest_obstacles(state, m_gaps, m_gapNormals))
+		for (int i = 0; i < n; i++)
+			if (m_inverseMass[i] > 0 && m_gaps[i] < contactDistance)
+			{
+				const float normal[3] = {m_gapNormals[i], m_gapNormals[n + i], m_gapNormals[2*n + i]};
+				Vector3f p = state.position(i);
+				m_contacts.push_back(i);
+				for (int axis = 0; axis < 3; axis++)
+					m_contactPlanes.push_back(normal[axis]);
+				m_contactPlanes.push_back(normal[0] * p[0] + normal[1] * p[1] + normal[2] * p[2] - m_gaps[i]);
+			}
+
+	m_lambda.assign(springs.size(), 0);
+
+	DistanceTask task;
+	task.springs = springs.empty() ? 0 : &springs[0];
+	task.order = springs.empty() ? 0 : &particleSystem->getSpringOrder()[0];
+	task.inverseMass = &m_inverseMass[0];
+	task.lambda = springs.empty() ? 0 : &m_lambda[0];
+	task.x = state.pos(0); task.y = state.pos(1); task.z = state.pos(2);
+	task.inverseStepSquared = 1 / (h * h);
+
+	ThreadPool &pool = particleSystem->getThreadPool();
+	const vector<int> &colorStart = particleSystem->getSpringColorStart();
+	int numColors = (int)colorStart.size() - 1;
+
+	for (int iteration = 0; iteration < m_iterations; iteration++)
+	{
+		for (int c = 0; c < numColors; c++)
+		{
+			int begin = colorStart[c], end = colorStart[c + 1];
+			if (pool.size() > 1 && particleSystem->isIndependentColor(c) && end - begin >= 1024)
+				pool.parallelFor(begin, end, task, 512);
+			else
+				task.run(begin, end);
+		}
+		projectContacts(state);
+	}
+
+	// the velocity that moved the free particles where they ended up
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float *px = state.pos(axis);
+		const float *x0 = &m_previous[axis * n];
+		float *pv = state.vel(axis);
+
+		for (int i = 0; i < n; i++)
+			if (m_inverseMass[i] > 0)
+				pv[i] = (px[i] - x0[i]) / h;
+	}
+}
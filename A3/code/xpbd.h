@@ -0,0 +1,51 @@
+#ifndef XPBD_H
+#define XPBD_H
+
+#include <vector>
+
+#include "TimeStepper.hpp"
+
+// Extended position-based dynamics (Macklin, Mueller and Chentanez, "XPBD:
+// Position-Based Simulation of Compliant Constrained Dynamics"). Every
+// spring of the system becomes a distance constraint with compliance
+// 1/stiffness, the same material as the force-based steppers see, and the
+// forces evalF gives without the springs (gravity, drag, wind, fixed
+// particles) move the particles to predicted positions that the
+// constraints are then projected on, Gauss-Seidel style. Because the
+// constraints are compliant and keep their Lagrange multipliers across
+// iterations, the result approaches the implicit solution of the same
+// springs instead of getting stiffer with more iterations or smaller steps.
+//
+// Constraints are projected one spring color at a time (see
+// ParticleSystem::color_springs): the springs of a color share no
+// particle, so each color runs in parallel on the system's thread pool.
+// Particles near an obstacle at their predicted position are kept on the
+// outer side of its tangent plane there in every iteration.
+class XPBD:public TimeStepper
+{
+public:
+  XPBD(int iterations = 10);
+
+  void takeStep(ParticleSystem* particleSystem, float stepSize);
+
+  void setIterations(int iterations) { m_iterations = iterations; }
+  int getIterations() const { return m_iterations; }
+
+private:
+  // keeps the contact particles out of their obstacles
+  void projectContacts(ParticleState &state);
+
+  int m_iterations;
+
+  ParticleState m_f;
+  std::vector<float> m_previous;	// positions at the start of the step
+  std::vector<float> m_inverseMass;
+  std::vector<float> m_lambda;	// per spring
+
+  // contacts: particle, outward normal, and normal . x of the surface
+  std::vector<int> m_contacts;
+  std::vector<float> m_contactPlanes;	// 4 per contact
+  std::vector<float> m_gaps, m_gapNormals;
+};
+
+#endif